@@ -19,12 +19,100 @@ size_t mem_align(size_t size, size_t alignment) {
 // MemoryService //////////////////////
 static MemoryService GlobalMemoryService;
 MemoryService *MemoryService::instance() { return &GlobalMemoryService; }
+
+namespace {
+  struct ThreadScratch {
+    LinearAllocator *arena = nullptr;
+    uint32_t generation = 0;
+    ~ThreadScratch() {
+      if (arena)
+        GlobalMemoryService.release_scratch(arena, generation);
+    }
+  };
+  thread_local ThreadScratch Thread_Scratch;
+  thread_local uint32_t Thread_Heap_Shard = UINT32_MAX;
+  std::atomic<uint32_t> Next_Heap_Shard{0};
+
+  void heap_stats_walker(void *ptr, size_t size, int used, void *user) {
+    if (used)
+      ((MemoryStatsHeap*)user)->add(size);
+  }
+}
+
+LinearAllocator *MemoryService::scratch() {
+  MemoryService *service = &GlobalMemoryService;
+  uint32_t generation = service->generation.load(std::memory_order_acquire);
+  if (!Thread_Scratch.arena || Thread_Scratch.generation != generation) {
+    Thread_Scratch.arena = service->acquire_scratch();
+    Thread_Scratch.generation = generation;
+  }
+  return Thread_Scratch.arena;
+}
+LinearAllocator* MemoryService::acquire_scratch() {
+  std::lock_guard<std::mutex> guard(scratch_lock);
+  ScratchChunk *chunk = &scratch_chunks;
+  for(;;) {
+    for(uint32_t i = 0; i < ScratchChunk::SIZE; ++i) {
+      if (chunk->in_use[i])
+        continue;
+      chunk->in_use[i] = true;
+      if (!chunk->arenas[i].mem)
+        chunk->arenas[i].init(scratch_size);
+      else
+        chunk->arenas[i].free();
+      return &chunk->arenas[i];
+    }
+    if (!chunk->next)
+      chunk->next = new ScratchChunk;
+    chunk = chunk->next;
+  }
+}
+void MemoryService::release_scratch(LinearAllocator *arena, uint32_t generation_) {
+  std::lock_guard<std::mutex> guard(scratch_lock);
+  if (generation_ != generation.load(std::memory_order_relaxed))
+    return;
+  for(ScratchChunk *chunk = &scratch_chunks; chunk; chunk = chunk->next) {
+    if (arena >= chunk->arenas && arena < chunk->arenas + ScratchChunk::SIZE) {
+      chunk->in_use[arena - chunk->arenas] = false;
+      return;
+    }
+  }
+}
+void MemoryService::reset_scratch() {
+  std::lock_guard<std::mutex> guard(scratch_lock);
+  for(ScratchChunk *chunk = &scratch_chunks; chunk; chunk = chunk->next)
+    for(uint32_t i = 0; i < ScratchChunk::SIZE; ++i)
+      if (chunk->arenas[i].mem)
+        chunk->arenas[i].free();
+}
+
 void MemoryService::init(MemoryConfig* config) {
   std::cout << "Initializing memory service, allocating " << config->default_size << " bytes...\n";
-  system_allocator.init(config->default_size);
+  system_allocator.init(config);
+  scratch_size = config->scratch_size;
+  generation.fetch_add(1, std::memory_order_release);
 }
 void MemoryService::shutdown() { 
-  scratch_allocator.kill();
+  {
+    std::lock_guard<std::mutex> guard(scratch_lock);
+    for(ScratchChunk *chunk = &scratch_chunks; chunk; chunk = chunk->next) {
+      for(uint32_t i = 0; i < ScratchChunk::SIZE; ++i) {
+        if (chunk->arenas[i].mem)
+          chunk->arenas[i].kill();
+        chunk->in_use[i] = false;
+      }
+    }
+    // Stale arena pointers are never dereferenced, the generation check comes first
+    ScratchChunk *chunk = scratch_chunks.next;
+    while(chunk) {
+      ScratchChunk *next = chunk->next;
+      delete chunk;
+      chunk = next;
+    }
+    scratch_chunks.next = nullptr;
+    // Threads still holding an arena will take a fresh one
+    generation.fetch_add(1, std::memory_order_release);
+  }
   system_allocator.shutdown(); 
 }
 
@@ -32,102 +120,676 @@ void MemoryService::shutdown() {
 HeapAllocator::~HeapAllocator() { }
 
 void HeapAllocator::init(size_t size) {
-  memory = malloc(size);
-  limit = size;
-  handle = tlsf_create_with_pool(memory, size);
-  std::cout << "HeapAllocator, size " << size << " created...\n";
+  MemoryConfig config;
+  config.default_size = size;
+  config.heap_shards = 1;
+  config.heap_growth_size = 0;
+  init(&config);
+}
+void HeapAllocator::init(MemoryConfig *config) {
+  ABORT(config->heap_shards > 0 && config->heap_shards <= MAX_SHARDS, "HeapAllocator: invalid shard count");
+  shard_count = config->heap_shards;
+  growth_size = config->heap_growth_size;
+  max_size = config->heap_max_size;
+  limit = 0;
+  size_t shard_size = mem_align(config->default_size / shard_count, 8);
+  for(uint32_t i = 0; i < shard_count; ++i) {
+    Shard *shard = &shards[i];
+    shard->control = malloc(tlsf_size());
+    shard->handle = tlsf_create(shard->control);
+    bool ok = add_pool(shard, shard_size);
+    ABORT(ok, "HeapAllocator: failed to create initial pool");
+  }
+  std::cout << "HeapAllocator, size " << config->default_size << " in " << shard_count << " shards created...\n";
 } // init
 
 void HeapAllocator::shutdown() {
   MemoryStatsHeap stats = { 0, limit };
-  pool_t pool = tlsf_get_pool(handle);
-  tlsf_walk_pool(pool, nullptr, (void*)&stats);
-  if (stats.allocated_bytes)
+  for(uint32_t i = 0; i < shard_count; ++i) {
+    for(uint32_t p = 0; p < MAX_POOLS; ++p)
+      if (shards[i].pools[p].memory)
+        tlsf_walk_pool(shards[i].pools[p].pool, heap_stats_walker, (void*)&stats);
+  }
+  if (stats.allocated_bytes) {
     std::cerr << "FAILED TO SHUTDOWN HEAPALLOCATOR! DETECTED ALLOCATED MEMORY!\n"
       << "  Allocated: " << stats.allocated_bytes << '\n'
       << "  Total: " << stats.total_bytes << '\n';
-  else 
+#if defined MEM_STATS
+    tracker.report(std::cerr);
+#endif
+  } else {
     std::cout << "HeapAllocator successfully shutdown! All memory free!\n";
+  }
+#if defined MEM_STATS
+  tracker.kill();
+#endif
 
   assert(stats.allocated_bytes == 0 && "MEMORY IS STILL ALLOCATED\n");
-  tlsf_destroy(handle);
-  free(memory);
+  for(uint32_t i = 0; i < shard_count; ++i) {
+    Shard *shard = &shards[i];
+    for(uint32_t p = 0; p < MAX_POOLS; ++p) {
+      uint8_t *memory = shard->pools[p].memory;
+      if (!memory)
+        continue;
+      free(memory);
+      shard->pools[p].memory = nullptr;
+      shard->pools[p].size = 0;
+      shard->pools[p].pool = nullptr;
+      shard->pools[p].used = 0;
+    }
+    tlsf_destroy(shard->handle);
+    free(shard->control);
+    shard->handle = nullptr;
+    shard->control = nullptr;
+  }
+  shard_count = 0;
+  limit = 0;
+  range_count = 0;
 } // shutdown
 
+HeapAllocator::Shard *HeapAllocator::home_shard() {
+  if (Thread_Heap_Shard == UINT32_MAX)
+    Thread_Heap_Shard = Next_Heap_Shard.fetch_add(1, std::memory_order_relaxed);
+  return &shards[Thread_Heap_Shard % shard_count];
+}
+HeapAllocator::Shard *HeapAllocator::find_shard(void *ptr, uint32_t *pool_index) {
+  uintptr_t p = (uintptr_t)ptr;
+  for(;;) {
+    uint32_t seq = range_seq.load(std::memory_order_acquire);
+    if (seq & 1)
+      continue;
+    // A torn count is caught by the seq check below, clamp it so the search stays in bounds
+    uint32_t count = range_count.load(std::memory_order_relaxed);
+    count = count < MAX_SHARDS * MAX_POOLS ? count : MAX_SHARDS * MAX_POOLS;
+    uint32_t lo = 0, hi = count;
+    while(lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      if (ranges[mid].end.load(std::memory_order_relaxed) <= p)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    uint32_t owner = UINT32_MAX;
+    if (lo < count && ranges[lo].begin.load(std::memory_order_relaxed) <= p)
+      owner = ranges[lo].owner.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (range_seq.load(std::memory_order_relaxed) != seq)
+      continue;
+    if (owner == UINT32_MAX)
+      return nullptr;
+    *pool_index = owner % MAX_POOLS;
+    return &shards[owner / MAX_POOLS];
+  }
+}
+void HeapAllocator::insert_range(uint8_t *memory, size_t size, uint32_t owner) {
+  std::lock_guard<std::mutex> guard(range_lock);
+  uint32_t count = range_count.load(std::memory_order_relaxed);
+  uint32_t seq = range_seq.load(std::memory_order_relaxed);
+  range_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  uintptr_t begin = (uintptr_t)memory;
+  uint32_t i = count;
+  for(; i > 0 && ranges[i - 1].begin.load(std::memory_order_relaxed) > begin; --i) {
+    ranges[i].begin.store(ranges[i - 1].begin.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ranges[i].end.store(ranges[i - 1].end.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ranges[i].owner.store(ranges[i - 1].owner.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  ranges[i].begin.store(begin, std::memory_order_relaxed);
+  ranges[i].end.store(begin + size, std::memory_order_relaxed);
+  ranges[i].owner.store(owner, std::memory_order_relaxed);
+  range_count.store(count + 1, std::memory_order_relaxed);
+  range_seq.store(seq + 2, std::memory_order_release);
+}
+void HeapAllocator::remove_range(uint8_t *memory) {
+  std::lock_guard<std::mutex> guard(range_lock);
+  uint32_t count = range_count.load(std::memory_order_relaxed);
+  uint32_t i = 0;
+  while(i < count && ranges[i].begin.load(std::memory_order_relaxed) != (uintptr_t)memory)
+    ++i;
+  if (i == count)
+    return;
+  uint32_t seq = range_seq.load(std::memory_order_relaxed);
+  range_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for(; i + 1 < count; ++i) {
+    ranges[i].begin.store(ranges[i + 1].begin.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ranges[i].end.store(ranges[i + 1].end.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ranges[i].owner.store(ranges[i + 1].owner.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  range_count.store(count - 1, std::memory_order_relaxed);
+  range_seq.store(seq + 2, std::memory_order_release);
+}
+
+bool HeapAllocator::add_pool(Shard *shard, size_t size) {
+  uint32_t slot = MAX_POOLS;
+  for(uint32_t i = 0; i < MAX_POOLS; ++i) {
+    if (!shard->pools[i].memory.load(std::memory_order_relaxed)) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot == MAX_POOLS)
+    return false;
+  size = mem_align(size, 8);
+  // Claim the bytes before reserving them, shards grow under their own locks
+  size_t current = limit.load(std::memory_order_relaxed);
+  do {
+    if (max_size && current + size > max_size)
+      return false;
+  } while(!limit.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+
+  uint8_t *memory = (uint8_t*)malloc(size);
+  pool_t pool = memory ? tlsf_add_pool(shard->handle, memory, size) : nullptr;
+  if (!pool) {
+    free(memory);
+    limit -= size;
+    return false;
+  }
+  Pool *p = &shard->pools[slot];
+  p->pool = pool;
+  p->used = 0;
+  p->size.store(size, std::memory_order_relaxed);
+  p->memory.store(memory, std::memory_order_relaxed);
+  insert_range(memory, size, (uint32_t)(shard - shards) * MAX_POOLS + slot);
+  return true;
+}
+void *HeapAllocator::pool_allocate(Shard *shard, size_t size, size_t alignment) {
+  void *ptr = alignment == 1 ? tlsf_malloc(shard->handle, size) : tlsf_memalign(shard->handle, alignment, size);
+  if (!ptr)
+    return nullptr;
+  uint32_t pool_index;
+  find_shard(ptr, &pool_index);
+  shard->pools[pool_index].used += tlsf_block_size(ptr);
+  return ptr;
+}
+void HeapAllocator::pool_release(Shard *shard, uint32_t pool_index, size_t size) {
+  Pool *p = &shard->pools[pool_index];
+  p->used -= size;
+  if (p->used || pool_index == 0)
+    return;
+
+  // Completely free: give it back
+  uint8_t *memory = p->memory.load(std::memory_order_relaxed);
+  size_t pool_size = p->size.load(std::memory_order_relaxed);
+  remove_range(memory);
+  p->memory.store(nullptr, std::memory_order_relaxed);
+  tlsf_remove_pool(shard->handle, p->pool);
+  p->pool = nullptr;
+  p->size.store(0, std::memory_order_relaxed);
+  limit -= pool_size;
+  free(memory);
+}
+
+void *HeapAllocator::shard_allocate(size_t size, size_t alignment) {
+  Shard *home = home_shard();
+  uint32_t start = home - shards;
+  void *allocated_mem = nullptr;
+
+  // Skip busy shards first, only wait on a lock if every shard was busy or full
+  for(uint32_t pass = 0; pass < 2 && !allocated_mem; ++pass) {
+    for(uint32_t i = 0; i < shard_count && !allocated_mem; ++i) {
+      Shard *shard = &shards[(start + i) % shard_count];
+      if (pass == 0) {
+        if (!shard->lock.try_lock())
+          continue;
+      } else {
+        shard->lock.lock();
+      }
+      allocated_mem = pool_allocate(shard, size, alignment);
+      shard->lock.unlock();
+    }
+  }
+  if (!allocated_mem && growth_size) {
+    std::lock_guard<std::mutex> guard(home->lock);
+    // Room for the block, its header and any alignment gap. TLSF searches from the next size class 
+    // up (classes are 1/32 of a power of 2 apart), so a pool of exactly this size is not enough
+    size_t needed = size + size / 16 + alignment + tlsf_pool_overhead() + tlsf_alloc_overhead() + tlsf_block_size_min();
+    if (add_pool(home, needed > growth_size ? needed : growth_size)) {
+      allocated_mem = pool_allocate(home, size, alignment);
+      if (!allocated_mem) {
+        for(uint32_t i = MAX_POOLS - 1; i > 0; --i) {
+          if (home->pools[i].memory.load(std::memory_order_relaxed) && home->pools[i].used == 0) {
+            pool_release(home, i, 0);
+            break;
+          }
+        }
+      }
+    }
+  }
+  if (allocated_mem)
+    allocated += tlsf_block_size(allocated_mem);
+  return allocated_mem;
+}
+void HeapAllocator::shard_free(void *ptr) {
+  uint32_t pool_index;
+  Shard *shard = find_shard(ptr, &pool_index);
+  DEBUG_ABORT(shard, "HeapAllocator: pointer is not from this allocator");
+  size_t size = tlsf_block_size(ptr);
+  allocated -= size;
+  std::lock_guard<std::mutex> guard(shard->lock);
+  tlsf_free(shard->handle, ptr);
+  pool_release(shard, pool_index, size);
+}
+
   /* General API */
 void *HeapAllocator::allocate(size_t size, size_t alignment) { 
-  void *allocated_mem = alignment == 1 ? tlsf_malloc(handle, size) : tlsf_memalign(handle, alignment, size);
-  size_t actual_size = tlsf_block_size(allocated_mem);
-  allocated += actual_size;
+  return allocate_at(size, alignment, nullptr, 0);
+}
+void *HeapAllocator::reallocate(size_t size, void* ptr) { 
+  return reallocate_at(size, ptr, nullptr, 0);
+}
+void *HeapAllocator::reallocate(size_t size, void* ptr, size_t old_size, size_t alignment) { 
+  return reallocate_at(size, ptr, nullptr, 0, alignment);
+}
+void HeapAllocator::deallocate(void* ptr) {
+  if (!ptr)
+    return;
+#if defined MEM_STATS
+  tracker.remove(ptr);
+#endif
+  shard_free(ptr);
+} 
+
+void *HeapAllocator::allocate_at(size_t size, size_t alignment, const char *file, int line) { 
+  void *allocated_mem = shard_allocate(size, alignment);
 #if defined MEM_STATS 
-  active_allocations->push_back(allocated_mem);
+  if (allocated_mem)
+    tracker.add(allocated_mem, tlsf_block_size(allocated_mem), file, line);
 #endif
   return allocated_mem;
 }
-void *HeapAllocator::reallocate(size_t size, void* ptr) { 
-  void *allocated_mem = tlsf_realloc(handle, ptr, size);
-  size_t actual_size = tlsf_block_size(allocated_mem);
-  allocated += actual_size;
+void *HeapAllocator::reallocate_at(size_t size, void* ptr, const char *file, int line, size_t alignment) { 
+  if (!ptr)
+    return allocate_at(size, alignment, file, line);
+  if (size == 0) {
+    deallocate(ptr);
+    return nullptr;
+  }
+
+  uint32_t pool_index;
+  Shard *shard = find_shard(ptr, &pool_index);
+  DEBUG_ABORT(shard, "HeapAllocator::reallocate: pointer is not from this allocator");
+  size_t old_size = tlsf_block_size(ptr);
+#if defined MEM_STATS
+  // Drop the entry while ptr is still ours, once it is freed another thread can be handed the 
+  // same address and add it first
+  tracker.remove(ptr);
+#endif
+  void *allocated_mem = nullptr;
+  // tlsf_realloc only keeps TLSF's own alignment, an over aligned block moves through shard_allocate
+  if (alignment <= tlsf_align_size()) {
+    std::lock_guard<std::mutex> guard(shard->lock);
+    // Hold the old block's bytes in its pool until the new block is accounted for, 
+    // so the pool cannot be released under a block that tlsf_realloc kept in place
+    allocated_mem = tlsf_realloc(shard->handle, ptr, size);
+    if (allocated_mem) {
+      uint32_t new_index;
+      find_shard(allocated_mem, &new_index);
+      shard->pools[new_index].used += tlsf_block_size(allocated_mem);
+      pool_release(shard, pool_index, old_size);
+    }
+  }
+  if (allocated_mem) {
+    allocated -= old_size;
+    allocated += tlsf_block_size(allocated_mem);
+  } else {
+    // Owning shard is full or the block is over aligned, move to another one
+    allocated_mem = shard_allocate(size, alignment);
+    if (!allocated_mem) {
+#if defined MEM_STATS
+      tracker.add(ptr, old_size, file, line);
+#endif
+      return nullptr;
+    }
+    mem_cpy(allocated_mem, ptr, old_size < size ? old_size : size);
+    shard_free(ptr);
+  }
+#if defined MEM_STATS
+  tracker.add(allocated_mem, tlsf_block_size(allocated_mem), file, line);
+#endif
   return allocated_mem;
 }
-void HeapAllocator::deallocate(void* ptr) {
-  size_t actual_size = tlsf_block_size(ptr);
-  allocated -= actual_size;
-  tlsf_free(handle, ptr);
+
 #if defined MEM_STATS
-  // TODO: make this use SIMD to scan the pointers...
-  for(size_t i = 0; i < active_allocations->size(); ++i) {
-    if ((*active_allocations)[i] == ptr) {
-      size_t last_index = active_allocations->size() - 1;
-      void* item = (*active_allocations)[last_index];
-      (*active_allocations)[i] = item;   
-      active_allocations->pop_back();
+// AllocationTracker //////////////////
+namespace {
+  inline size_t hash_ptr(const void *ptr) {
+    uint64_t h = (uint64_t)(uintptr_t)ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (size_t)h;
+  }
+}
+
+size_t AllocationTracker::find(void *ptr) {
+  size_t mask = cap - 1;
+  for(size_t i = hash_ptr(ptr) & mask;; i = (i + 1) & mask) {
+    if (entries[i].ptr == ptr || entries[i].ptr == nullptr)
+      return i;
+  }
+}
+uint32_t AllocationTracker::find_site(const char *file, int line) {
+  if (site_count * 4 >= site_cap * 3) {
+    uint32_t new_cap = site_cap ? site_cap * 2 : 64;
+    sites = (Site*)realloc(sites, new_cap * sizeof(Site));
+    ::free(site_table);
+    site_table = (uint32_t*)calloc(new_cap, sizeof(uint32_t));
+    site_cap = new_cap;
+    for(uint32_t s = 0; s < site_count; ++s) {
+      size_t i = hash_ptr((const uint8_t*)sites[s].file + sites[s].line) & (site_cap - 1);
+      while(site_table[i])
+        i = (i + 1) & (site_cap - 1);
+      site_table[i] = s + 1;
+    }
+  }
+
+  // file is always a string literal from __FILE__, so the pointer identifies it
+  size_t i = hash_ptr((const uint8_t*)file + line) & (site_cap - 1);
+  for(;; i = (i + 1) & (site_cap - 1)) {
+    uint32_t s = site_table[i];
+    if (s == 0)
+      break;
+    if (sites[s - 1].file == file && sites[s - 1].line == line)
+      return s - 1;
+  }
+  site_table[i] = site_count + 1;
+  sites[site_count] = { file, line, 0, 0, 0, 0, 0 };
+  return site_count++;
+}
+void AllocationTracker::grow() {
+  Entry *old = entries;
+  size_t old_cap = cap;
+  cap = cap ? cap * 2 : 1024;
+  entries = (Entry*)calloc(cap, sizeof(Entry));
+  for(size_t i = 0; i < old_cap; ++i)
+    if (old[i].ptr)
+      entries[find(old[i].ptr)] = old[i];
+  ::free(old);
+}
+
+void AllocationTracker::add(void *ptr, size_t size, const char *file, int line) {
+  std::lock_guard<std::mutex> guard(lock);
+  if ((len + 1) * 10 >= cap * 7)
+    grow();
+
+  uint32_t s = find_site(file, line);
+  Site *site = &sites[s];
+  site->live_bytes += size;
+  site->total_bytes += size;
+  ++site->live_count;
+  ++site->total_count;
+  if (site->live_bytes > site->peak_bytes)
+    site->peak_bytes = site->live_bytes;
+
+  size_t i = find(ptr);
+  if (!entries[i].ptr)
+    ++len;
+  entries[i] = { ptr, size, s };
+}
+void AllocationTracker::remove(void *ptr) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (!cap)
+    return;
+  size_t mask = cap - 1;
+  size_t i = find(ptr);
+  if (!entries[i].ptr)
+    return;
+
+  Site *site = &sites[entries[i].site];
+  site->live_bytes -= entries[i].size;
+  --site->live_count;
+  --len;
+
+  // Backward shift: pull later entries of the probe run into the hole so lookups never see a gap
+  size_t hole = i;
+  for(size_t j = (i + 1) & mask; entries[j].ptr; j = (j + 1) & mask) {
+    size_t home = hash_ptr(entries[j].ptr) & mask;
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      entries[hole] = entries[j];
+      hole = j;
     }
   }
+  entries[hole].ptr = nullptr;
+}
+size_t AllocationTracker::count() {
+  std::lock_guard<std::mutex> guard(lock);
+  return len;
+}
+void AllocationTracker::report(std::ostream &out) {
+  std::lock_guard<std::mutex> guard(lock);
+  for(uint32_t s = 0; s < site_count; ++s) {
+    Site *site = &sites[s];
+    if (!site->live_count)
+      continue;
+    out << "  " << (site->file ? site->file : "<no call site>") << ":" << site->line 
+        << " live: " << site->live_bytes << " bytes in " << site->live_count << " allocations"
+        << " (peak " << site->peak_bytes << ", total " << site->total_bytes << " in " << site->total_count << ")\n";
+  }
+}
+void AllocationTracker::kill() {
+  std::lock_guard<std::mutex> guard(lock);
+  ::free(entries);
+  ::free(sites);
+  ::free(site_table);
+  entries = nullptr;
+  sites = nullptr;
+  site_table = nullptr;
+  cap = 0;
+  len = 0;
+  site_count = 0;
+  site_cap = 0;
+}
 #endif
-} 
 
 // LinearAllocator ////////////////////
 LinearAllocator::~LinearAllocator() { }
 
-void *LinearAllocator::reallocate(size_t size, void* ptr) { return nullptr; }
-void LinearAllocator::deallocate(void* ptr) { }
+static inline uint8_t* block_mem(LinearAllocator::Block *b) {
+  return (uint8_t*)b + mem_align(sizeof(LinearAllocator::Block), 16);
+}
 
 void LinearAllocator::init(size_t size) {
-  mem = (uint8_t*)malloc(size);
-  cap = size;
+  block_size = size;
+  head = nullptr;
+  block = nullptr;
+  adopted = nullptr;
+  borrowed = false;
+  bool ok = next_block(size);
+  ABORT(ok, "Linear Allocator: failed to allocate first block");
 }
+void LinearAllocator::init(void *buffer, size_t size, size_t block_size_) {
+  size_t header = mem_align(sizeof(Block), 16);
+  uint8_t *aligned = (uint8_t*)mem_align((uintptr_t)buffer, 16);
+  size_t padding = aligned - (uint8_t*)buffer;
+  ABORT(size >= header + padding, "Linear Allocator: borrowed buffer too small");
+
+  Block *b = (Block*)aligned;
+  b->next = nullptr;
+  b->cap = size - header - padding;
+  head = b;
+  block = nullptr;
+  adopted = nullptr;
+  block_size = block_size_;
+  borrowed = true;
+  use_block(b);
+}
+void LinearAllocator::adopt(LinearAllocator *other) {
+  Block *first = other->borrowed ? other->head->next : other->head;
+  if (first) {
+    // Kept off the allocation chain, so next_block and restore never hand them out again and head
+    // stays the first block
+    Block *end = first;
+    while(end->next)
+      end = end->next;
+    end->next = adopted;
+    adopted = first;
+  }
+  if (other->adopted) {
+    Block *end = other->adopted;
+    while(end->next)
+      end = end->next;
+    end->next = adopted;
+    adopted = other->adopted;
+    other->adopted = nullptr;
+  }
+  if (other->borrowed && other->head)
+    other->head->next = nullptr;
+  else
+    other->head = nullptr;
+  other->block = nullptr;
+  other->mem = nullptr;
+  other->cap = 0;
+  other->alloced = 0;
+  other->last = nullptr;
+}
+void LinearAllocator::use_block(Block *b) {
+  block = b;
+  mem = block_mem(b);
+  cap = b->cap;
+  alloced = 0;
+  last = nullptr;
+}
+bool LinearAllocator::next_block(size_t size) {
+  if (block && block->next && block->next->cap >= size) {
+    use_block(block->next);
+    return true;
+  }
+  if (size < block_size)
+    size = block_size;
+  Block *b = (Block*)malloc(mem_align(sizeof(Block), 16) + size);
+  if (!b)
+    return false;
+  b->cap = size;
+  // Insert after the current block, anything further down the chain is still reusable
+  if (block) {
+    b->next = block->next;
+    block->next = b;
+  } else {
+    b->next = nullptr;
+    head = b;
+  }
+  use_block(b);
+  return true;
+}
+
 void *LinearAllocator::allocate(size_t size, size_t alignment) {
-  size_t pad = mem_align(size, alignment) - size;
+  uintptr_t base = (uintptr_t)mem;
+  size_t offset = mem_align(base + alloced, alignment) - base;
+  if (offset + size > cap) {
+    if (!next_block(size + alignment))
+      return nullptr;
+    base = (uintptr_t)mem;
+    offset = mem_align(base, alignment) - base;
+  }
+#ifdef MEM_STATS
+  stats.alloc(offset + size - alloced);
+#endif
+  last = mem + offset;
+  alloced = offset + size;
+  return (void*)last;
+}
+void *LinearAllocator::reallocate(size_t size, void* ptr) { 
+  if (!ptr || ptr != last || (size_t)(last - mem) + size > cap)
+    return nullptr;
+  size_t end = (last - mem) + size;
 #ifdef MEM_STATS
-  stats.alloc(size + pad);
+  if (end > alloced)
+    stats.alloc(end - alloced);
+  else
+    stats.dealloc(alloced - end);
 #endif
-  void* ptr = (void*)(mem + alloced + pad);
-  alloced += pad + size;
-  ABORT(alloced < cap, "Linear Allocator: Overflow");
+  alloced = end;
   return ptr;
 }
+void *LinearAllocator::reallocate(size_t size, void* ptr, size_t old_size) { 
+  return reallocate(size, ptr, old_size, 16);
+}
+void *LinearAllocator::reallocate(size_t size, void* ptr, size_t old_size, size_t alignment) { 
+  if (!ptr)
+    return allocate(size, alignment);
+  void *in_place = reallocate(size, ptr);
+  if (in_place)
+    return in_place;
+
+  void *new_ptr = allocate(size, alignment);
+  if (new_ptr)
+    mem_cpy(new_ptr, ptr, old_size < size ? old_size : size);
+  return new_ptr;
+}
+void LinearAllocator::deallocate(void* ptr) { 
+  if (!ptr || ptr != last)
+    return;
+#ifdef MEM_STATS
+  stats.dealloc(alloced - (last - mem));
+#endif
+  alloced = last - mem;
+  last = nullptr;
+}
+
+LinearAllocator::Marker LinearAllocator::mark() {
+  Marker marker;
+  marker.block = block;
+  marker.alloced = alloced;
+#ifdef MEM_STATS
+  marker.stats_alloced = stats.alloced;
+#endif
+  return marker;
+}
+void LinearAllocator::restore(Marker marker) {
+  // A marker taken before the first block existed frees everything
+  if (!marker.block) {
+    if (head)
+      use_block(head);
+  } else if (marker.block != block) {
+    use_block(marker.block);
+  }
+  alloced = marker.alloced;
+  last = nullptr;
+#ifdef MEM_STATS
+  stats.alloced = marker.stats_alloced;
+#endif
+}
+
 void LinearAllocator::cut(size_t size) {
   alloced -= size;
+  last = nullptr;
 #ifdef MEM_STATS
   stats.dealloc(size); 
 #endif
 }
+static void free_chain(LinearAllocator::Block *b) {
+  while(b) {
+    LinearAllocator::Block *next = b->next;
+    ::free((void*)b);
+    b = next;
+  }
+}
 void LinearAllocator::free() {
-  alloced = 0;
+  if (head)
+    use_block(head);
+  free_chain(adopted);
+  adopted = nullptr;
 #ifdef MEM_STATS 
   stats.dealloc(stats.alloced);
 #endif
 }
 void LinearAllocator::kill() { 
-  std::cout << "Linear allocator freed\n";
+  // Silent: arenas are killed with every document, not once per process
 #ifdef MEM_STATS
-  std::cout << "        Remaining Allocation size in LinearAllocator: " << stats.alloced << '\n';
   stats.alloced = 0;
 #endif
-  cap = 0; 
   DEBUG_ABORT(mem, "Linear Allocator: free nullptr");
-  ::free((void*)mem);
+  free_chain(borrowed ? head->next : head);
+  free_chain(adopted);
+  head = nullptr;
+  adopted = nullptr;
+  block = nullptr;
+  mem = nullptr;
+  last = nullptr;
+  borrowed = false;
+  cap = 0; 
+  alloced = 0;
 }
 
 } // namespace Sol
@@ -4,6 +4,9 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <atomic>
+#include <mutex>
+#include <ostream>
 #include <vector>
 
 #include "tlsf.h"
@@ -38,81 +41,267 @@ struct MemoryStatsLinear {
     alloced -= s;
   }
 };
-static std::vector<void*> Global_Allocation_Tracker;
+#if defined MEM_STATS
+// Live heap allocations in an open addressing table keyed on the pointer (linear probing, 
+// backward shift deletion), plus bytes per allocating call site, so tracking is O(1) per call.
+// Storage comes from malloc so the tracker never shows up in its own numbers.
+struct AllocationTracker {
+  struct Entry {
+    void *ptr;
+    size_t size;
+    uint32_t site;
+  };
+  struct Site {
+    const char *file; // nullptr for allocations which did not come through the mem_* macros
+    int line;
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t total_bytes;
+    size_t live_count;
+    size_t total_count;
+  };
+
+  Entry *entries = nullptr;
+  size_t cap = 0; // always a power of 2
+  size_t len = 0;
+  uint32_t *site_table = nullptr; // open addressing table of indices into sites, +1 (0 is empty)
+  Site *sites = nullptr;
+  uint32_t site_count = 0;
+  uint32_t site_cap = 0;
+  std::mutex lock;
+
+  void add(void *ptr, size_t size, const char *file, int line);
+  void remove(void *ptr);
+  size_t count();
+  // print the call sites which still have live allocations
+  void report(std::ostream &out);
+  void kill();
+
+  size_t find(void *ptr);
+  uint32_t find_site(const char *file, int line);
+  void grow();
+};
+#endif
 
 struct Allocator {
   virtual ~Allocator() {}
   virtual void *allocate(size_t size, size_t alignment) = 0;
   virtual void *reallocate(size_t size, void* ptr) = 0;
+  // For allocators which do not know the size of their allocations
+  virtual void *reallocate(size_t size, void* ptr, size_t old_size) { return reallocate(size, ptr); }
+  // Same, keeping alignment if the block has to move
+  virtual void *reallocate(size_t size, void* ptr, size_t old_size, size_t alignment) = 0;
   virtual void deallocate(void* ptr) = 0; 
 };
 
+struct MemoryConfig;
+
+// Thread safe: the heap is split into shards, each a TLSF instance behind its own lock.
+// Threads start at a shard picked from their id and move on to the next shard if it is busy, 
+// frees go back to the shard which owns the address.
+// Each shard starts with one pool. When every shard is full the calling thread's shard gets a 
+// new pool (tlsf_add_pool), and extra pools are handed back to the system once they are empty.
 struct HeapAllocator : public Allocator {
   ~HeapAllocator() override;
 
-  void *handle;
-  void *memory;
-  size_t allocated = 0;
-  size_t limit = 0;
+  static constexpr uint32_t MAX_SHARDS = 16;
+  static constexpr uint32_t MAX_POOLS = 32;
+
+  struct Pool {
+    std::atomic<uint8_t*> memory{nullptr};
+    std::atomic<size_t> size{0};
+    pool_t pool = nullptr;
+    size_t used = 0; // bytes in live blocks, guarded by the shard lock
+  };
+  struct Shard {
+    std::mutex lock;
+    void *handle = nullptr;
+    void *control = nullptr;
+    Pool pools[MAX_POOLS]; // pools[0] is the initial pool, it is never released
+  };
+  // Address range of a pool, owner is shard * MAX_POOLS + pool
+  struct PoolRange {
+    std::atomic<uintptr_t> begin{0};
+    std::atomic<uintptr_t> end{0};
+    std::atomic<uint32_t> owner{0};
+  };
+
+  Shard shards[MAX_SHARDS];
+  // Every pool's range sorted by address, so finding the owner of a pointer is a binary search.
+  // Written under range_lock as pools come and go, read without a lock: range_seq is odd while a
+  // write is in progress and readers retry if it changed under them.
+  PoolRange ranges[MAX_SHARDS * MAX_POOLS];
+  std::atomic<uint32_t> range_count{0};
+  std::atomic<uint32_t> range_seq{0};
+  std::mutex range_lock;
+  uint32_t shard_count = 0;
+  std::atomic<size_t> allocated{0};
+  // bytes currently reserved from the system across all pools
+  std::atomic<size_t> limit{0};
+  // minimum size of pools added on demand, 0 disables growth
+  size_t growth_size = 0;
+  // cap on limit, 0 for no cap
+  size_t max_size = 0;
 #if defined MEM_STATS
-  std::vector<void*>* active_allocations = &Global_Allocation_Tracker;
+  AllocationTracker tracker;
 #endif
 
   /* Initialize/Kill service */
   void init(size_t size);
+  void init(MemoryConfig *config);
   void shutdown();
 
+  Shard* home_shard();
+  Shard* find_shard(void *ptr, uint32_t *pool_index);
+  void *shard_allocate(size_t size, size_t alignment);
+  void shard_free(void *ptr);
+  // shard must be locked
+  bool add_pool(Shard *shard, size_t size);
+  void insert_range(uint8_t *memory, size_t size, uint32_t owner);
+  void remove_range(uint8_t *memory);
+  void *pool_allocate(Shard *shard, size_t size, size_t alignment);
+  void pool_release(Shard *shard, uint32_t pool_index, size_t size);
+
   /* General API */
   void *allocate(size_t size, size_t alignment) override;
   void *reallocate(size_t size, void* ptr) override;
+  void *reallocate(size_t size, void* ptr, size_t old_size, size_t alignment) override;
   void deallocate(void* ptr) override; 
+  // Same as above, recording the call site under MEM_STATS
+  void *allocate_at(size_t size, size_t alignment, const char *file, int line);
+  // alignment is kept when the block has to move, 1 for the allocator's default
+  void *reallocate_at(size_t size, void* ptr, const char *file, int line, size_t alignment = 1);
 };
 
+// Bump allocator over a chain of blocks. When the current block is full the next block in the 
+// chain is reused if it is big enough, otherwise a new block is malloc'd, so allocate() only 
+// fails (returns nullptr) when the system is out of memory. 
+// free() and restore() keep the blocks for reuse, kill() gives them back.
 struct LinearAllocator : public Allocator {
   ~LinearAllocator() override;
 
+  struct Block {
+    Block *next;
+    size_t cap;
+  };
+  struct Marker {
+    Block *block;
+    size_t alloced;
+#ifdef MEM_STATS
+    size_t stats_alloced;
+#endif
+  };
+
+  Block *head = nullptr;
+  Block *block = nullptr;
+  // blocks taken over by adopt(), full and never allocated from, freed by free() and kill()
+  Block *adopted = nullptr;
+  // current block's memory
   uint8_t *mem = nullptr;
   size_t cap = 0;
   size_t alloced = 0;
+  // minimum size of new blocks
+  size_t block_size = 0;
+  // the most recent allocation can be grown, shrunk or freed in place
+  uint8_t *last = nullptr;
+  // head is memory owned by someone else (see init(buffer, size))
+  bool borrowed = false;
 
   void init(size_t size);
+  // Use buffer as the first block, overflow chains malloc'd blocks of at least block_size_
+  void init(void *buffer, size_t size, size_t block_size_);
+  // Take over the malloc'd blocks of other (which is left empty), so they are freed with this.
+  // The blocks of this are untouched, allocation carries on where it was.
+  void adopt(LinearAllocator *other);
   void cut(size_t size);
   void free();
   void kill();
 
+  Marker mark();
+  // Free everything allocated since the marker was taken
+  void restore(Marker marker);
+
   /* General API */
   void *allocate(size_t size, size_t alignment) override;
+  // Only possible in place, on the most recent allocation
   void *reallocate(size_t size, void* ptr) override;
+  void *reallocate(size_t size, void* ptr, size_t old_size) override;
+  void *reallocate(size_t size, void* ptr, size_t old_size, size_t alignment) override;
+  // Only reclaims the most recent allocation
   void deallocate(void* ptr) override; 
 #ifdef MEM_STATS
   MemoryStatsLinear stats;
 #endif
+
+  bool next_block(size_t size);
+  void use_block(Block *b);
 };
 
 struct MemoryConfig {
   size_t default_size = 32 * 1024 * 1024;
+  // size of the first block of each thread's scratch arena, they grow by chaining more
+  size_t scratch_size = 1024 * 1024;
+  uint32_t heap_shards = 4;
+  // minimum size of a pool added when the heap is full, 0 keeps the heap at default_size
+  size_t heap_growth_size = 32 * 1024 * 1024;
+  // the heap will not reserve more than this from the system, 0 for no limit
+  size_t heap_max_size = 0;
 };
 
 struct MemoryService {
+  // Scratch arenas live in chunks which never move, threads keep pointers into them. More chunks
+  // are chained on as threads need them.
+  struct ScratchChunk {
+    static constexpr uint32_t SIZE = 64;
+    LinearAllocator arenas[SIZE];
+    bool in_use[SIZE] = {};
+    ScratchChunk *next = nullptr;
+  };
+
   HeapAllocator system_allocator;
-  LinearAllocator scratch_allocator;
+  // One scratch arena per thread, handed out lazily by scratch(). A slot returns to the 
+  // free list when its thread exits, its memory is kept for the next thread to take it.
+  ScratchChunk scratch_chunks;
+  std::mutex scratch_lock;
+  size_t scratch_size = 0;
+  // Bumped by init and shutdown, threads holding an arena from an older generation take a new one
+  std::atomic<uint32_t> generation{0};
+
   // return a pointer to an instance of a static MemoryService
   static MemoryService* instance();
+  // return the calling thread's scratch arena
+  static LinearAllocator* scratch();
   void init(MemoryConfig* config);
   // free all memory associated with the service
   void shutdown();
+
+  // Reset every thread's scratch arena at once. No thread may be using its arena.
+  void reset_scratch();
+  LinearAllocator* acquire_scratch();
+  void release_scratch(LinearAllocator *arena, uint32_t generation_);
+};
+
+// Restores the arena to where it was when the scope was entered
+struct ScratchScope {
+  LinearAllocator *arena;
+  LinearAllocator::Marker marker;
+
+  ScratchScope(LinearAllocator *arena_ = MemoryService::scratch()) : arena(arena_), marker(arena_->mark()) {}
+  ~ScratchScope() { arena->restore(marker); }
+  ScratchScope(const ScratchScope&) = delete;
+  ScratchScope& operator=(const ScratchScope&) = delete;
 };
 
 inline void mem_cpy(void* to, void* from, size_t size);
 
-#define lin_alloca(size, alignment) ((Sol::MemoryService::instance()->scratch_allocator).allocate(size, alignment))
+#define lin_alloca(size, alignment) (Sol::MemoryService::scratch()->allocate(size, alignment))
 #define mem_cpy(to, from, size) (memcpy(to, from, size))
 
 #define mem_alloc2(size, alignment, alloc) ((alloc)->allocate(size, alignment))
-#define mem_alloca(size, alignment) ((Sol::MemoryService::instance()->system_allocator).allocate(size, alignment))
-#define mem_alloc(size) ((Sol::MemoryService::instance()->system_allocator).allocate(size, 1))
+#define mem_alloca(size, alignment) ((Sol::MemoryService::instance()->system_allocator).allocate_at(size, alignment, __FILE__, __LINE__))
+#define mem_alloc(size) ((Sol::MemoryService::instance()->system_allocator).allocate_at(size, 1, __FILE__, __LINE__))
 
-#define mem_realloc(size, ptr) ((Sol::MemoryService::instance()->system_allocator).reallocate(size, (void*)(ptr)))
+#define mem_realloc(size, ptr) ((Sol::MemoryService::instance()->system_allocator).reallocate_at(size, (void*)(ptr), __FILE__, __LINE__))
 #define mem_free(ptr) ((Sol::MemoryService::instance()->system_allocator).deallocate((void*)(ptr)))
 
 } // Sol
@@ -0,0 +1,331 @@
+#include <cmath>
+
+#include "Animation.hpp"
+#include "VulkanErrors.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  // See the spec's animation section for the normalisation of integer outputs
+  inline float read_component(const uint8_t *ptr, Accessor::ComponentType type, uint32_t i) {
+    switch(type) {
+      case Accessor::FLOAT: {
+        float f;
+        mem_cpy(&f, (void*)(ptr + i * 4), 4);
+        return f;
+      }
+      case Accessor::INT8:
+        return std::fmax((float)((const int8_t*)ptr)[i] / 127.0f, -1.0f);
+      case Accessor::UINT8:
+        return (float)ptr[i] / 255.0f;
+      case Accessor::INT16: {
+        int16_t c;
+        mem_cpy(&c, (void*)(ptr + i * 2), 2);
+        return std::fmax((float)c / 32767.0f, -1.0f);
+      }
+      case Accessor::UINT16: {
+        uint16_t c;
+        mem_cpy(&c, (void*)(ptr + i * 2), 2);
+        return (float)c / 65535.0f;
+      }
+      default:
+        return 0;
+    }
+  }
+  inline const uint8_t* key_ptr(const AnimationPlayer::Track *track, uint32_t element) {
+    return track->values + (size_t)element * track->stride;
+  }
+
+  // Index of the keyframe at or before t
+  uint32_t find_key(AnimationPlayer::Track *track, float t) {
+    uint32_t k = track->last_key;
+    if (k >= track->count || track->times[k] > t) {
+      uint32_t lo = 0;
+      uint32_t hi = track->count - 1;
+      while(lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (track->times[mid] <= t)
+          lo = mid;
+        else
+          hi = mid - 1;
+      }
+      k = lo;
+    } else {
+      while(k + 1 < track->count && track->times[k + 1] <= t)
+        ++k;
+    }
+    track->last_key = k;
+    return k;
+  }
+
+  void slerp(float *dst, const float *a, const float *b, float t) {
+    float d = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    float sign = 1.0f;
+    if (d < 0) {
+      d = -d;
+      sign = -1.0f;
+    }
+    float wa, wb;
+    if (d > 0.9995f) {
+      wa = 1.0f - t;
+      wb = t;
+    } else {
+      float theta = std::acos(d);
+      float inv_sin = 1.0f / std::sin(theta);
+      wa = std::sin((1.0f - t) * theta) * inv_sin;
+      wb = std::sin(t * theta) * inv_sin;
+    }
+    wb *= sign;
+
+    float len = 0;
+    for(uint32_t i = 0; i < 4; ++i) {
+      dst[i] = wa * a[i] + wb * b[i];
+      len += dst[i] * dst[i];
+    }
+    len = len > 0 ? 1.0f / std::sqrt(len) : 0;
+    for(uint32_t i = 0; i < 4; ++i)
+      dst[i] *= len;
+  }
+}
+
+// NodeTransforms /////////////////
+void NodeTransforms::init(glTF *gltf) {
+  size_t count = gltf->nodes.nodes.len;
+  translations.alloc = alloc;
+  rotations.alloc = alloc;
+  scales.alloc = alloc;
+  weights.alloc = alloc;
+  weight_offsets.alloc = alloc;
+  weight_counts.alloc = alloc;
+
+  translations.init(count * 3, 16);
+  rotations.init(count * 4, 16);
+  scales.init(count * 3, 16);
+  weight_offsets.init(count, 8);
+  weight_counts.init(count, 8);
+
+  size_t weight_total = 0;
+  for(size_t i = 0; i < count; ++i) {
+    Node *node = &gltf->nodes.nodes[i];
+    uint32_t c = node->weights.len;
+    if (c == 0 && node->mesh != INVALID_INDEX && (size_t)node->mesh < gltf->meshes.meshes.len)
+      c = gltf->meshes.meshes[node->mesh].weights.len;
+    weight_offsets.push(weight_total);
+    weight_counts.push(c);
+    weight_total += c;
+  }
+  weights.init(weight_total ? weight_total : 1, 16);
+
+  const float t_default[] = { 0, 0, 0 };
+  const float r_default[] = { 0, 0, 0, 1 };
+  const float s_default[] = { 1, 1, 1 };
+  for(size_t i = 0; i < count; ++i) {
+    Node *node = &gltf->nodes.nodes[i];
+    // Animated nodes may not use 'matrix' (spec), so matrix nodes just keep identity TRS here
+    translations.copy_here(node->translation.len == 3 ? node->translation.mem : (float*)t_default, 3);
+    rotations.copy_here(node->rotation.len == 4 ? node->rotation.mem : (float*)r_default, 4);
+    scales.copy_here(node->scale.len == 3 ? node->scale.mem : (float*)s_default, 3);
+
+    uint32_t c = weight_counts[i];
+    if (c == 0)
+      continue;
+    if (node->weights.len == c)
+      weights.copy_here(node->weights.mem, c);
+    else
+      weights.copy_here(gltf->meshes.meshes[node->mesh].weights.mem, c);
+  }
+}
+void NodeTransforms::kill() {
+  alloc->deallocate(translations.mem);
+  alloc->deallocate(rotations.mem);
+  alloc->deallocate(scales.mem);
+  alloc->deallocate(weights.mem);
+  alloc->deallocate(weight_offsets.mem);
+  alloc->deallocate(weight_counts.mem);
+  *this = NodeTransforms();
+}
+
+// AnimationPlayer //////////////////
+bool AnimationPlayer::load(glTF *gltf, int32_t index, NodeTransforms *transforms) {
+  if (index < 0 || (size_t)index >= gltf->animations.animations.len)
+    return false;
+  Animation *animation = &gltf->animations.animations[index];
+
+  // Reloading a player frees what the last load made
+  kill();
+  tracks.alloc = alloc;
+  bindings.alloc = alloc;
+  tracks.init(animation->samplers.len ? animation->samplers.len : 1, 8);
+  bindings.init(animation->channels.len ? animation->channels.len : 1, 8);
+  time = 0;
+  duration = 0;
+
+  for(size_t i = 0; i < animation->samplers.len; ++i) {
+    Animation::Sampler *sampler = &animation->samplers[i];
+    Track track;
+    track.interpolation = sampler->interpolation;
+
+    uint32_t in_stride;
+    uint32_t out_stride;
+    const uint8_t *input = gltf->accessor_data(sampler->input, &in_stride);
+    const uint8_t *output = gltf->accessor_data(sampler->output, &out_stride);
+    if (input && output) {
+      Accessor *in = &gltf->accessors.accessors[sampler->input];
+      Accessor *out = &gltf->accessors.accessors[sampler->output];
+      uint32_t per_key = track.interpolation == Animation::Sampler::CUBICSPLINE ? 3 : 1;
+
+      // Keyframe times must be tightly packed floats for the search
+      if (in->component_type == Accessor::FLOAT && in->type == Accessor::SCALAR && in_stride == 4 &&
+          out->count % (in->count * per_key) == 0)
+      {
+        track.times = (const float*)input;
+        track.values = output;
+        track.count = in->count;
+        track.component_type = out->component_type;
+        // Scalar outputs (weights) pack several elements into one keyframe
+        uint32_t elems = out->count / (in->count * per_key);
+        track.width = type_width(out->type) * elems;
+        track.stride = out_stride * elems;
+        if (elems > 1 && out_stride != component_size(out->component_type))
+          track.count = 0;
+
+        if (track.count && track.times[track.count - 1] > duration)
+          duration = track.times[track.count - 1];
+      }
+    }
+    tracks.push(track);
+  }
+
+  for(size_t i = 0; i < animation->channels.len; ++i) {
+    Animation::Channel *channel = &animation->channels[i];
+    int32_t node = channel->target.node;
+    if (node == INVALID_INDEX || (size_t)node >= gltf->nodes.nodes.len)
+      continue;
+    if (channel->sampler == INVALID_INDEX || (size_t)channel->sampler >= tracks.len)
+      continue;
+    Track *track = &tracks[channel->sampler];
+    if (track->count == 0)
+      continue;
+
+    Binding binding;
+    binding.track = channel->sampler;
+    binding.path = channel->target.path;
+    switch(binding.path) {
+      case Animation::Channel::Target::TRANSLATION:
+        if (track->width != 3)
+          continue;
+        binding.dst = &transforms->translations[node * 3];
+        break;
+      case Animation::Channel::Target::ROTATION:
+        if (track->width != 4)
+          continue;
+        binding.dst = &transforms->rotations[node * 4];
+        break;
+      case Animation::Channel::Target::SCALE:
+        if (track->width != 3)
+          continue;
+        binding.dst = &transforms->scales[node * 3];
+        break;
+      case Animation::Channel::Target::WEIGHTS:
+        if (track->width != transforms->weight_counts[node] || track->width == 0)
+          continue;
+        binding.dst = &transforms->weights[transforms->weight_offsets[node]];
+        break;
+      default:
+        continue;
+    }
+    bindings.push(binding);
+  }
+  return true;
+}
+void AnimationPlayer::kill() {
+  alloc->deallocate(tracks.mem);
+  alloc->deallocate(bindings.mem);
+  tracks = Array<Track>();
+  bindings = Array<Binding>();
+}
+
+void AnimationPlayer::update(float dt) {
+  time += dt;
+  if (loop && duration > 0)
+    time = std::fmod(time, duration);
+  sample(time);
+}
+
+void AnimationPlayer::sample(float t) {
+  for(size_t i = 0; i < bindings.len; ++i) {
+    Binding *binding = &bindings.mem[i];
+    Track *track = &tracks.mem[binding->track];
+    float *dst = binding->dst;
+    uint32_t width = track->width;
+    bool cubic = track->interpolation == Animation::Sampler::CUBICSPLINE;
+    // Cubic keyframes are (in-tangent, value, out-tangent) triples
+    size_t key_stride = cubic ? 3 : 1;
+    size_t value_offset = cubic ? 1 : 0;
+
+    uint32_t k = find_key(track, t);
+    bool clamp = t <= track->times[0] || k + 1 >= track->count;
+    if (clamp || track->interpolation == Animation::Sampler::STEP) {
+      if (t <= track->times[0])
+        k = 0;
+      const uint8_t *v = key_ptr(track, k * key_stride + value_offset);
+      for(uint32_t c = 0; c < width; ++c)
+        dst[c] = read_component(v, track->component_type, c);
+      continue;
+    }
+
+    float t0 = track->times[k];
+    float t1 = track->times[k + 1];
+    float td = t1 - t0;
+    float u = td > 0 ? (t - t0) / td : 0;
+
+    if (cubic) {
+      float u2 = u * u;
+      float u3 = u2 * u;
+      float h00 = 2 * u3 - 3 * u2 + 1;
+      float h10 = (u3 - 2 * u2 + u) * td;
+      float h01 = -2 * u3 + 3 * u2;
+      float h11 = (u3 - u2) * td;
+      const uint8_t *a = key_ptr(track, k * 3 + 1);
+      const uint8_t *a_out = key_ptr(track, k * 3 + 2);
+      const uint8_t *b_in = key_ptr(track, (k + 1) * 3);
+      const uint8_t *b = key_ptr(track, (k + 1) * 3 + 1);
+      for(uint32_t c = 0; c < width; ++c) {
+        float va = read_component(a, track->component_type, c);
+        float out_a = read_component(a_out, track->component_type, c);
+        float in_b = read_component(b_in, track->component_type, c);
+        float vb = read_component(b, track->component_type, c);
+        dst[c] = h00 * va + h10 * out_a + h01 * vb + h11 * in_b;
+      }
+      if (binding->path == Animation::Channel::Target::ROTATION) {
+        float len = std::sqrt(dst[0] * dst[0] + dst[1] * dst[1] + dst[2] * dst[2] + dst[3] * dst[3]);
+        if (len > 0)
+          for(uint32_t c = 0; c < 4; ++c)
+            dst[c] /= len;
+      }
+      continue;
+    }
+
+    const uint8_t *a = key_ptr(track, k);
+    const uint8_t *b = key_ptr(track, k + 1);
+    if (binding->path == Animation::Channel::Target::ROTATION) {
+      float qa[4];
+      float qb[4];
+      for(uint32_t c = 0; c < 4; ++c) {
+        qa[c] = read_component(a, track->component_type, c);
+        qb[c] = read_component(b, track->component_type, c);
+      }
+      slerp(dst, qa, qb, u);
+    } else {
+      for(uint32_t c = 0; c < width; ++c) {
+        float va = read_component(a, track->component_type, c);
+        float vb = read_component(b, track->component_type, c);
+        dst[c] = va + (vb - va) * u;
+      }
+    }
+  }
+}
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Flattened TRS + morph weights for every node in a glTF, indexed by node.
+// This is what animations write into: renderers read from here rather than from Node.
+struct NodeTransforms {
+  Array<float> translations; // 3 floats per node
+  Array<float> rotations; // 4 floats per node, (x, y, z, w)
+  Array<float> scales; // 3 floats per node
+  Array<float> weights; // packed morph weights for all nodes
+  Array<uint32_t> weight_offsets; // per node offset into weights
+  Array<uint32_t> weight_counts; // per node weight count
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  // Initialize from the Node defaults
+  void init(glTF *gltf);
+  void kill();
+};
+
+// Plays one Animation. Channel targets are resolved to float slots in a NodeTransforms
+// once in load(), so update() is a linear walk over the bindings with no lookups.
+struct AnimationPlayer {
+  struct Track {
+    const float *times = nullptr;
+    const uint8_t *values = nullptr;
+    uint32_t count = 0;
+    uint32_t stride = 0;
+    uint32_t width = 0; // floats per keyframe element
+    Accessor::ComponentType component_type = Accessor::NONE;
+    Animation::Sampler::Interpolation interpolation = Animation::Sampler::LINEAR;
+    uint32_t last_key = 0; // cached for forward playback
+  };
+  struct Binding {
+    float *dst = nullptr;
+    uint32_t track = 0;
+    Animation::Channel::Target::Path path = Animation::Channel::Target::NONE;
+  };
+
+  Array<Track> tracks;
+  Array<Binding> bindings;
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+  float time = 0;
+  float duration = 0;
+  bool loop = true;
+
+  // Resolve every channel of gltf->animations.animations[animation] against transforms.
+  // Buffers must already be loaded. Channels which cannot be resolved are skipped. A player may be
+  // loaded again, the previous tracks are freed.
+  bool load(glTF *gltf, int32_t animation, NodeTransforms *transforms);
+  void kill();
+
+  // Advance by dt seconds and write the sampled values
+  void update(float dt);
+  void sample(float t);
+};
+
+} // namespace glTF
+} // namespace Sol
@@ -1,29 +1,68 @@
 #pragma once 
+#include <new>
+#include <type_traits>
+#include <utility>
+
 #include "Allocator.hpp"
 #include "VulkanErrors.hpp"
 
 namespace Sol {
 
+// Elements are moved as bytes when the array grows and assigned into storage which was never
+// constructed, so only trivially copyable types are allowed
 template <typename T>
 struct Array {
+  static_assert(std::is_trivially_copyable<T>::value, "Array<T>: T must be trivially copyable");
+
   T* mem = nullptr;
   size_t cap = 0;
   size_t len = 0;
-  Allocator *alloc = &MemoryService::instance()->scratch_allocator;
+  Allocator *alloc = MemoryService::scratch();
+  // from init, kept when growing moves the elements
+  size_t alignment = alignof(T);
   
-void init(size_t size, size_t alignment) {
+void init(size_t size, size_t alignment_) {
   cap = size;
+  alignment = alignment_;
   mem = (T*)mem_alloc2(size * sizeof(T), alignment, alloc);
 }
 void reset() {
   len = 0;
 }
+// Grow through the allocator's reallocate, in place where the allocator can do it
+void reserve(size_t size) {
+  if (size <= cap)
+    return;
+  T* new_mem = (T*)alloc->reallocate(size * sizeof(T), (void*)mem, cap * sizeof(T), alignment);
+  ABORT(new_mem, "Array<T>::reserve: allocation failed");
+  mem = new_mem;
+  cap = size;
+}
+void grow() {
+  reserve(cap ? cap * 2 : 4);
+}
 
-void push(T t) {
-  ABORT(len < cap, "Push to Array<T> with insufficient capacity");
+void push(const T &t) {
+  if (len == cap)
+    grow();
   mem[len] = t;
   ++len;
 }
+void push(T &&t) {
+  if (len == cap)
+    grow();
+  mem[len] = std::move(t);
+  ++len;
+}
+// Construct the next element in place
+template <typename... Args>
+T* emplace_back(Args&&... args) {
+  if (len == cap)
+    grow();
+  T* t = new (mem + len) T(std::forward<Args>(args)...);
+  ++len;
+  return t;
+}
 T pop() {
   if (len == 0)
     return NULL;
@@ -37,7 +76,8 @@ void swap_last(size_t i) {
   mem[len - 1] = tmp;
 }
 void copy_here(T* data, size_t count) {
-  ABORT(cap - len >= count, "Array<T>::copy_here with insufficient size");
+  if (cap - len < count)
+    reserve(len + count > cap * 2 ? len + count : cap * 2);
   mem_cpy(mem + len, data, count * sizeof(T));
   len += count;
 }
@@ -0,0 +1,461 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Bake.hpp"
+#include "Hash.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  // Missing files and data uris go into the key as their uri, so both show up as a change
+  void hash_source(Hasher *hasher, const char *dir, const char *uri) {
+    uint64_t h = 0;
+    if (uri[0] == '\0' || strncmp(uri, "data:", 5) == 0 ||
+        !hash_file((std::string(dir) + "/" + decode_uri(uri)).c_str(), 0, &h))
+      h = hash64(uri, strlen(uri));
+    hasher->update(&h, sizeof(h));
+  }
+  uint64_t source_key(const char *path) {
+    uint64_t h = 0;
+    if (!hash_file(path, 0, &h))
+      h = hash64(path, strlen(path));
+    return h;
+  }
+
+  // Builds the baked block. Records are placed first and their arrays appended after, so fields
+  // are addressed by offset: the block moves as it grows.
+  struct Writer {
+    Array<uint8_t> bytes;
+
+    void init(size_t size) {
+      bytes.alloc = &MemoryService::instance()->system_allocator;
+      bytes.init(size, 16);
+    }
+    void kill() {
+      bytes.alloc->deallocate(bytes.mem);
+      bytes = Array<uint8_t>();
+    }
+    // Offset of size zeroed bytes at alignment
+    size_t reserve(size_t size, size_t alignment) {
+      size_t offset = (bytes.len + alignment - 1) & ~(alignment - 1);
+      if (offset + size > bytes.cap)
+        bytes.reserve(offset + size > bytes.cap * 2 ? offset + size : bytes.cap * 2);
+      memset(bytes.mem + bytes.len, 0, offset + size - bytes.len);
+      bytes.len = offset + size;
+      return offset;
+    }
+    template <typename T>
+    T* at(size_t offset) { return (T*)(bytes.mem + offset); }
+
+    // Point the RelArray at field to a copy of src
+    template <typename T>
+    void array(size_t field, const T *src, size_t len) {
+      if (len == 0)
+        return;
+      size_t target = reserve(len * sizeof(T), alignof(T));
+      memcpy(bytes.mem + target, src, len * sizeof(T));
+      link<T>(field, target, len);
+    }
+    template <typename T>
+    void array(size_t field, const Array<T> &src) { array(field, src.mem, src.len); }
+    void string(size_t field, StringView str) {
+      if (str.len == 0)
+        return;
+      size_t target = reserve(str.len + 1, 1);
+      memcpy(bytes.mem + target, str.str, str.len);
+      link<char>(field, target, str.len);
+    }
+    template <typename T>
+    void link(size_t field, size_t target, size_t len) {
+      RelArray<T> *rel = at<RelArray<T>>(field);
+      rel->offset = (int64_t)target - (int64_t)field;
+      rel->len = len;
+    }
+    // Records for a section, filled in through at() afterwards
+    template <typename T>
+    size_t records(size_t field, size_t len) {
+      if (len == 0)
+        return 0;
+      size_t target = reserve(len * sizeof(T), alignof(T));
+      for(size_t i = 0; i < len; ++i)
+        new (bytes.mem + target + i * sizeof(T)) T();
+      link<T>(field, target, len);
+      return target;
+    }
+  };
+
+  #define FIELD(base, type, member) ((base) + offsetof(type, member))
+
+  void bake_nodes(Writer *w, glTF *gltf) {
+    Array<Node> &nodes = gltf->nodes.nodes;
+    size_t base = w->records<Bake::Node>(offsetof(Bake::Document, nodes), nodes.len);
+    for(size_t i = 0; i < nodes.len; ++i) {
+      Node *node = &nodes.mem[i];
+      size_t rec = base + i * sizeof(Bake::Node);
+      w->array(FIELD(rec, Bake::Node, rotation), node->rotation);
+      w->array(FIELD(rec, Bake::Node, scale), node->scale);
+      w->array(FIELD(rec, Bake::Node, translation), node->translation);
+      w->array(FIELD(rec, Bake::Node, matrix), node->matrix);
+      w->array(FIELD(rec, Bake::Node, weights), node->weights);
+      w->array(FIELD(rec, Bake::Node, children), node->children);
+      Bake::Node *out = w->at<Bake::Node>(rec);
+      out->name = node->name;
+      out->mesh = node->mesh;
+      out->skin = node->skin;
+      out->camera = node->camera;
+    }
+  }
+  void bake_meshes(Writer *w, glTF *gltf) {
+    Array<Mesh> &meshes = gltf->meshes.meshes;
+    size_t base = w->records<Bake::Mesh>(offsetof(Bake::Document, meshes), meshes.len);
+    for(size_t i = 0; i < meshes.len; ++i) {
+      Mesh *mesh = &meshes.mem[i];
+      size_t rec = base + i * sizeof(Bake::Mesh);
+      w->array(FIELD(rec, Bake::Mesh, weights), mesh->weights);
+      w->array(FIELD(rec, Bake::Mesh, target_names), mesh->extras.target_names);
+      w->at<Bake::Mesh>(rec)->name = mesh->name;
+
+      size_t prims = w->records<Bake::Primitive>(FIELD(rec, Bake::Mesh, primitives), mesh->primitives.len);
+      for(size_t j = 0; j < mesh->primitives.len; ++j) {
+        Mesh::Primitive *prim = &mesh->primitives.mem[j];
+        size_t prim_rec = prims + j * sizeof(Bake::Primitive);
+        w->array(FIELD(prim_rec, Bake::Primitive, attributes), prim->attributes);
+        Bake::Primitive *out = w->at<Bake::Primitive>(prim_rec);
+        out->indices = prim->indices;
+        out->material = prim->material;
+        out->mode = prim->mode;
+
+        size_t targets = w->records<Bake::Target>(FIELD(prim_rec, Bake::Primitive, targets), prim->targets.len);
+        for(size_t k = 0; k < prim->targets.len; ++k)
+          w->array(FIELD(targets + k * sizeof(Bake::Target), Bake::Target, attributes), prim->targets.mem[k].attributes);
+      }
+    }
+  }
+  void bake_accessors(Writer *w, glTF *gltf) {
+    Array<Accessor> &accessors = gltf->accessors.accessors;
+    size_t base = w->records<Bake::Accessor>(offsetof(Bake::Document, accessors), accessors.len);
+    for(size_t i = 0; i < accessors.len; ++i) {
+      Accessor *accessor = &accessors.mem[i];
+      size_t rec = base + i * sizeof(Bake::Accessor);
+      w->array(FIELD(rec, Bake::Accessor, max), accessor->max);
+      w->array(FIELD(rec, Bake::Accessor, min), accessor->min);
+      Bake::Accessor *out = w->at<Bake::Accessor>(rec);
+      out->sparse = accessor->sparse;
+      out->type = accessor->type;
+      out->component_type = accessor->component_type;
+      out->byte_offset = accessor->byte_offset;
+      out->count = accessor->count;
+      out->buffer_view = accessor->buffer_view;
+    }
+  }
+  void bake_materials(Writer *w, glTF *gltf) {
+    Array<Material> &materials = gltf->materials.materials;
+    size_t base = w->records<Bake::Material>(offsetof(Bake::Document, materials), materials.len);
+    for(size_t i = 0; i < materials.len; ++i) {
+      Material *mat = &materials.mem[i];
+      size_t rec = base + i * sizeof(Bake::Material);
+      w->array(FIELD(rec, Bake::Material, base_color_factor), mat->pbr_metallic_roughness.base_color_factor);
+      w->array(FIELD(rec, Bake::Material, emissive_factor), mat->emissive_factor);
+      Bake::Material *out = w->at<Bake::Material>(rec);
+      out->base_color_texture = mat->pbr_metallic_roughness.base_color_texture;
+      out->metallic_roughness_texture = mat->pbr_metallic_roughness.metallic_roughness_texture;
+      out->normal_texture = mat->normal_texture;
+      out->occlusion_texture = mat->occlusion_texture;
+      out->emissive_texture = mat->emissive_texture;
+      out->metallic_factor = mat->pbr_metallic_roughness.metallic_factor;
+      out->roughness_factor = mat->pbr_metallic_roughness.roughness_factor;
+      out->name = mat->name;
+      out->alpha_mode = mat->alpha_mode;
+      out->alpha_cutoff = mat->alpha_cutoff;
+      out->double_sided = mat->double_sided;
+    }
+  }
+  void bake_streams(Writer *w, glTF *gltf) {
+    Array<Accessor> &accessors = gltf->accessors.accessors;
+    size_t base = w->records<Bake::Stream>(offsetof(Bake::Document, streams), accessors.len);
+    for(size_t i = 0; i < accessors.len; ++i) {
+      uint32_t stride;
+      const uint8_t *src = gltf->accessor_data(i, &stride);
+      if (!src)
+        continue;
+      Accessor *accessor = &accessors.mem[i];
+      uint32_t elem_size = component_size(accessor->component_type) * type_width(accessor->type);
+      size_t rec = base + i * sizeof(Bake::Stream);
+      size_t target = w->reserve((size_t)elem_size * accessor->count, 16);
+      uint8_t *dst = w->bytes.mem + target;
+      if (stride == elem_size) {
+        memcpy(dst, src, (size_t)elem_size * accessor->count);
+      } else {
+        for(uint32_t e = 0; e < accessor->count; ++e)
+          memcpy(dst + (size_t)e * elem_size, src + (size_t)e * stride, elem_size);
+      }
+      w->link<uint8_t>(FIELD(rec, Bake::Stream, data), target, (size_t)elem_size * accessor->count);
+      w->at<Bake::Stream>(rec)->stride = elem_size;
+    }
+  }
+}
+
+// Content key //////////////////////
+uint64_t content_key(const char *path, const char *dir, glTF *gltf) {
+  Hasher hasher;
+  hasher.init(source_key(path));
+  for(size_t i = 0; i < gltf->buffers.buffers.len; ++i)
+    hash_source(&hasher, dir, gltf->buffers.buffers.mem[i].uri.c_str());
+  return hasher.digest();
+}
+uint64_t content_key(const char *path, const char *dir, const Bake::Document *doc) {
+  Hasher hasher;
+  hasher.init(source_key(path));
+  for(size_t i = 0; i < doc->buffers.len; ++i) {
+    const Bake::Buffer *buf = &doc->buffers[i];
+    hash_source(&hasher, dir, buf->uri.len ? buf->uri.data() : "");
+  }
+  return hasher.digest();
+}
+
+// Bake ////////////////////////
+bool bake(glTF *gltf, uint64_t key, bool streams, const char *bake_path) {
+  Writer w;
+  w.init(gltf->arena.head ? gltf->arena.head->cap : 4096);
+  w.reserve(sizeof(Bake::Document), alignof(Bake::Document));
+  new (w.bytes.mem) Bake::Document();
+
+  w.string(offsetof(Bake::Document, asset_version), gltf->asset.version.view());
+  w.string(offsetof(Bake::Document, copyright), gltf->asset.copyright.view());
+
+  Array<Scene> &scenes = gltf->scenes.scenes;
+  size_t base = w.records<Bake::Scene>(offsetof(Bake::Document, scenes), scenes.len);
+  for(size_t i = 0; i < scenes.len; ++i) {
+    size_t rec = base + i * sizeof(Bake::Scene);
+    w.array(FIELD(rec, Bake::Scene, nodes), scenes.mem[i].nodes);
+    w.at<Bake::Scene>(rec)->name = scenes.mem[i].name;
+  }
+  bake_nodes(&w, gltf);
+
+  Array<Buffer> &buffers = gltf->buffers.buffers;
+  base = w.records<Bake::Buffer>(offsetof(Bake::Document, buffers), buffers.len);
+  for(size_t i = 0; i < buffers.len; ++i) {
+    size_t rec = base + i * sizeof(Bake::Buffer);
+    w.string(FIELD(rec, Bake::Buffer, uri), buffers.mem[i].uri.view());
+    w.at<Bake::Buffer>(rec)->byte_length = buffers.mem[i].byte_length;
+  }
+  w.array(offsetof(Bake::Document, buffer_views), gltf->buffer_views.views);
+  bake_accessors(&w, gltf);
+  bake_meshes(&w, gltf);
+
+  Array<Skin> &skins = gltf->skins.skins;
+  base = w.records<Bake::Skin>(offsetof(Bake::Document, skins), skins.len);
+  for(size_t i = 0; i < skins.len; ++i) {
+    size_t rec = base + i * sizeof(Bake::Skin);
+    w.array(FIELD(rec, Bake::Skin, joints), skins.mem[i].joints);
+    w.at<Bake::Skin>(rec)->i_bind_matrices = skins.mem[i].i_bind_matrices;
+    w.at<Bake::Skin>(rec)->skeleton = skins.mem[i].skeleton;
+  }
+  w.array(offsetof(Bake::Document, textures), gltf->textures.textures);
+
+  Array<Image> &images = gltf->images.images;
+  base = w.records<Bake::Image>(offsetof(Bake::Document, images), images.len);
+  for(size_t i = 0; i < images.len; ++i) {
+    size_t rec = base + i * sizeof(Bake::Image);
+    w.string(FIELD(rec, Bake::Image, uri), images.mem[i].uri.view());
+    w.at<Bake::Image>(rec)->mime_type = images.mem[i].mime_type;
+    w.at<Bake::Image>(rec)->buffer_view = images.mem[i].buffer_view;
+  }
+  w.array(offsetof(Bake::Document, samplers), gltf->samplers.samplers);
+  bake_materials(&w, gltf);
+  w.array(offsetof(Bake::Document, cameras), gltf->cameras.cameras);
+
+  Array<Animation> &animations = gltf->animations.animations;
+  base = w.records<Bake::Animation>(offsetof(Bake::Document, animations), animations.len);
+  for(size_t i = 0; i < animations.len; ++i) {
+    size_t rec = base + i * sizeof(Bake::Animation);
+    w.array(FIELD(rec, Bake::Animation, channels), animations.mem[i].channels);
+    w.array(FIELD(rec, Bake::Animation, samplers), animations.mem[i].samplers);
+    w.at<Bake::Animation>(rec)->name = animations.mem[i].name;
+  }
+  if (streams)
+    bake_streams(&w, gltf);
+
+  w.array(offsetof(Bake::Document, chars), gltf->strings.chars);
+  w.array(offsetof(Bake::Document, string_offsets), gltf->strings.offsets);
+  w.array(offsetof(Bake::Document, string_lengths), gltf->strings.lengths);
+
+  Bake::Document *doc = w.at<Bake::Document>(0);
+  doc->size = w.bytes.len;
+  doc->key = key;
+  doc->flags = streams ? (uint32_t)Bake::Document::STREAMS : 0;
+  doc->scene = gltf->scenes.scene;
+
+  // Written beside bake_path and renamed over it, so readers see the old file or the whole new one
+  static std::atomic<uint32_t> temp_id{0};
+  std::string temp = std::string(bake_path) + ".tmp." + std::to_string(getpid()) + "." +
+                     std::to_string(temp_id.fetch_add(1, std::memory_order_relaxed));
+  bool ok = false;
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0) {
+    size_t done = 0;
+    while(done < w.bytes.len) {
+      ssize_t put = write(fd, w.bytes.mem + done, w.bytes.len - done);
+      if (put < 0 && errno == EINTR)
+        continue;
+      if (put <= 0)
+        break;
+      done += put;
+    }
+    ok = done == w.bytes.len && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(temp.c_str(), bake_path) == 0;
+    if (!ok)
+      unlink(temp.c_str());
+  }
+  w.kill();
+  return ok;
+}
+
+#undef FIELD
+
+// BakedFile ////////////////////////
+namespace {
+  // Offsets and lengths come from the file, so every array has to be checked against the mapping
+  // before anything reads through it
+  struct Bounds {
+    const uint8_t *map;
+    size_t size;
+
+    // terminated: one more element past len must be mapped too
+    template <typename T>
+    bool ok(const RelArray<T> &a, bool terminated = false) const {
+      if (a.len == 0)
+        return true;
+      int64_t base = (const uint8_t*)&a - map;
+      if (a.offset > (int64_t)size - base || -base > a.offset)
+        return false;
+      uint64_t start = base + a.offset;
+      uint64_t room = (size - start) / sizeof(T);
+      // The mapping is page aligned, so the file offset decides the alignment
+      return start % alignof(T) == 0 && (terminated ? a.len < room : a.len <= room);
+    }
+    // Non empty strings are followed by their null byte
+    bool string(const RelArray<char> &a) const {
+      return a.len == 0 || (ok(a, true) && a.data()[a.len] == '\0');
+    }
+  };
+
+  bool in_bounds(const Bake::Document *doc, size_t size) {
+    Bounds b = { (const uint8_t*)doc, size };
+    if (!b.string(doc->asset_version) || !b.string(doc->copyright) || !b.ok(doc->scenes) || !b.ok(doc->nodes) ||
+        !b.ok(doc->buffers) || !b.ok(doc->buffer_views) || !b.ok(doc->accessors) || !b.ok(doc->meshes) ||
+        !b.ok(doc->skins) || !b.ok(doc->textures) || !b.ok(doc->images) || !b.ok(doc->samplers) ||
+        !b.ok(doc->materials) || !b.ok(doc->cameras) || !b.ok(doc->animations) || !b.ok(doc->streams) ||
+        !b.ok(doc->chars) || !b.ok(doc->string_offsets) || !b.ok(doc->string_lengths))
+      return false;
+
+    for(size_t i = 0; i < doc->scenes.len; ++i)
+      if (!b.ok(doc->scenes.data()[i].nodes))
+        return false;
+    for(size_t i = 0; i < doc->nodes.len; ++i) {
+      const Bake::Node &node = doc->nodes.data()[i];
+      if (!b.ok(node.rotation) || !b.ok(node.scale) || !b.ok(node.translation) || !b.ok(node.matrix) ||
+          !b.ok(node.weights) || !b.ok(node.children))
+        return false;
+    }
+    for(size_t i = 0; i < doc->buffers.len; ++i)
+      if (!b.string(doc->buffers.data()[i].uri))
+        return false;
+    for(size_t i = 0; i < doc->accessors.len; ++i)
+      if (!b.ok(doc->accessors.data()[i].max) || !b.ok(doc->accessors.data()[i].min))
+        return false;
+    for(size_t i = 0; i < doc->meshes.len; ++i) {
+      const Bake::Mesh &mesh = doc->meshes.data()[i];
+      if (!b.ok(mesh.primitives) || !b.ok(mesh.weights) || !b.ok(mesh.target_names))
+        return false;
+      for(size_t p = 0; p < mesh.primitives.len; ++p) {
+        const Bake::Primitive &prim = mesh.primitives.data()[p];
+        if (!b.ok(prim.attributes) || !b.ok(prim.targets))
+          return false;
+        for(size_t t = 0; t < prim.targets.len; ++t)
+          if (!b.ok(prim.targets.data()[t].attributes))
+            return false;
+      }
+    }
+    for(size_t i = 0; i < doc->skins.len; ++i)
+      if (!b.ok(doc->skins.data()[i].joints))
+        return false;
+    for(size_t i = 0; i < doc->images.len; ++i)
+      if (!b.string(doc->images.data()[i].uri))
+        return false;
+    for(size_t i = 0; i < doc->materials.len; ++i)
+      if (!b.ok(doc->materials.data()[i].base_color_factor) || !b.ok(doc->materials.data()[i].emissive_factor))
+        return false;
+    for(size_t i = 0; i < doc->animations.len; ++i)
+      if (!b.ok(doc->animations.data()[i].channels) || !b.ok(doc->animations.data()[i].samplers))
+        return false;
+    for(size_t i = 0; i < doc->streams.len; ++i)
+      if (!b.ok(doc->streams.data()[i].data))
+        return false;
+
+    // Document::string() reads chars at these offsets up to the null byte
+    if (doc->string_offsets.len != doc->string_lengths.len)
+      return false;
+    for(size_t i = 0; i < doc->string_offsets.len; ++i) {
+      uint64_t offset = doc->string_offsets.data()[i];
+      uint64_t len = doc->string_lengths.data()[i];
+      if (offset + len >= doc->chars.len || doc->chars.data()[offset + len] != '\0')
+        return false;
+    }
+    return true;
+  }
+}
+
+bool BakedFile::open(const char *bake_path) {
+  int fd = ::open(bake_path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Bake::Document)) {
+    close(fd);
+    return false;
+  }
+  void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED)
+    return false;
+
+  const Bake::Document *header = (const Bake::Document*)ptr;
+  if (header->magic != Bake::MAGIC || header->version != Bake::VERSION || header->size != (uint64_t)st.st_size ||
+      !in_bounds(header, st.st_size)) {
+    munmap(ptr, st.st_size);
+    return false;
+  }
+  map = ptr;
+  size = st.st_size;
+  doc = header;
+  return true;
+}
+bool BakedFile::open(const char *bake_path, uint64_t key) {
+  if (!open(bake_path))
+    return false;
+  if (doc->key == key)
+    return true;
+  kill();
+  return false;
+}
+void BakedFile::kill() {
+  if (map)
+    munmap(map, size);
+  map = nullptr;
+  size = 0;
+  doc = nullptr;
+}
+
+} // namespace glTF
+} // namespace Sol
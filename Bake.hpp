@@ -0,0 +1,200 @@
+#pragma once
+
+#include <type_traits>
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Self relative array: the elements start at the address of the RelArray itself plus offset, so a
+// baked file reads the same wherever it is mapped and needs no pointer fixup after loading.
+template <typename T>
+struct RelArray {
+  int64_t offset = 0;
+  uint64_t len = 0;
+
+  const T* data() const { return len ? (const T*)((const uint8_t*)this + offset) : nullptr; }
+  const T& operator[](size_t i) const {
+    ABORT(i < len, "Out of Bounds access on RelArray<T>");
+    return data()[i];
+  }
+};
+
+// A filled glTF laid out as one relocatable block. The records mirror the glTF structs with
+// Array<T> and StringBuffer swapped for RelArray<T>; members without pointers reuse the glTF types.
+// Strings are null terminated, len does not count the null byte.
+namespace Bake {
+
+static constexpr uint32_t MAGIC = 0x424c4f53; // "SOLB"
+static constexpr uint32_t VERSION = 1;
+
+// The glTF types embedded as they are. Their layout is part of the file format, changing one of
+// them means bumping VERSION along with the size here.
+template <typename T>
+constexpr bool embeds(size_t size) {
+  return sizeof(T) == size && alignof(T) <= 8 && std::is_trivially_copyable<T>::value &&
+         std::is_standard_layout<T>::value;
+}
+static_assert(embeds<Sol::glTF::Accessor::Sparse>(24), "Bake: Accessor::Sparse changed");
+static_assert(embeds<Sol::glTF::Mesh::Primitive::Attribute>(12), "Bake: Mesh::Primitive::Attribute changed");
+static_assert(embeds<Sol::glTF::Material::MatTexture>(12), "Bake: Material::MatTexture changed");
+static_assert(embeds<Sol::glTF::BufferView>(20), "Bake: BufferView changed");
+static_assert(embeds<Sol::glTF::Texture>(8), "Bake: Texture changed");
+static_assert(embeds<Sol::glTF::Sampler>(16), "Bake: Sampler changed");
+static_assert(embeds<Sol::glTF::Camera>(32), "Bake: Camera changed");
+static_assert(embeds<Sol::glTF::Animation::Channel>(12), "Bake: Animation::Channel changed");
+static_assert(embeds<Sol::glTF::Animation::Sampler>(12), "Bake: Animation::Sampler changed");
+
+struct Scene {
+  RelArray<int32_t> nodes;
+  uint32_t name = StringPool::NONE;
+};
+struct Node {
+  RelArray<float> rotation;
+  RelArray<float> scale;
+  RelArray<float> translation;
+  RelArray<float> matrix;
+  RelArray<float> weights;
+  RelArray<int32_t> children;
+  uint32_t name = StringPool::NONE;
+  int32_t mesh = INVALID_INDEX;
+  int32_t skin = INVALID_INDEX;
+  int32_t camera = INVALID_INDEX;
+};
+struct Buffer {
+  RelArray<char> uri;
+  uint32_t byte_length = 0;
+};
+struct Accessor {
+  Sol::glTF::Accessor::Sparse sparse;
+  RelArray<float> max;
+  RelArray<float> min;
+  Sol::glTF::Accessor::Type type = Sol::glTF::Accessor::SCALAR;
+  Sol::glTF::Accessor::ComponentType component_type = Sol::glTF::Accessor::NONE;
+  uint32_t byte_offset = INVALID_COUNT;
+  uint32_t count = INVALID_COUNT;
+  int32_t buffer_view = INVALID_INDEX;
+};
+struct Target {
+  RelArray<Sol::glTF::Mesh::Primitive::Attribute> attributes;
+};
+struct Primitive {
+  RelArray<Sol::glTF::Mesh::Primitive::Attribute> attributes;
+  RelArray<Target> targets;
+  int32_t indices = INVALID_INDEX;
+  int32_t material = INVALID_INDEX;
+  int32_t mode = INVALID_INDEX;
+};
+struct Mesh {
+  RelArray<Primitive> primitives;
+  RelArray<float> weights;
+  RelArray<uint32_t> target_names;
+  uint32_t name = StringPool::NONE;
+};
+struct Skin {
+  RelArray<int32_t> joints;
+  int32_t i_bind_matrices = INVALID_INDEX;
+  int32_t skeleton = INVALID_INDEX;
+};
+struct Image {
+  RelArray<char> uri;
+  Sol::glTF::Image::MimeType mime_type = Sol::glTF::Image::NONE;
+  int32_t buffer_view = INVALID_INDEX;
+};
+struct Material {
+  RelArray<float> base_color_factor;
+  RelArray<float> emissive_factor;
+  Sol::glTF::Material::MatTexture base_color_texture;
+  Sol::glTF::Material::MatTexture metallic_roughness_texture;
+  Sol::glTF::Material::MatTexture normal_texture;
+  Sol::glTF::Material::MatTexture occlusion_texture;
+  Sol::glTF::Material::MatTexture emissive_texture;
+  float metallic_factor = INVALID_FLOAT;
+  float roughness_factor = INVALID_FLOAT;
+  uint32_t name = StringPool::NONE;
+  Sol::glTF::Material::AlphaMode alpha_mode = Sol::glTF::Material::OPAQUE;
+  float alpha_cutoff = INVALID_FLOAT;
+  bool double_sided = false;
+};
+struct Animation {
+  RelArray<Sol::glTF::Animation::Channel> channels;
+  RelArray<Sol::glTF::Animation::Sampler> samplers;
+  uint32_t name = StringPool::NONE;
+};
+// An accessor's elements copied out of its buffer, tightly packed
+struct Stream {
+  RelArray<uint8_t> data; // empty if the accessor did not resolve when baking
+  uint32_t stride = 0;
+};
+
+// The start of every baked file
+struct Document {
+  enum Flags : uint32_t {
+    STREAMS = 1, // streams has one entry per accessor
+  };
+
+  uint32_t magic = MAGIC;
+  uint32_t version = VERSION;
+  uint64_t size = 0; // bytes in the file
+  uint64_t key = 0; // content_key() of the sources this was baked from
+  uint32_t flags = 0;
+  int32_t scene = INVALID_INDEX;
+
+  RelArray<char> asset_version;
+  RelArray<char> copyright;
+  RelArray<Scene> scenes;
+  RelArray<Node> nodes;
+  RelArray<Buffer> buffers;
+  RelArray<BufferView> buffer_views;
+  RelArray<Accessor> accessors;
+  RelArray<Mesh> meshes;
+  RelArray<Skin> skins;
+  RelArray<Texture> textures;
+  RelArray<Image> images;
+  RelArray<Sol::glTF::Sampler> samplers;
+  RelArray<Material> materials;
+  RelArray<Camera> cameras;
+  RelArray<Animation> animations;
+  RelArray<Stream> streams;
+
+  // glTF::strings
+  RelArray<char> chars;
+  RelArray<uint32_t> string_offsets;
+  RelArray<uint32_t> string_lengths;
+
+  // "" for StringPool::NONE
+  const char* string(uint32_t id) const {
+    if (id == StringPool::NONE || id >= string_offsets.len)
+      return "";
+    return chars.data() + string_offsets.data()[id];
+  }
+};
+
+} // namespace Bake
+
+// Hash of the glTF at path and every buffer file it references (relative to dir). Files which
+// cannot be read are hashed as missing, so adding them later changes the key.
+uint64_t content_key(const char *path, const char *dir, glTF *gltf);
+uint64_t content_key(const char *path, const char *dir, const Bake::Document *doc);
+
+// Write gltf to bake_path under key. With streams every accessor's elements are copied in too,
+// which needs the buffers loaded. The file is replaced atomically.
+bool bake(glTF *gltf, uint64_t key, bool streams, const char *bake_path);
+
+// A baked file mapped read only. doc points into the mapping and is ready to read once open()
+// returns true.
+struct BakedFile {
+  void *map = nullptr;
+  size_t size = 0;
+  const Bake::Document *doc = nullptr;
+
+  // False if the file is missing, truncated or from another version
+  bool open(const char *bake_path);
+  // Same, and false if key does not match the one it was baked with
+  bool open(const char *bake_path, uint64_t key);
+  void kill();
+};
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Cache.hpp"
+#include "Hash.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  const char ENTRY_EXT[] = ".bake";
+
+  std::string dir_of(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? std::string(path, slash - path) : std::string(".");
+  }
+  void stamp_file(Hasher *hasher, const std::string &path) {
+    struct stat st;
+    uint64_t fields[5] = {};
+    if (stat(path.c_str(), &st) == 0) {
+      fields[0] = st.st_size;
+      fields[1] = st.st_mtim.tv_sec;
+      fields[2] = st.st_mtim.tv_nsec;
+      fields[3] = st.st_ino;
+      fields[4] = st.st_dev;
+    }
+    hasher->update(fields, sizeof(fields));
+  }
+  uint64_t stamp_files(const char *path, const char *dir, const Bake::Document *doc) {
+    Hasher hasher;
+    hasher.init();
+    stamp_file(&hasher, path);
+    for(size_t i = 0; i < doc->buffers.len; ++i) {
+      const Bake::Buffer *buf = &doc->buffers[i];
+      if (buf->uri.len && strncmp(buf->uri.data(), "data:", 5) != 0)
+        stamp_file(&hasher, std::string(dir) + "/" + decode_uri(buf->uri.data()));
+    }
+    return hasher.digest();
+  }
+  bool read_bytes(const char *path, std::string *bytes) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    bytes->resize(st.st_size);
+    size_t pos = 0;
+    while(pos < bytes->size()) {
+      ssize_t got = read(fd, &(*bytes)[pos], bytes->size() - pos);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        break;
+      pos += got;
+    }
+    close(fd);
+    return pos == bytes->size();
+  }
+  // The BIN chunk is the glb's first buffer, the one without a uri
+  bool attach_bin(glTF *gltf, const Glb &glb) {
+    Array<Buffer> &buffers = gltf->buffers.buffers;
+    if (buffers.len == 0 || buffers[0].uri.len != 0 || buffers[0].data)
+      return true;
+    if (!glb.bin || glb.bin_size < buffers[0].byte_length)
+      return false;
+    buffers[0].data = (uint8_t*)mem_alloca(buffers[0].byte_length ? buffers[0].byte_length : 1, 16);
+    if (!buffers[0].data)
+      return false;
+    memcpy(buffers[0].data, glb.bin, buffers[0].byte_length);
+    return true;
+  }
+  bool is_entry(const char *name) {
+    size_t len = strlen(name);
+    size_t ext = sizeof(ENTRY_EXT) - 1;
+    return len > ext && strcmp(name + len - ext, ENTRY_EXT) == 0;
+  }
+}
+
+bool AssetCache::init(const char *dir_, uint64_t max_bytes_) {
+  dir = dir_;
+  max_bytes = max_bytes_;
+  hits.store(0, std::memory_order_relaxed);
+  misses.store(0, std::memory_order_relaxed);
+  if (mkdir(dir_, 0755) != 0 && errno != EEXIST)
+    return false;
+  evict();
+  return true;
+}
+void AssetCache::kill() {
+  dir.clear();
+  stamps.clear();
+}
+
+std::string AssetCache::entry_path(uint64_t name) {
+  char buf[17 + sizeof(ENTRY_EXT)];
+  snprintf(buf, sizeof(buf), "%016llx%s", (unsigned long long)name, ENTRY_EXT);
+  return dir + "/" + buf;
+}
+
+bool AssetCache::load(const char *path, bool streams, BakedFile *out, ThreadPool *pool) {
+  // One entry per source file, with and without streams side by side
+  const char *slash = strrchr(path, '/');
+  std::string source_dir = canonical_dir(dir_of(path));
+  std::string source = source_dir + "/" + (slash ? slash + 1 : path);
+  std::string entry = entry_path(hash64(source.data(), source.size(), streams ? 1 : 0));
+
+  if (out->open(entry.c_str())) {
+    // Stamped before hashing, so a file changing mid-hash is seen as changed next time
+    uint64_t files = stamp_files(source.c_str(), source_dir.c_str(), out->doc);
+    bool fresh;
+    {
+      std::lock_guard<std::mutex> guard(stamp_lock);
+      auto it = stamps.find(entry);
+      fresh = it != stamps.end() && it->second.files == files && it->second.key == out->doc->key;
+    }
+    if (!fresh && content_key(source.c_str(), source_dir.c_str(), out->doc) == out->doc->key) {
+      fresh = true;
+      std::lock_guard<std::mutex> guard(stamp_lock);
+      stamps[entry] = Stamp{files, out->doc->key};
+    }
+    if (fresh) {
+      // mtime is the last use for eviction
+      utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+      hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    out->kill();
+  }
+  misses.fetch_add(1, std::memory_order_relaxed);
+
+  std::string bytes;
+  if (!read_bytes(source.c_str(), &bytes))
+    return false;
+  Glb glb;
+  bool binary = parse_glb((const uint8_t*)bytes.data(), bytes.size(), &glb);
+  Json json;
+  if (binary ? !parse_json(glb.json, glb.json_size, &json) : !parse_json(bytes.data(), bytes.size(), &json))
+    return false;
+  glTF gltf;
+  gltf.fill(json, pool);
+  if (streams) {
+    if (binary)
+      attach_bin(&gltf, glb);
+    gltf.load_buffers(source_dir.c_str());
+  }
+  bytes = std::string();
+  uint64_t key = content_key(source.c_str(), source_dir.c_str(), &gltf);
+  bool ok = bake(&gltf, key, streams, entry.c_str());
+  gltf.free_buffers();
+  gltf.kill();
+  if (!ok)
+    return false;
+
+  // Map before evicting: an entry larger than max_bytes on its own is still returned once
+  ok = out->open(entry.c_str(), key);
+  evict();
+  return ok;
+}
+
+void AssetCache::evict() {
+  struct Entry {
+    std::string path;
+    uint64_t size;
+    struct timespec used;
+  };
+  std::lock_guard<std::mutex> guard(lock);
+
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  while(struct dirent *e = readdir(d)) {
+    if (!is_entry(e->d_name))
+      continue;
+    Entry entry;
+    entry.path = dir + "/" + e->d_name;
+    struct stat st;
+    if (stat(entry.path.c_str(), &st) != 0)
+      continue;
+    entry.size = st.st_size;
+    entry.used = st.st_mtim;
+    total += entry.size;
+    entries.push_back(std::move(entry));
+  }
+  closedir(d);
+  if (total <= max_bytes)
+    return;
+
+  std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+    if (a.used.tv_sec != b.used.tv_sec)
+      return a.used.tv_sec < b.used.tv_sec;
+    return a.used.tv_nsec < b.used.tv_nsec;
+  });
+  // Mapped entries stay readable after unlink, so a reader never loses its file
+  for(size_t i = 0; i < entries.size() && total > max_bytes; ++i) {
+    if (unlink(entries[i].path.c_str()) == 0)
+      total -= entries[i].size;
+  }
+}
+
+} // namespace glTF
+} // namespace Sol
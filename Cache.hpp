@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Bake.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Directory of baked documents. An entry is named by the hash of the source's canonical path and
+// holds the content_key() of the source plus its buffers, so an edit to either is a miss and the
+// entry is rebaked in place. Sources are .gltf or .glb. Entries are evicted least recently used
+// first once the directory holds more than max_bytes.
+struct AssetCache {
+  static constexpr uint64_t DEFAULT_MAX_BYTES = 1ull << 30;
+
+  // Sizes and mtimes of an entry's source files when its key was last checked. Until they change
+  // a hit trusts the key rather than hashing every file again.
+  struct Stamp {
+    uint64_t files;
+    uint64_t key;
+  };
+
+  std::string dir;
+  uint64_t max_bytes = DEFAULT_MAX_BYTES;
+  std::mutex lock; // one eviction scan at a time
+  std::mutex stamp_lock;
+  std::unordered_map<std::string, Stamp> stamps; // by entry path
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+
+  // Creates dir if needed
+  bool init(const char *dir_, uint64_t max_bytes_ = DEFAULT_MAX_BYTES);
+  void kill();
+
+  // Map the baked glTF at path, parsing and baking it first on a miss. With streams the entry
+  // also holds every accessor's elements.
+  bool load(const char *path, bool streams, BakedFile *out, ThreadPool *pool = nullptr);
+  std::string entry_path(uint64_t name);
+  // Delete least recently used entries until the directory fits in max_bytes
+  void evict();
+};
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,148 @@
+// Fuzz target for everything which reads untrusted bytes: parse_glb, parse_json, the lazy skim,
+// LazyDocument, glTF::fill, validate and accessor and index decoding. 'make fuzz' builds it for libFuzzer,
+// 'make fuzz-afl' for AFL. Without libFuzzer main() runs each file named on the command line (or
+// stdin) once, which is what AFL and reproducing a crash need.
+
+#include <cstdio>
+#include <vector>
+
+#include "glTF.hpp"
+#include "Lazy.hpp"
+#include "Validate.hpp"
+#include "Indices.hpp"
+
+using namespace Sol;
+
+namespace {
+  // Small enough that every input runs in milliseconds, the defaults are for real assets
+  glTF::Limits fuzz_limits() {
+    glTF::Limits limits;
+    limits.max_bytes = 1024 * 1024;
+    limits.max_depth = 32;
+    limits.max_elements = 64 * 1024;
+    return limits;
+  }
+
+  // Reads every byte an accessor resolves to, so ASan sees a range which should not have resolved
+  uint32_t read_accessor(glTF::glTF *gltf, int32_t index) {
+    uint32_t stride;
+    const uint8_t *data = gltf->accessor_data(index, &stride);
+    if (!data)
+      return 0;
+    const glTF::Accessor &accessor = gltf->accessors.accessors[index];
+    uint32_t elem_size = glTF::component_size(accessor.component_type) * glTF::type_width(accessor.type);
+    uint32_t sum = 0;
+    for(uint32_t i = 0; i < accessor.count; ++i)
+      for(uint32_t b = 0; b < elem_size; ++b)
+        sum += data[(size_t)i * stride + b];
+    return sum;
+  }
+
+  void skim(const char *text, size_t size) {
+    const char *keys[] = { "nodes", "meshes", "accessors" };
+    glTF::TextRange ranges[3];
+    if (!glTF::skim_object(text, size, keys, 3, ranges))
+      return;
+    Array<glTF::TextRange> elements;
+    elements.alloc = &MemoryService::instance()->system_allocator;
+    elements.init(16, 8);
+    for(uint32_t i = 0; i < 3; ++i) {
+      elements.len = 0;
+      glTF::skim_array(text, ranges[i], &elements);
+    }
+    elements.alloc->deallocate(elements.mem);
+  }
+
+  // The lazy path parses each section and element on its own, through the same limits
+  void lazy(const char *text, size_t size) {
+    glTF::LazyDocument doc;
+    if (!doc.open_text(text, size, fuzz_limits()))
+      return;
+    // Odd sections a piece at a time first, then every section whole, which finishes those
+    for(uint32_t s = 1; s < glTF::glTF::SECTION_COUNT; s += 2) {
+      size_t count = doc.count((glTF::glTF::Section)s);
+      for(size_t i = 0; i < count; ++i)
+        doc.element((glTF::glTF::Section)s, i);
+    }
+    for(uint32_t s = 0; s < glTF::glTF::SECTION_COUNT; ++s)
+      doc.section((glTF::glTF::Section)s);
+    doc.kill();
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  static bool memory = [] {
+    MemoryConfig config;
+    MemoryService::instance()->init(&config);
+    return true;
+  }();
+  (void)memory;
+
+  const char *text = (const char*)data;
+  size_t text_size = size;
+  glTF::Glb glb;
+  if (glTF::parse_glb(data, size, &glb)) {
+    text = glb.json;
+    text_size = glb.json_size;
+  }
+  skim(text, text_size);
+  lazy(text, text_size);
+
+  glTF::Json json;
+  if (!glTF::parse_json(text, text_size, &json, fuzz_limits()))
+    return 0;
+  glTF::glTF gltf;
+  gltf.fill(json);
+  json = glTF::Json();
+
+  glTF::Diagnostics diagnostics;
+  glTF::validate(&gltf, &diagnostics, glTF::Validation::FULL);
+
+  // The BIN chunk is the first buffer's data, lent for the decoding below. Decoding runs whether
+  // or not the document validated, accessor_data and decode_indices must stand on their own.
+  Array<glTF::Buffer> &buffers = gltf.buffers.buffers;
+  bool lent = glb.bin && buffers.len && buffers[0].uri.len == 0 && buffers[0].byte_length <= glb.bin_size;
+  if (lent)
+    buffers[0].data = (uint8_t*)glb.bin;
+
+  volatile uint32_t sink = 0;
+  for(size_t i = 0; i < gltf.accessors.accessors.len; ++i)
+    sink += read_accessor(&gltf, i);
+  Array<uint32_t> indices;
+  indices.alloc = &MemoryService::instance()->system_allocator;
+  indices.init(64, 8);
+  for(size_t m = 0; m < gltf.meshes.meshes.len; ++m)
+    for(size_t p = 0; p < gltf.meshes.meshes[m].primitives.len; ++p)
+      if (glTF::decode_indices(&gltf, &gltf.meshes.meshes[m].primitives[p], &indices) && indices.len)
+        sink += indices.mem[indices.len - 1];
+  indices.alloc->deallocate(indices.mem);
+  glTF::validate_indices(&gltf, &diagnostics);
+
+  if (lent)
+    buffers[0].data = nullptr;
+  diagnostics.kill();
+  gltf.kill();
+  return 0;
+}
+
+#ifndef SOL_LIBFUZZER
+int main(int argc, char **argv) {
+  std::vector<uint8_t> bytes;
+  for(int i = 1; i < argc || i == 1; ++i) {
+    FILE *f = argc > 1 ? fopen(argv[i], "rb") : stdin;
+    if (!f) {
+      fprintf(stderr, "fuzz: cannot open %s\n", argv[i]);
+      continue;
+    }
+    bytes.clear();
+    uint8_t chunk[4096];
+    size_t got;
+    while((got = fread(chunk, 1, sizeof(chunk), f)) > 0)
+      bytes.insert(bytes.end(), chunk, chunk + got);
+    if (f != stdin)
+      fclose(f);
+    LLVMFuzzerTestOneInput(bytes.data(), bytes.size());
+  }
+  return 0;
+}
+#endif
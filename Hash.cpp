@@ -0,0 +1,151 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Hash.hpp"
+
+namespace Sol {
+
+namespace {
+  constexpr uint64_t PRIME_1 = 11400714785074694791ull;
+  constexpr uint64_t PRIME_2 = 14029467366897019727ull;
+  constexpr uint64_t PRIME_3 = 1609587929392839161ull;
+  constexpr uint64_t PRIME_4 = 9650029242287828579ull;
+  constexpr uint64_t PRIME_5 = 2870177450012600261ull;
+
+  inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+  }
+  inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+  inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME_2;
+    acc = rotl(acc, 31);
+    return acc * PRIME_1;
+  }
+  inline uint64_t merge(uint64_t acc, uint64_t lane) {
+    acc ^= round(0, lane);
+    return acc * PRIME_1 + PRIME_4;
+  }
+  // Whole 32 byte rounds of bytes, returns the bytes consumed
+  size_t rounds(uint64_t lanes[4], const uint8_t *bytes, size_t size) {
+    uint64_t a = lanes[0];
+    uint64_t b = lanes[1];
+    uint64_t c = lanes[2];
+    uint64_t d = lanes[3];
+    size_t i = 0;
+    for(; i + 32 <= size; i += 32) {
+      a = round(a, read64(bytes + i));
+      b = round(b, read64(bytes + i + 8));
+      c = round(c, read64(bytes + i + 16));
+      d = round(d, read64(bytes + i + 24));
+    }
+    lanes[0] = a;
+    lanes[1] = b;
+    lanes[2] = c;
+    lanes[3] = d;
+    return i;
+  }
+}
+
+// Hasher ////////////////////////
+void Hasher::init(uint64_t seed_) {
+  seed = seed_;
+  lanes[0] = seed + PRIME_1 + PRIME_2;
+  lanes[1] = seed + PRIME_2;
+  lanes[2] = seed;
+  lanes[3] = seed - PRIME_1;
+  tail_len = 0;
+  total = 0;
+}
+void Hasher::update(const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t*)data;
+  total += size;
+  if (tail_len) {
+    size_t take = 32 - tail_len < size ? 32 - tail_len : size;
+    memcpy(tail + tail_len, bytes, take);
+    tail_len += take;
+    bytes += take;
+    size -= take;
+    if (tail_len < 32)
+      return;
+    rounds(lanes, tail, 32);
+    tail_len = 0;
+  }
+  size_t done = rounds(lanes, bytes, size);
+  memcpy(tail, bytes + done, size - done);
+  tail_len = size - done;
+}
+uint64_t Hasher::digest() const {
+  uint64_t h;
+  if (total >= 32) {
+    h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+    for(uint32_t i = 0; i < 4; ++i)
+      h = merge(h, lanes[i]);
+  } else {
+    h = seed + PRIME_5;
+  }
+  h += total;
+
+  const uint8_t *p = tail;
+  const uint8_t *end = tail + tail_len;
+  for(; p + 8 <= end; p += 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * PRIME_1 + PRIME_4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)read32(p) * PRIME_1;
+    h = rotl(h, 23) * PRIME_2 + PRIME_3;
+    p += 4;
+  }
+  for(; p < end; ++p) {
+    h ^= *p * PRIME_5;
+    h = rotl(h, 11) * PRIME_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME_2;
+  h ^= h >> 29;
+  h *= PRIME_3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+  Hasher hasher;
+  hasher.init(seed);
+  hasher.update(data, size);
+  return hasher.digest();
+}
+
+bool hash_file(const char *path, uint64_t seed, uint64_t *hash) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  Hasher hasher;
+  hasher.init(seed);
+  uint8_t chunk[64 * 1024];
+  bool ok = true;
+  for(;;) {
+    ssize_t got = read(fd, chunk, sizeof(chunk));
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0)
+      ok = false;
+    if (got <= 0)
+      break;
+    hasher.update(chunk, got);
+  }
+  close(fd);
+  *hash = hasher.digest();
+  return ok;
+}
+
+} // namespace Sol
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Sol {
+
+// 64 bit non cryptographic hash over byte streams, following XXH64: four independent 64 bit
+// lanes eat 32 bytes per round, so the loop has no carried dependency between lanes and
+// vectorizes. Hashing the same bytes in one call or over several update()s gives the same result.
+struct Hasher {
+  uint64_t lanes[4];
+  uint8_t tail[32]; // bytes not yet forming a whole round
+  uint32_t tail_len = 0;
+  uint64_t total = 0;
+  uint64_t seed = 0;
+
+  void init(uint64_t seed_ = 0);
+  void update(const void *data, size_t size);
+  uint64_t digest() const;
+};
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed = 0);
+// Hash of a whole file's bytes, false if it cannot be read
+bool hash_file(const char *path, uint64_t seed, uint64_t *hash);
+
+} // namespace Sol
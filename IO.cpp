@@ -0,0 +1,335 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "IO.hpp"
+#include "ThreadPool.hpp"
+
+namespace Sol {
+
+namespace {
+  // pread until done, EOF or error
+  int64_t pread_all(int fd, uint8_t *dst, size_t size, size_t offset) {
+    size_t done = 0;
+    while(done < size) {
+      ssize_t got = pread(fd, dst + done, size - done, offset + done);
+      if (got < 0) {
+        if (errno == EINTR)
+          continue;
+        return -errno;
+      }
+      if (got == 0)
+        break;
+      done += got;
+    }
+    return done;
+  }
+  void read_one(ReadRequest *request) {
+    int fd = open(request->path, O_RDONLY);
+    if (fd < 0) {
+      request->result = -errno;
+      return;
+    }
+    request->result = pread_all(fd, request->dst, request->size, 0);
+    close(fd);
+  }
+  void read_range(size_t begin, size_t end, void *arg) {
+    ReadRequest *requests = (ReadRequest*)arg;
+    for(size_t i = begin; i < end; ++i)
+      read_one(&requests[i]);
+  }
+
+#ifdef __linux__
+  int uring_setup(uint32_t entries, io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+  }
+  int uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+  }
+#endif
+}
+
+void FileReader::init(ThreadPool *pool_, uint32_t queue_depth, bool use_uring) {
+  uring = use_uring && init_uring(queue_depth);
+  pool = pool_;
+}
+void FileReader::kill() {
+#ifdef __linux__
+  if (sqes)
+    munmap(sqes, sqes_size);
+  if (cq_ptr && cq_ptr != sq_ptr)
+    munmap(cq_ptr, cq_size);
+  if (sq_ptr)
+    munmap(sq_ptr, sq_size);
+  if (ring_fd >= 0)
+    close(ring_fd);
+#endif
+  ring_fd = -1;
+  sq_ptr = nullptr;
+  cq_ptr = nullptr;
+  sqes = nullptr;
+  depth = 0;
+  uring = false;
+  pool = nullptr;
+}
+
+bool FileReader::init_uring(uint32_t queue_depth) {
+#ifdef __linux__
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd = uring_setup(queue_depth, &params);
+  if (ring_fd < 0) {
+    ring_fd = -1;
+    return false;
+  }
+  depth = params.sq_entries;
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) {
+    if (cq_size > sq_size)
+      sq_size = cq_size;
+    cq_size = sq_size;
+  }
+  sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    sq_ptr = nullptr;
+    kill();
+    return false;
+  }
+  if (single) {
+    cq_ptr = sq_ptr;
+  } else {
+    cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      cq_ptr = nullptr;
+      kill();
+      return false;
+    }
+  }
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    sqes = nullptr;
+    kill();
+    return false;
+  }
+
+  uint8_t *sq = (uint8_t*)sq_ptr;
+  sq_head = (uint32_t*)(sq + params.sq_off.head);
+  sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+  sq_mask = (uint32_t*)(sq + params.sq_off.ring_mask);
+  sq_array = (uint32_t*)(sq + params.sq_off.array);
+  uint8_t *cq = (uint8_t*)cq_ptr;
+  cq_head = (uint32_t*)(cq + params.cq_off.head);
+  cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+  cq_mask = (uint32_t*)(cq + params.cq_off.ring_mask);
+  cqes = cq + params.cq_off.cqes;
+  return true;
+#else
+  (void)queue_depth;
+  return false;
+#endif
+}
+
+int64_t FileReader::file_size(const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return -1;
+  return st.st_size;
+}
+
+bool FileReader::read(ReadRequest *requests, size_t count) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (uring)
+    read_uring(requests, count);
+  else
+    read_fallback(requests, count);
+
+  bool ok = true;
+  for(size_t i = 0; i < count; ++i)
+    ok &= requests[i].result == (int64_t)requests[i].size;
+  return ok;
+}
+
+void FileReader::read_fallback(ReadRequest *requests, size_t count) {
+  if (pool)
+    pool->parallel_for(count, 1, read_range, requests);
+  else
+    read_range(0, count, requests);
+}
+
+// Keeps up to depth reads in flight, resubmitting short reads for the remainder. If the ring itself
+// fails, everything it still has is reaped before returning (the kernel may be writing into dst)
+// and the requests it did not finish go through read_fallback.
+bool FileReader::read_uring(ReadRequest *requests, size_t count) {
+#ifdef __linux__
+  struct Pending {
+    int fd;
+    size_t done;
+    bool finished; // result is final
+  };
+  // Files are opened as their request enters the ring and closed once it finishes, so no more
+  // than depth are open at a time however large the batch
+  Pending *pending = new Pending[count];
+  for(size_t i = 0; i < count; ++i) {
+    pending[i].fd = -1;
+    pending[i].done = 0;
+    pending[i].finished = false;
+    requests[i].result = 0;
+  }
+  auto finish = [&](size_t i) {
+    pending[i].finished = true;
+    close(pending[i].fd);
+    pending[i].fd = -1;
+  };
+
+  size_t next = 0; // next request to submit
+  uint32_t in_flight = 0; // queued in the SQ ring or with the kernel, not yet completed
+  bool ring_ok = true;
+  io_uring_sqe *sqe_ring = (io_uring_sqe*)sqes;
+  io_uring_cqe *cqe_ring = (io_uring_cqe*)cqes;
+
+  auto queue = [&](size_t i) {
+    uint32_t tail = *sq_tail;
+    uint32_t index = tail & *sq_mask;
+    io_uring_sqe *sqe = &sqe_ring[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = pending[i].fd;
+    sqe->addr = (uint64_t)(uintptr_t)(requests[i].dst + pending[i].done);
+    size_t left = requests[i].size - pending[i].done;
+    sqe->len = left > (1u << 30) ? (1u << 30) : (uint32_t)left;
+    sqe->off = pending[i].done;
+    sqe->user_data = i;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++in_flight;
+  };
+
+  std::vector<size_t> retry;
+  // Takes every completion the CQ ring holds, false if it was empty
+  auto reap = [&]() {
+    uint32_t head = *cq_head;
+    uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+      return false;
+    for(; head != tail; ++head) {
+      io_uring_cqe *cqe = &cqe_ring[head & *cq_mask];
+      size_t i = cqe->user_data;
+      --in_flight;
+      if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        // Kernel without IORING_OP_READ
+        requests[i].result = pread_all(pending[i].fd, requests[i].dst + pending[i].done, 
+                                       requests[i].size - pending[i].done, pending[i].done);
+        if (requests[i].result >= 0)
+          requests[i].result += pending[i].done;
+        finish(i);
+      } else if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+        retry.push_back(i);
+      } else if (cqe->res < 0) {
+        requests[i].result = cqe->res;
+        finish(i);
+      } else {
+        pending[i].done += cqe->res;
+        requests[i].result = pending[i].done;
+        if (cqe->res > 0 && pending[i].done < requests[i].size)
+          retry.push_back(i);
+        else
+          finish(i);
+      }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return true;
+  };
+
+  while(next < count || in_flight || !retry.empty()) {
+    while(in_flight < depth && !retry.empty()) {
+      queue(retry.back());
+      retry.pop_back();
+    }
+    while(in_flight < depth && next < count) {
+      size_t i = next++;
+      pending[i].fd = open(requests[i].path, O_RDONLY);
+      if (pending[i].fd < 0) {
+        // Out of descriptors is left unfinished for read_fallback, once the ring's are closed
+        if (errno != EMFILE && errno != ENFILE) {
+          requests[i].result = -errno;
+          pending[i].finished = true;
+        }
+        continue;
+      }
+      if (requests[i].size == 0)
+        finish(i);
+      else
+        queue(i);
+    }
+    if (in_flight == 0)
+      break;
+
+    // Whatever the kernel has not consumed yet (a short submit or an interrupted call) goes again.
+    // Only wait when something is with the kernel, or nothing could ever complete.
+    uint32_t unsubmitted = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    bool waiting = in_flight > unsubmitted;
+    int ret = uring_enter(ring_fd, unsubmitted, waiting ? 1 : 0, waiting ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0 && errno != EINTR && !((errno == EAGAIN || errno == EBUSY) && waiting)) {
+      ring_ok = false;
+      break;
+    }
+    reap();
+  }
+
+  if (!ring_ok) {
+    // Take back what the kernel never consumed, then wait out what it has. Completions are posted
+    // without io_uring_enter, so if even waiting fails keep polling the CQ ring.
+    uint32_t head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    in_flight -= *sq_tail - head;
+    __atomic_store_n(sq_tail, head, __ATOMIC_RELEASE);
+    while(in_flight) {
+      if (reap())
+        continue;
+      if (uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        usleep(100);
+    }
+  }
+
+  for(size_t i = 0; i < count; ++i)
+    if (pending[i].fd >= 0)
+      close(pending[i].fd);
+
+  // Only what the ring did not finish is read again
+  std::vector<ReadRequest> left;
+  std::vector<size_t> left_index;
+  for(size_t i = 0; i < count; ++i) {
+    if (!pending[i].finished) {
+      left.push_back(requests[i]);
+      left_index.push_back(i);
+    }
+  }
+  delete[] pending;
+  if (!left.empty()) {
+    read_fallback(left.data(), left.size());
+    for(size_t i = 0; i < left.size(); ++i)
+      requests[left_index[i]].result = left[i].result;
+  }
+  // The ring failed once, later batches go straight to the fallback
+  if (!ring_ok)
+    uring = false;
+  return ring_ok;
+#else
+  read_fallback(requests, count);
+  return false;
+#endif
+}
+
+} // namespace Sol
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace Sol {
+
+struct ThreadPool;
+
+// One file read into memory the caller has already allocated
+struct ReadRequest {
+  const char *path = nullptr;
+  uint8_t *dst = nullptr;
+  size_t size = 0; // bytes to read from the start of the file
+  int64_t result = 0; // bytes read, or -errno
+};
+
+// Reads batches of whole files. On Linux every read of a batch is in flight at once through io_uring,
+// so a cold load is bound by the device rather than by per file latency. Where io_uring is
+// unavailable the reads are spread over a ThreadPool with pread (or run in order without a pool).
+struct FileReader {
+  static constexpr uint32_t DEFAULT_DEPTH = 64;
+
+  ThreadPool *pool = nullptr;
+  bool uring = false; // io_uring in use
+  std::mutex lock; // one batch at a time
+
+  // io_uring state, see io_uring_setup(2)
+  int ring_fd = -1;
+  uint32_t depth = 0;
+  void *sq_ptr = nullptr;
+  size_t sq_size = 0;
+  void *cq_ptr = nullptr;
+  size_t cq_size = 0;
+  void *sqes = nullptr;
+  size_t sqes_size = 0;
+  uint32_t *sq_head = nullptr;
+  uint32_t *sq_tail = nullptr;
+  uint32_t *sq_mask = nullptr;
+  uint32_t *sq_array = nullptr;
+  uint32_t *cq_head = nullptr;
+  uint32_t *cq_tail = nullptr;
+  uint32_t *cq_mask = nullptr;
+  void *cqes = nullptr;
+
+  // pool may be nullptr. use_uring false forces the fallback.
+  void init(ThreadPool *pool_, uint32_t queue_depth = DEFAULT_DEPTH, bool use_uring = true);
+  void kill();
+
+  // Fills in each request's result, true if every file was read in full
+  bool read(ReadRequest *requests, size_t count);
+  // Size of a file, -1 if it cannot be stat'd
+  static int64_t file_size(const char *path);
+
+  bool init_uring(uint32_t queue_depth);
+  // Every request has its result on return, false if the ring failed and was given up on
+  bool read_uring(ReadRequest *requests, size_t count);
+  void read_fallback(ReadRequest *requests, size_t count);
+};
+
+} // namespace Sol
@@ -0,0 +1,185 @@
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SOL_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include "Indices.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  template <typename T>
+  inline uint32_t load(const uint8_t *ptr) {
+    T t;
+    memcpy(&t, ptr, sizeof(T));
+    return t;
+  }
+
+  template <typename T>
+  uint32_t max_scalar(const uint8_t *data, uint32_t count, uint32_t stride, uint32_t max) {
+    for(uint32_t i = 0; i < count; ++i) {
+      uint32_t v = load<T>(data + (size_t)i * stride);
+      max = v > max ? v : max;
+    }
+    return max;
+  }
+  template <typename T>
+  uint32_t decode_scalar(const uint8_t *data, uint32_t count, uint32_t stride, uint32_t *dst, uint32_t max) {
+    for(uint32_t i = 0; i < count; ++i) {
+      uint32_t v = load<T>(data + (size_t)i * stride);
+      dst[i] = v;
+      max = v > max ? v : max;
+    }
+    return max;
+  }
+
+#ifdef SOL_AVX2
+  bool has_avx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+  }
+
+  __attribute__((target("avx2")))
+  uint32_t reduce_epu32(__m256i v) {
+    __m128i m = _mm_max_epu32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    m = _mm_max_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(m);
+  }
+
+  // Packed indices only, the tail is left to the scalar loop. *done is how many were read.
+  __attribute__((target("avx2")))
+  uint32_t max_avx2(const uint8_t *data, uint32_t count, Accessor::ComponentType type, uint32_t *done) {
+    __m256i acc = _mm256_setzero_si256();
+    uint32_t i = 0;
+    switch(type) {
+      case Accessor::UINT8:
+        for(; i + 32 <= count; i += 32)
+          acc = _mm256_max_epu8(acc, _mm256_loadu_si256((const __m256i*)(data + i)));
+        // Widen the 8 bit lanes so one reduction serves every type
+        acc = _mm256_max_epu16(_mm256_unpacklo_epi8(acc, _mm256_setzero_si256()),
+                               _mm256_unpackhi_epi8(acc, _mm256_setzero_si256()));
+        acc = _mm256_max_epu32(_mm256_unpacklo_epi16(acc, _mm256_setzero_si256()),
+                               _mm256_unpackhi_epi16(acc, _mm256_setzero_si256()));
+        break;
+      case Accessor::UINT16:
+        for(; i + 16 <= count; i += 16)
+          acc = _mm256_max_epu16(acc, _mm256_loadu_si256((const __m256i*)(data + (size_t)i * 2)));
+        acc = _mm256_max_epu32(_mm256_unpacklo_epi16(acc, _mm256_setzero_si256()),
+                               _mm256_unpackhi_epi16(acc, _mm256_setzero_si256()));
+        break;
+      case Accessor::UINT32:
+        for(; i + 8 <= count; i += 8)
+          acc = _mm256_max_epu32(acc, _mm256_loadu_si256((const __m256i*)(data + (size_t)i * 4)));
+        break;
+      default:
+        break;
+    }
+    *done = i;
+    return reduce_epu32(acc);
+  }
+
+  __attribute__((target("avx2")))
+  uint32_t decode_avx2(const uint8_t *data, uint32_t count, Accessor::ComponentType type, uint32_t *dst,
+                       uint32_t *done) {
+    __m256i acc = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+      __m256i v;
+      switch(type) {
+        case Accessor::UINT8:  v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(data + i))); break;
+        case Accessor::UINT16: v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(data + (size_t)i * 2))); break;
+        default:               v = _mm256_loadu_si256((const __m256i*)(data + (size_t)i * 4)); break;
+      }
+      acc = _mm256_max_epu32(acc, v);
+      _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+    *done = i;
+    return reduce_epu32(acc);
+  }
+#endif
+}
+
+uint32_t max_index(const uint8_t *data, uint32_t count, uint32_t stride, Accessor::ComponentType type) {
+  if (count == 0 || (type != Accessor::UINT8 && type != Accessor::UINT16 && type != Accessor::UINT32))
+    return 0;
+  uint32_t max = 0;
+  uint32_t done = 0;
+#ifdef SOL_AVX2
+  if (stride == component_size(type) && has_avx2())
+    max = max_avx2(data, count, type, &done);
+#endif
+  data += (size_t)done * stride;
+  count -= done;
+  switch(type) {
+    case Accessor::UINT8:  return max_scalar<uint8_t>(data, count, stride, max);
+    case Accessor::UINT16: return max_scalar<uint16_t>(data, count, stride, max);
+    default:               return max_scalar<uint32_t>(data, count, stride, max);
+  }
+}
+
+uint32_t decode_indices(const uint8_t *data, uint32_t count, uint32_t stride, Accessor::ComponentType type,
+                        uint32_t *dst) {
+  if (count == 0 || (type != Accessor::UINT8 && type != Accessor::UINT16 && type != Accessor::UINT32))
+    return 0;
+  uint32_t max = 0;
+  uint32_t done = 0;
+#ifdef SOL_AVX2
+  if (stride == component_size(type) && has_avx2())
+    max = decode_avx2(data, count, type, dst, &done);
+#endif
+  data += (size_t)done * stride;
+  dst += done;
+  count -= done;
+  switch(type) {
+    case Accessor::UINT8:  return decode_scalar<uint8_t>(data, count, stride, dst, max);
+    case Accessor::UINT16: return decode_scalar<uint16_t>(data, count, stride, dst, max);
+    default:               return decode_scalar<uint32_t>(data, count, stride, dst, max);
+  }
+}
+
+uint32_t vertex_count(glTF *gltf, const Mesh::Primitive *prim) {
+  uint32_t count = UINT32_MAX;
+  for(size_t i = 0; i < prim->attributes.len; ++i) {
+    int32_t a = prim->attributes.mem[i].accessor;
+    if (a < 0 || (size_t)a >= gltf->accessors.accessors.len || gltf->accessors.accessors.mem[a].count == INVALID_COUNT)
+      return 0;
+    uint32_t c = gltf->accessors.accessors.mem[a].count;
+    count = c < count ? c : count;
+  }
+  return count == UINT32_MAX ? 0 : count;
+}
+
+bool decode_indices(glTF *gltf, const Mesh::Primitive *prim, Array<uint32_t> *dst) {
+  uint32_t vertices = vertex_count(gltf, prim);
+  dst->len = 0;
+  if (prim->indices == INVALID_INDEX) {
+    dst->reserve(vertices);
+    for(uint32_t i = 0; i < vertices; ++i)
+      dst->mem[i] = i;
+    dst->len = vertices;
+    return true;
+  }
+
+  uint32_t stride;
+  const uint8_t *data = gltf->accessor_data(prim->indices, &stride);
+  if (!data)
+    return false;
+  const Accessor &accessor = gltf->accessors.accessors.mem[prim->indices];
+  bool unsigned_int = accessor.component_type == Accessor::UINT8 || accessor.component_type == Accessor::UINT16 ||
+                      accessor.component_type == Accessor::UINT32;
+  if (accessor.type != Accessor::SCALAR || !unsigned_int)
+    return false;
+  dst->reserve(accessor.count);
+  uint32_t max = decode_indices(data, accessor.count, stride, accessor.component_type, dst->mem);
+  if (max >= vertices)
+    return false;
+  dst->len = accessor.count;
+  return true;
+}
+
+} // namespace glTF
+} // namespace Sol
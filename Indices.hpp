@@ -0,0 +1,27 @@
+#pragma once
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Index buffers as they go to the GPU: widened to uint32 and checked against the vertex count.
+// On x86 the kernels use AVX2 where the CPU has it (checked once at runtime), elsewhere and for
+// strided views they fall back to scalar loops.
+
+// Largest of count indices of type (UINT8, UINT16 or UINT32) at data, stride bytes apart. 0 for
+// no indices or another type.
+uint32_t max_index(const uint8_t *data, uint32_t count, uint32_t stride, Accessor::ComponentType type);
+// Widen count indices into dst and return the largest, in the same pass over the source
+uint32_t decode_indices(const uint8_t *data, uint32_t count, uint32_t stride, Accessor::ComponentType type,
+                        uint32_t *dst);
+
+// Vertices of a primitive: the smallest count among its attribute accessors, 0 if it has none
+uint32_t vertex_count(glTF *gltf, const Mesh::Primitive *prim);
+// Decode a primitive's indices into dst (resized to fit). false if its index accessor does not
+// resolve (see glTF::accessor_data) or any index is not below vertex_count(). Buffers must be
+// loaded. Primitives without indices decode to 0, 1, 2... vertex_count() - 1.
+bool decode_indices(glTF *gltf, const Mesh::Primitive *prim, Array<uint32_t> *dst);
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,304 @@
+#include <cstring>
+#include <fstream>
+
+#include "Lazy.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  const char* SECTION_KEYS[glTF::SECTION_COUNT + 1] = {
+    "asset", "scenes", "nodes", "buffers", "bufferViews", "accessors", "meshes", "skins",
+    "textures", "images", "samplers", "materials", "cameras", "animations", "scene",
+  };
+
+  inline bool is_space(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+  inline const char* skip_space(const char *p, const char *end) {
+    while(p < end && is_space(*p))
+      ++p;
+    return p;
+  }
+  // p is at the opening quote, returns one past the closing one
+  const char* skip_string(const char *p, const char *end) {
+    ++p;
+    while(p < end) {
+      char c = *p++;
+      if (c == '\\')
+        ++p;
+      else if (c == '"')
+        return p <= end ? p : nullptr;
+    }
+    return nullptr;
+  }
+  // One past the end of the value at p, nullptr if the text ends first
+  const char* skip_value(const char *p, const char *end) {
+    if (p >= end)
+      return nullptr;
+    if (*p == '"')
+      return skip_string(p, end);
+    if (*p == '{' || *p == '[') {
+      uint32_t depth = 0;
+      while(p < end) {
+        char c = *p;
+        if (c == '"') {
+          p = skip_string(p, end);
+          if (!p)
+            return nullptr;
+          continue;
+        }
+        if (c == '{' || c == '[') {
+          ++depth;
+        } else if (c == '}' || c == ']') {
+          if (--depth == 0)
+            return p + 1;
+        }
+        ++p;
+      }
+      return nullptr;
+    }
+    while(p < end && *p != ',' && *p != '}' && *p != ']' && !is_space(*p))
+      ++p;
+    return p;
+  }
+
+  size_t section_len(glTF *gltf, glTF::Section section) {
+    switch(section) {
+      case glTF::SCENES:       return gltf->scenes.scenes.len;
+      case glTF::NODES:        return gltf->nodes.nodes.len;
+      case glTF::BUFFERS:      return gltf->buffers.buffers.len;
+      case glTF::BUFFER_VIEWS: return gltf->buffer_views.views.len;
+      case glTF::ACCESSORS:    return gltf->accessors.accessors.len;
+      case glTF::MESHES:       return gltf->meshes.meshes.len;
+      case glTF::SKINS:        return gltf->skins.skins.len;
+      case glTF::TEXTURES:     return gltf->textures.textures.len;
+      case glTF::IMAGES:       return gltf->images.images.len;
+      case glTF::SAMPLERS:     return gltf->samplers.samplers.len;
+      case glTF::MATERIALS:    return gltf->materials.materials.len;
+      case glTF::CAMERAS:      return gltf->cameras.cameras.len;
+      case glTF::ANIMATIONS:   return gltf->animations.animations.len;
+      default: return 0;
+    }
+  }
+  void* element_ptr(glTF *gltf, glTF::Section section, size_t index) {
+    switch(section) {
+      case glTF::SCENES:       return &gltf->scenes.scenes[index];
+      case glTF::NODES:        return &gltf->nodes.nodes[index];
+      case glTF::BUFFERS:      return &gltf->buffers.buffers[index];
+      case glTF::BUFFER_VIEWS: return &gltf->buffer_views.views[index];
+      case glTF::ACCESSORS:    return &gltf->accessors.accessors[index];
+      case glTF::MESHES:       return &gltf->meshes.meshes[index];
+      case glTF::SKINS:        return &gltf->skins.skins[index];
+      case glTF::TEXTURES:     return &gltf->textures.textures[index];
+      case glTF::IMAGES:       return &gltf->images.images[index];
+      case glTF::SAMPLERS:     return &gltf->samplers.samplers[index];
+      case glTF::MATERIALS:    return &gltf->materials.materials[index];
+      case glTF::CAMERAS:      return &gltf->cameras.cameras[index];
+      case glTF::ANIMATIONS:   return &gltf->animations.animations[index];
+      default: return nullptr;
+    }
+  }
+}
+
+// Skim ////////////////////////
+bool skim_object(const char *text, size_t size, const char *const *keys, uint32_t key_count, TextRange *ranges) {
+  const char *end = text + size;
+  const char *p = skip_space(text, end);
+  if (p == end || *p != '{')
+    return false;
+  p = skip_space(p + 1, end);
+  if (p < end && *p == '}')
+    return true;
+
+  while(p < end) {
+    if (*p != '"')
+      return false;
+    const char *key = p + 1;
+    p = skip_string(p, end);
+    if (!p)
+      return false;
+    size_t key_len = p - 1 - key;
+    p = skip_space(p, end);
+    if (p == end || *p != ':')
+      return false;
+    p = skip_space(p + 1, end);
+    const char *value = p;
+    p = skip_value(p, end);
+    if (!p)
+      return false;
+
+    for(uint32_t i = 0; i < key_count; ++i) {
+      if (strlen(keys[i]) == key_len && memcmp(keys[i], key, key_len) == 0) {
+        ranges[i].begin = value - text;
+        ranges[i].end = p - text;
+        break;
+      }
+    }
+    p = skip_space(p, end);
+    if (p < end && *p == '}')
+      return true;
+    if (p == end || *p != ',')
+      return false;
+    p = skip_space(p + 1, end);
+  }
+  return false;
+}
+
+bool skim_array(const char *text, TextRange range, Array<TextRange> *elements) {
+  const char *end = text + range.end;
+  const char *p = skip_space(text + range.begin, end);
+  if (p == end || *p != '[')
+    return false;
+  p = skip_space(p + 1, end);
+  if (p < end && *p == ']')
+    return true;
+
+  while(p < end) {
+    const char *value = p;
+    p = skip_value(p, end);
+    if (!p)
+      return false;
+    elements->push({(uint32_t)(value - text), (uint32_t)(p - text)});
+    p = skip_space(p, end);
+    if (p < end && *p == ']')
+      return true;
+    if (p == end || *p != ',')
+      return false;
+    p = skip_space(p + 1, end);
+  }
+  return false;
+}
+
+// LazyDocument ////////////////////////
+bool LazyDocument::open(const char *path, const Limits &limits_) {
+  limits = limits_;
+  std::ifstream f(path, std::ios::binary | std::ios::ate);
+  if (!f.is_open())
+    return false;
+  std::streamoff file_size = f.tellg();
+  // Ranges are 32 bit
+  if (file_size < 0 || (uint64_t)file_size > limits.max_bytes || (uint64_t)file_size >= UINT32_MAX)
+    return false;
+  size = file_size;
+  f.seekg(0);
+  text = (char*)alloc->allocate(size ? size : 1, 16);
+  f.read(text, size);
+  if ((size_t)f.gcount() != size) {
+    kill();
+    return false;
+  }
+  return skim();
+}
+bool LazyDocument::open_text(const char *text_, size_t size_, const Limits &limits_) {
+  limits = limits_;
+  if (size_ > limits.max_bytes || size_ >= UINT32_MAX)
+    return false;
+  size = size_;
+  text = (char*)alloc->allocate(size ? size : 1, 16);
+  memcpy(text, text_, size);
+  return skim();
+}
+bool LazyDocument::skim() {
+  TextRange ranges[glTF::SECTION_COUNT + 1];
+  if (!skim_object(text, size, SECTION_KEYS, glTF::SECTION_COUNT + 1, ranges)) {
+    kill();
+    return false;
+  }
+  for(uint32_t i = 0; i < glTF::SECTION_COUNT; ++i)
+    sections[i] = ranges[i];
+  scene = ranges[glTF::SECTION_COUNT];
+  return true;
+}
+
+void LazyDocument::kill() {
+  gltf.kill();
+  if (text)
+    alloc->deallocate(text);
+  text = nullptr;
+  size = 0;
+  for(uint32_t i = 0; i < glTF::SECTION_COUNT; ++i) {
+    if (elements[i].mem)
+      alloc->deallocate(elements[i].mem);
+    if (element_state[i].mem)
+      alloc->deallocate(element_state[i].mem);
+    elements[i] = Array<TextRange>();
+    element_state[i] = Array<uint8_t>();
+    sections[i] = TextRange();
+    filled[i] = false;
+  }
+  scene = TextRange();
+}
+
+glTF* LazyDocument::section(glTF::Section section) {
+  if (filled[section])
+    return &gltf;
+  filled[section] = true;
+
+  Json part = Json::object();
+  Json value;
+  if (section == glTF::SCENES && !scene.empty() &&
+      parse_json(text + scene.begin, scene.end - scene.begin, &value, limits))
+    part["scene"] = std::move(value);
+  // Part of it already went in an element at a time, so finish that way. Only "scene" is left
+  // for fill_section then.
+  if (element_state[section].mem) {
+    for(size_t i = 0; i < elements[section].len; ++i)
+      element(section, i);
+  } else {
+    TextRange range = sections[section];
+    if (!range.empty() && parse_json(text + range.begin, range.end - range.begin, &value, limits))
+      part[SECTION_KEYS[section]] = std::move(value);
+  }
+  gltf.fill_section(part, section);
+  return &gltf;
+}
+
+bool LazyDocument::prepare_elements(glTF::Section section) {
+  if (section == glTF::ASSET)
+    return false;
+  if (element_state[section].mem)
+    return true;
+
+  elements[section].alloc = alloc;
+  element_state[section].alloc = alloc;
+  elements[section].init(16, 8);
+  if (!sections[section].empty() && !skim_array(text, sections[section], &elements[section]))
+    elements[section].len = 0;
+
+  size_t count = elements[section].len;
+  element_state[section].init(count ? count : 1, 8);
+  element_state[section].len = count;
+  memset(element_state[section].mem, 0, count);
+  gltf.reserve_section(section, count);
+  return true;
+}
+
+size_t LazyDocument::count(glTF::Section section) {
+  if (section == glTF::ASSET)
+    return 1;
+  if (filled[section] && !element_state[section].mem)
+    return section_len(&gltf, section);
+  prepare_elements(section);
+  return elements[section].len;
+}
+
+void* LazyDocument::element(glTF::Section section, size_t index) {
+  if (filled[section] && !element_state[section].mem)
+    return index < section_len(&gltf, section) ? element_ptr(&gltf, section, index) : nullptr;
+  if (!prepare_elements(section) || index >= elements[section].len)
+    return nullptr;
+
+  uint8_t *state = &element_state[section].mem[index];
+  if (*state == ELEMENT_PENDING) {
+    TextRange range = elements[section].mem[index];
+    Json value;
+    *state = ELEMENT_REJECTED;
+    if (parse_json(text + range.begin, range.end - range.begin, &value, limits)) {
+      gltf.fill_element(value, section, index);
+      *state = ELEMENT_FILLED;
+    }
+  }
+  return *state == ELEMENT_FILLED ? element_ptr(&gltf, section, index) : nullptr;
+}
+
+} // namespace glTF
+} // namespace Sol
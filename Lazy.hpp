@@ -0,0 +1,64 @@
+#pragma once
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// [begin, end) of a json value in the source text
+struct TextRange {
+  uint32_t begin = 0;
+  uint32_t end = 0;
+
+  bool empty() const { return begin == end; }
+};
+
+// Byte ranges of the top level values of a json object, found without building a Json: the skim
+// only tracks strings and bracket depth. False if the text is not an object or is cut short.
+bool skim_object(const char *text, size_t size, const char *const *keys, uint32_t key_count, TextRange *ranges);
+// Ranges of the elements of the json array at range, appended to elements
+bool skim_array(const char *text, TextRange range, Array<TextRange> *elements);
+
+// A glTF filled on demand. open() reads the file and skims the top level; a section is parsed and
+// filled the first time it is asked for, and single accessors, meshes and animations can be
+// filled without the rest of their section. Not thread safe.
+struct LazyDocument {
+  glTF gltf;
+  char *text = nullptr;
+  size_t size = 0;
+  TextRange sections[glTF::SECTION_COUNT];
+  TextRange scene; // "scene"
+  bool filled[glTF::SECTION_COUNT] = {};
+  // Per element state of sections being filled one element at a time
+  enum ElementState : uint8_t {
+    ELEMENT_PENDING,
+    ELEMENT_FILLED,
+    ELEMENT_REJECTED, // not json or over the limits, left default
+  };
+  Array<TextRange> elements[glTF::SECTION_COUNT];
+  Array<uint8_t> element_state[glTF::SECTION_COUNT];
+  // Applied to the file in open() and to every part parsed from it
+  Limits limits;
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  bool open(const char *path, const Limits &limits_ = Limits());
+  // Same, from json text in memory, which is copied
+  bool open_text(const char *text_, size_t size_, const Limits &limits_ = Limits());
+  void kill();
+
+  // gltf with section filled
+  glTF* section(glTF::Section section);
+  // nullptr if out of range or the element's json was rejected
+  Accessor* accessor(size_t index) { return (Accessor*)element(glTF::ACCESSORS, index); }
+  Mesh* mesh(size_t index) { return (Mesh*)element(glTF::MESHES, index); }
+  Animation* animation(size_t index) { return (Animation*)element(glTF::ANIMATIONS, index); }
+  // Number of elements in an array section, without filling it
+  size_t count(glTF::Section section);
+
+  void* element(glTF::Section section, size_t index);
+  bool prepare_elements(glTF::Section section);
+  bool skim();
+};
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,403 @@
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+#include "Loader.hpp"
+#include "VulkanErrors.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  constexpr size_t READ_CHUNK = 1024 * 1024;
+
+  // Runs the next stage, then queues the one after it against the same counter so the counter
+  // only reaches 0 once the whole load has stopped
+  void run_stage(void *arg) {
+    AsyncLoad *load = (AsyncLoad*)arg;
+    uint32_t stage = load->completed.load(std::memory_order_relaxed);
+    if (load->cancelled.load(std::memory_order_relaxed)) {
+      load->status.store(AsyncLoad::CANCELLED, std::memory_order_release);
+      return;
+    }
+
+    bool ok = false;
+    switch(stage) {
+      case AsyncLoad::READ:    ok = load->read(); break;
+      case AsyncLoad::PARSE:   ok = load->parse(); break;
+      case AsyncLoad::FILL:    ok = load->fill(); break;
+      case AsyncLoad::BUFFERS: ok = load->load_buffers(); break;
+      case AsyncLoad::DECODE:  ok = load->decode(); break;
+      default: break;
+    }
+    if (!ok) {
+      AsyncLoad::Status status = load->cancelled.load() ? AsyncLoad::CANCELLED : AsyncLoad::FAILED;
+      load->status.store(status, std::memory_order_release);
+      return;
+    }
+
+    load->completed.store(stage + 1, std::memory_order_release);
+    if (stage + 1 == AsyncLoad::STAGE_COUNT)
+      load->status.store(AsyncLoad::DONE, std::memory_order_release);
+    else
+      load->pool->submit(run_stage, load, &load->counter);
+  }
+
+  void load_buffer_range(size_t begin, size_t end, void *arg) {
+    AsyncLoad *load = (AsyncLoad*)arg;
+    for(size_t i = begin; i < end; ++i) {
+      if (load->cancelled.load(std::memory_order_relaxed))
+        return;
+      if (load->gltf.load_buffer(i, load->dir.c_str()))
+        load->done_items[AsyncLoad::BUFFERS].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  // Whole file into *buf, which grows as needed. false if it cannot be read.
+  bool read_file(const char *path, char **buf, size_t *cap, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+      return false;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0) {
+      fclose(f);
+      return false;
+    }
+    if ((size_t)len > *cap || !*buf) {
+      if (*buf)
+        mem_free(*buf);
+      *buf = (char*)mem_alloca(len ? len : 1, 16);
+      *cap = len;
+    }
+    *size = fread(*buf, 1, len, f);
+    fclose(f);
+    return *size == (size_t)len;
+  }
+
+  std::string dir_of(const char *path) {
+    std::string str = path;
+    size_t slash = str.find_last_of("/\\");
+    return slash == std::string::npos ? "." : str.substr(0, slash);
+  }
+  // Documents reaching one file through different directories or escapes share its Resource
+  std::string resource_path(const std::string &dir, const StringBuffer &uri) {
+    std::string file = dir + "/" + decode_uri(uri.c_str());
+    size_t slash = file.rfind('/');
+    return canonical_dir(file.substr(0, slash)) + file.substr(slash);
+  }
+
+  // Each slot loads documents until the paths run out
+  void run_slot(void *arg) {
+    BatchLoader::Slot *slot = (BatchLoader::Slot*)arg;
+    BatchLoader *batch = slot->batch;
+    for(;;) {
+      size_t index = batch->next.fetch_add(1, std::memory_order_relaxed);
+      if (index >= batch->path_count)
+        return;
+      bool ok = batch->load_document(slot, index);
+      if (ok && batch->visit)
+        batch->visit(&slot->gltf, index, batch->user);
+      batch->release(slot);
+      if (ok)
+        batch->files.fetch_add(1, std::memory_order_relaxed);
+      else
+        batch->failed.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void decode_range(size_t begin, size_t end, void *arg) {
+    AsyncLoad *load = (AsyncLoad*)arg;
+    for(size_t i = begin; i < end; ++i) {
+      AsyncLoad::Stream *stream = &load->streams.mem[i];
+      stream->data = load->gltf.accessor_data(i, &stream->stride);
+    }
+    load->done_items[AsyncLoad::DECODE].fetch_add(end - begin, std::memory_order_relaxed);
+  }
+}
+
+void AsyncLoad::start(const char *path_, ThreadPool *pool_) {
+  // A load still running finishes first, then everything the last one made is freed
+  kill();
+  pool = pool_;
+  path = path_;
+  dir = dir_of(path_);
+
+  completed.store(0, std::memory_order_relaxed);
+  cancelled.store(false, std::memory_order_relaxed);
+  for(uint32_t i = 0; i < STAGE_COUNT; ++i) {
+    done_items[i].store(0, std::memory_order_relaxed);
+    total_items[i].store(0, std::memory_order_relaxed);
+  }
+  status.store(RUNNING, std::memory_order_release);
+  pool->submit(run_stage, this, &counter);
+}
+void AsyncLoad::wait() {
+  if (pool)
+    pool->wait(&counter);
+}
+void AsyncLoad::kill() {
+  wait();
+  if (text)
+    mem_free(text);
+  text = nullptr;
+  json = Json();
+  gltf.kill();
+  if (streams.mem)
+    alloc->deallocate(streams.mem);
+  streams = Array<Stream>();
+  status.store(IDLE, std::memory_order_relaxed);
+  pool = nullptr;
+}
+
+float AsyncLoad::progress(Stage stage) {
+  if (reached(stage))
+    return 1.0f;
+  uint64_t total = total_items[stage].load(std::memory_order_relaxed);
+  if (total == 0)
+    return 0.0f;
+  return (float)done_items[stage].load(std::memory_order_relaxed) / (float)total;
+}
+
+bool AsyncLoad::read() {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (size <= 0) {
+    fclose(f);
+    return false;
+  }
+
+  text_size = size;
+  total_items[READ].store(text_size, std::memory_order_relaxed);
+  text = (char*)mem_alloc(text_size);
+  if (!text) {
+    fclose(f);
+    return false;
+  }
+  size_t pos = 0;
+  while(pos < text_size && !cancelled.load(std::memory_order_relaxed)) {
+    size_t want = text_size - pos < READ_CHUNK ? text_size - pos : READ_CHUNK;
+    size_t got = fread(text + pos, 1, want, f);
+    if (got == 0)
+      break;
+    pos += got;
+    done_items[READ].store(pos, std::memory_order_relaxed);
+  }
+  fclose(f);
+  if (pos != text_size) {
+    mem_free(text);
+    text = nullptr;
+    return false;
+  }
+  return true;
+}
+bool AsyncLoad::parse() {
+  total_items[PARSE].store(1, std::memory_order_relaxed);
+  bool ok = parse_json(text, text_size, &json);
+  mem_free(text);
+  text = nullptr;
+  if (!ok)
+    return false;
+  done_items[PARSE].store(1, std::memory_order_relaxed);
+  return true;
+}
+bool AsyncLoad::fill() {
+  total_items[FILL].store(1, std::memory_order_relaxed);
+  gltf.fill(json, pool);
+  // Everything has been copied out
+  json = Json();
+  done_items[FILL].store(1, std::memory_order_relaxed);
+  return true;
+}
+bool AsyncLoad::load_buffers() {
+  size_t count = gltf.buffers.buffers.len;
+  if (reader) {
+    total_items[BUFFERS].store(1, std::memory_order_relaxed);
+    bool ok = gltf.load_files(dir.c_str(), reader);
+    done_items[BUFFERS].store(1, std::memory_order_relaxed);
+    return ok;
+  }
+  total_items[BUFFERS].store(count, std::memory_order_relaxed);
+  // One buffer per job, files are few and large
+  pool->parallel_for(count, 1, load_buffer_range, this);
+  return done_items[BUFFERS].load() == count;
+}
+bool AsyncLoad::decode() {
+  size_t count = gltf.accessors.accessors.len;
+  total_items[DECODE].store(count, std::memory_order_relaxed);
+  if (count == 0)
+    return true;
+  if (streams.mem)
+    alloc->deallocate(streams.mem);
+  streams.alloc = alloc;
+  streams.init(count, 8);
+  streams.len = count;
+  pool->parallel_for(count, 0, decode_range, this);
+  return true;
+}
+
+// BatchLoader ////////////////////
+void BatchLoader::init(ThreadPool *pool_, uint32_t in_flight) {
+  pool = pool_;
+  slot_count = in_flight ? in_flight : pool->thread_count() * 2;
+  slots = new Slot[slot_count];
+  for(uint32_t i = 0; i < slot_count; ++i)
+    slots[i].batch = this;
+}
+void BatchLoader::kill() {
+  for(uint32_t i = 0; i < slot_count; ++i) {
+    release(&slots[i]);
+    if (slots[i].gltf.arena.mem)
+      slots[i].gltf.kill();
+    if (slots[i].text)
+      mem_free(slots[i].text);
+  }
+  delete[] slots;
+  slots = nullptr;
+  slot_count = 0;
+
+  for(auto &entry : cache) {
+    if (entry.second->data)
+      mem_free(entry.second->data);
+    delete entry.second;
+  }
+  cache.clear();
+  cache_bytes = 0;
+}
+
+BatchLoader::Stats BatchLoader::run(const char **paths_, size_t count, Visit visit_, void *user_) {
+  paths = paths_;
+  path_count = count;
+  visit = visit_;
+  user = user_;
+  next = 0;
+  files = 0;
+  failed = 0;
+  bytes = 0;
+  shared = 0;
+
+  auto begin = std::chrono::steady_clock::now();
+  ThreadPool::Counter counter;
+  for(uint32_t i = 0; i < slot_count; ++i)
+    pool->submit(run_slot, &slots[i], &counter);
+  pool->wait(&counter);
+  auto end = std::chrono::steady_clock::now();
+
+  Stats stats;
+  stats.files = files;
+  stats.failed = failed;
+  stats.bytes = bytes;
+  stats.shared = shared;
+  stats.seconds = std::chrono::duration<double>(end - begin).count();
+  return stats;
+}
+
+bool BatchLoader::load_document(Slot *slot, size_t index) {
+  const char *path = paths[index];
+  size_t size;
+  if (!read_file(path, &slot->text, &slot->text_cap, &size))
+    return false;
+  bytes.fetch_add(size, std::memory_order_relaxed);
+
+  if (!parse_json(slot->text, size, &slot->json))
+    return false;
+  // Documents are the unit of parallelism here, so each fill runs on its slot's thread
+  slot->gltf.fill(slot->json, nullptr);
+
+  std::string dir = dir_of(path);
+  glTF *gltf = &slot->gltf;
+  for(size_t i = 0; i < gltf->buffers.buffers.len; ++i) {
+    Buffer *buf = &gltf->buffers.buffers[i];
+    if (buf->uri.len == 0 || strncmp(buf->uri.c_str(), "data:", 5) == 0)
+      continue;
+    Resource *res = acquire(resource_path(dir, buf->uri));
+    slot->resources.push_back(res);
+    if (!res->data || res->size < buf->byte_length)
+      return false;
+    buf->data = res->data;
+  }
+  for(size_t i = 0; load_images && i < gltf->images.images.len; ++i) {
+    Image *img = &gltf->images.images[i];
+    if (img->uri.len == 0 || strncmp(img->uri.c_str(), "data:", 5) == 0)
+      continue;
+    Resource *res = acquire(resource_path(dir, img->uri));
+    slot->resources.push_back(res);
+    img->data = res->data;
+    img->byte_length = res->size;
+  }
+  return true;
+}
+
+BatchLoader::Resource* BatchLoader::acquire(const std::string &path) {
+  Resource *res;
+  {
+    std::lock_guard<std::mutex> guard(cache_lock);
+    Resource *&entry = cache[path];
+    if (!entry)
+      entry = new Resource;
+    res = entry;
+    ++res->refs;
+  }
+
+  std::lock_guard<std::mutex> guard(res->lock);
+  if (res->loaded) {
+    shared.fetch_add(1, std::memory_order_relaxed);
+    return res;
+  }
+  char *data = nullptr;
+  size_t cap = 0;
+  size_t size = 0;
+  if (read_file(path.c_str(), &data, &cap, &size)) {
+    res->data = (uint8_t*)data;
+    res->size = size;
+    bytes.fetch_add(size, std::memory_order_relaxed);
+  } else if (data) {
+    mem_free(data);
+  }
+  res->loaded = true;
+
+  std::lock_guard<std::mutex> cache_guard(cache_lock);
+  cache_bytes += res->size;
+  return res;
+}
+void BatchLoader::release(Slot *slot) {
+  // The shared bytes must not be freed with the document
+  glTF *gltf = &slot->gltf;
+  for(size_t i = 0; i < gltf->buffers.buffers.len; ++i)
+    gltf->buffers.buffers[i].data = nullptr;
+  for(size_t i = 0; i < gltf->images.images.len; ++i)
+    gltf->images.images[i].data = nullptr;
+
+  std::lock_guard<std::mutex> guard(cache_lock);
+  for(Resource *res : slot->resources)
+    --res->refs;
+  slot->resources.clear();
+  if (cache_bytes > cache_limit)
+    trim();
+}
+void BatchLoader::trim() {
+  for(auto it = cache.begin(); it != cache.end() && cache_bytes > cache_limit;) {
+    Resource *res = it->second;
+    if (res->refs || !res->loaded) {
+      ++it;
+      continue;
+    }
+    cache_bytes -= res->size;
+    if (res->data)
+      mem_free(res->data);
+    delete res;
+    it = cache.erase(it);
+  }
+}
+
+void BatchLoader::Stats::report(std::ostream &out) {
+  out << "Batch: " << files << " files (" << failed << " failed, " << shared << " shared resources) in " 
+      << seconds << "s, " << files_per_sec() << " files/sec, " << mb_per_sec() << " MB/sec\n";
+}
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "glTF.hpp"
+#include "ThreadPool.hpp"
+#include "IO.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// A glTF load running on a ThreadPool. Each stage is its own job, so the stages of several loads
+// interleave on the workers. Stages publish their results as they complete: once reached(FILL) the
+// document structure (gltf minus buffer data) may be read while buffers are still loading.
+struct AsyncLoad {
+  enum Stage : uint32_t {
+    READ, // file bytes into memory
+    PARSE, // json text to Json
+    FILL, // Json to gltf
+    BUFFERS, // Buffer::data for every buffer (and Image::data with a reader)
+    DECODE, // streams for every accessor
+    STAGE_COUNT,
+  };
+  enum Status : uint32_t {
+    IDLE,
+    RUNNING,
+    DONE,
+    FAILED,
+    CANCELLED,
+  };
+  // Where an accessor's elements are, see glTF::accessor_data
+  struct Stream {
+    const uint8_t *data = nullptr;
+    uint32_t stride = 0;
+  };
+
+  glTF gltf;
+  Array<Stream> streams; // one per accessor after DECODE, data is nullptr if it did not resolve
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  ThreadPool *pool = nullptr;
+  // When set, BUFFERS reads every buffer and image in one batch through it
+  FileReader *reader = nullptr;
+  ThreadPool::Counter counter;
+  std::string path;
+  std::string dir;
+  Json json;
+  char *text = nullptr;
+  size_t text_size = 0;
+
+  std::atomic<uint32_t> status{IDLE};
+  std::atomic<uint32_t> completed{0}; // stages done
+  std::atomic<bool> cancelled{false};
+  std::atomic<uint64_t> done_items[STAGE_COUNT] = {}; // bytes for READ, sections for FILL...
+  std::atomic<uint64_t> total_items[STAGE_COUNT] = {};
+
+  // Start loading path_ on pool, returns immediately. A previous load is waited for and freed.
+  void start(const char *path_, ThreadPool *pool_);
+  // Stop at the next stage boundary, wait() still has to be called
+  void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+  // Help run jobs until the load has finished, failed or been cancelled
+  void wait();
+  // Wait, then free everything
+  void kill();
+
+  bool reached(Stage stage) { return completed.load(std::memory_order_acquire) > stage; }
+  // 0 to 1
+  float progress(Stage stage);
+  Status get_status() { return (Status)status.load(std::memory_order_acquire); }
+
+  bool read();
+  bool parse();
+  bool fill();
+  bool load_buffers();
+  bool decode();
+};
+
+// Loads many documents on one pool with a fixed number in flight. Every in flight slot keeps its glTF
+// (so its arena) and its file buffer from one document to the next. External buffers and images are
+// read once per path and shared by all the documents referencing them: Buffer::data and Image::data
+// are only valid during the visit callback.
+struct BatchLoader {
+  // One external file
+  struct Resource {
+    std::mutex lock; // held while loading
+    uint8_t *data = nullptr;
+    size_t size = 0;
+    bool loaded = false;
+    uint32_t refs = 0; // documents in flight using it, under BatchLoader::cache_lock
+  };
+  struct Slot {
+    BatchLoader *batch = nullptr;
+    glTF gltf;
+    Json json;
+    char *text = nullptr;
+    size_t text_cap = 0;
+    std::vector<Resource*> resources; // held by the current document
+  };
+  struct Stats {
+    uint64_t files = 0;
+    uint64_t failed = 0;
+    uint64_t bytes = 0; // json plus external files actually read
+    uint64_t shared = 0; // external references served from the cache
+    double seconds = 0;
+
+    double files_per_sec() { return seconds > 0 ? files / seconds : 0; }
+    double mb_per_sec() { return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0; }
+    void report(std::ostream &out);
+  };
+  // Called on a worker for every document which loaded, gltf is reused once it returns
+  typedef void (*Visit)(glTF *gltf, size_t index, void *user);
+
+  ThreadPool *pool = nullptr;
+  Slot *slots = nullptr;
+  uint32_t slot_count = 0;
+  bool load_images = true;
+  // Resources no document is using are freed once the cache holds more than this
+  size_t cache_limit = 256 * 1024 * 1024;
+
+  std::mutex cache_lock;
+  std::unordered_map<std::string, Resource*> cache;
+  size_t cache_bytes = 0;
+
+  const char **paths = nullptr;
+  size_t path_count = 0;
+  std::atomic<size_t> next{0};
+  Visit visit = nullptr;
+  void *user = nullptr;
+  std::atomic<uint64_t> files{0};
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> shared{0};
+
+  // in_flight documents at once, 0 for two per pool thread
+  void init(ThreadPool *pool_, uint32_t in_flight);
+  void kill();
+  // Load every path, visit each one which loads, returns once all are done
+  Stats run(const char **paths_, size_t count, Visit visit_, void *user_);
+
+  bool load_document(Slot *slot, size_t index);
+  Resource* acquire(const std::string &path);
+  void release(Slot *slot);
+  // Call with cache_lock held
+  void trim();
+};
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,169 @@
+#include <cstring>
+
+#include "NameIndex.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  inline uint32_t slot_of(uint32_t name, uint32_t mask) {
+    return (name * 0x9E3779B1u) >> 7 & mask;
+  }
+  uint32_t table_size(size_t count) {
+    uint32_t size = 4;
+    while(size < count * 2)
+      size *= 2;
+    return size;
+  }
+  // Name id of element i of each kind's array, a function per kind keeps build() a single loop
+  uint32_t name_of(glTF *gltf, NameIndex::Kind kind, size_t i) {
+    switch(kind) {
+      case NameIndex::NODES:      return gltf->nodes.nodes.mem[i].name;
+      case NameIndex::MESHES:     return gltf->meshes.meshes.mem[i].name;
+      case NameIndex::MATERIALS:  return gltf->materials.materials.mem[i].name;
+      case NameIndex::ANIMATIONS: return gltf->animations.animations.mem[i].name;
+      default: return StringPool::NONE;
+    }
+  }
+  size_t count_of(glTF *gltf, NameIndex::Kind kind) {
+    switch(kind) {
+      case NameIndex::NODES:      return gltf->nodes.nodes.len;
+      case NameIndex::MESHES:     return gltf->meshes.meshes.len;
+      case NameIndex::MATERIALS:  return gltf->materials.materials.len;
+      case NameIndex::ANIMATIONS: return gltf->animations.animations.len;
+      default: return 0;
+    }
+  }
+}
+
+void NameIndex::init(glTF *gltf_) {
+  gltf = gltf_;
+  built.store(false, std::memory_order_relaxed);
+}
+void NameIndex::kill() {
+  if (block)
+    alloc->deallocate(block);
+  block = nullptr;
+  roots = nullptr;
+  root_count = 0;
+  for(uint32_t k = 0; k < KIND_COUNT; ++k)
+    tables[k] = Table();
+  built.store(false, std::memory_order_relaxed);
+}
+
+void NameIndex::build() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (built.load(std::memory_order_relaxed))
+    return;
+
+  size_t node_count = gltf->nodes.nodes.len;
+  uint32_t sizes[KIND_COUNT];
+  size_t bytes = 0;
+  for(uint32_t k = 0; k < KIND_COUNT; ++k) {
+    size_t named = 0;
+    size_t count = count_of(gltf, (Kind)k);
+    for(size_t i = 0; i < count; ++i)
+      named += name_of(gltf, (Kind)k, i) != StringPool::NONE;
+    sizes[k] = table_size(named);
+    bytes += sizes[k] * sizeof(Slot);
+  }
+  // Parent flags live at the end of the block while roots are collected
+  size_t root_bytes = node_count * sizeof(int32_t);
+  block = alloc->allocate(bytes + root_bytes + node_count + 1, 8);
+  ABORT(block, "NameIndex: allocation failed");
+
+  uint8_t *ptr = (uint8_t*)block;
+  for(uint32_t k = 0; k < KIND_COUNT; ++k) {
+    Table *table = &tables[k];
+    table->slots = (Slot*)ptr;
+    table->mask = sizes[k] - 1;
+    ptr += sizes[k] * sizeof(Slot);
+    for(uint32_t s = 0; s < sizes[k]; ++s)
+      table->slots[s] = {StringPool::NONE, INVALID_INDEX};
+
+    size_t count = count_of(gltf, (Kind)k);
+    for(size_t i = 0; i < count; ++i) {
+      uint32_t name = name_of(gltf, (Kind)k, i);
+      if (name == StringPool::NONE)
+        continue;
+      uint32_t s = slot_of(name, table->mask);
+      while(table->slots[s].name != StringPool::NONE && table->slots[s].name != name)
+        s = (s + 1) & table->mask;
+      // Keep the first object with this name
+      if (table->slots[s].name == StringPool::NONE)
+        table->slots[s] = {name, (int32_t)i};
+    }
+  }
+
+  roots = (int32_t*)ptr;
+  uint8_t *has_parent = ptr + root_bytes;
+  memset(has_parent, 0, node_count);
+  for(size_t i = 0; i < node_count; ++i) {
+    Node *node = &gltf->nodes.nodes.mem[i];
+    for(size_t c = 0; c < node->children.len; ++c) {
+      int32_t child = node->children.mem[c];
+      if (child >= 0 && (size_t)child < node_count)
+        has_parent[child] = 1;
+    }
+  }
+  root_count = 0;
+  for(size_t i = 0; i < node_count; ++i)
+    if (!has_parent[i])
+      roots[root_count++] = i;
+
+  built.store(true, std::memory_order_release);
+}
+
+int32_t NameIndex::lookup(Kind kind, uint32_t name) {
+  Table *table = &tables[kind];
+  uint32_t s = slot_of(name, table->mask);
+  while(table->slots[s].name != StringPool::NONE) {
+    if (table->slots[s].name == name)
+      return table->slots[s].index;
+    s = (s + 1) & table->mask;
+  }
+  return INVALID_INDEX;
+}
+
+int32_t NameIndex::find(Kind kind, StringView name) {
+  if (!built.load(std::memory_order_acquire))
+    build();
+  uint32_t id = gltf->strings.find(name.str, name.len);
+  if (id == StringPool::NONE)
+    return INVALID_INDEX;
+  return lookup(kind, id);
+}
+
+namespace {
+  // Node at path[start..] among candidates. Siblings may share a name, so each match is tried.
+  int32_t resolve(glTF *gltf, const int32_t *candidates, size_t count, StringView path, size_t start) {
+    size_t end = start;
+    while(end < path.len && path.str[end] != '/')
+      ++end;
+    uint32_t id = gltf->strings.find(path.str + start, end - start);
+    if (id == StringPool::NONE)
+      return INVALID_INDEX;
+
+    Array<Node> &nodes = gltf->nodes.nodes;
+    for(size_t i = 0; i < count; ++i) {
+      int32_t c = candidates[i];
+      if (c < 0 || (size_t)c >= nodes.len || nodes.mem[c].name != id)
+        continue;
+      if (end == path.len)
+        return c;
+      int32_t found = resolve(gltf, nodes.mem[c].children.mem, nodes.mem[c].children.len, path, end + 1);
+      if (found != INVALID_INDEX)
+        return found;
+    }
+    return INVALID_INDEX;
+  }
+}
+
+int32_t NameIndex::find_path(StringView path) {
+  if (!built.load(std::memory_order_acquire))
+    build();
+  return resolve(gltf, roots, root_count, path, 0);
+}
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Name -> index for the named objects of a document, built on the first query. Names are already
+// interned, so a lookup is one StringPool::find and one probe sequence over string ids. Where
+// several objects share a name the lowest index wins. The tables and the list of root nodes
+// live in one allocation.
+struct NameIndex {
+  enum Kind {
+    NODES,
+    MESHES,
+    MATERIALS,
+    ANIMATIONS,
+    KIND_COUNT,
+  };
+  // Open addressing, linear probing. name is StringPool::NONE in empty slots.
+  struct Slot {
+    uint32_t name;
+    int32_t index;
+  };
+  struct Table {
+    Slot *slots = nullptr;
+    uint32_t mask = 0;
+  };
+
+  glTF *gltf = nullptr;
+  Table tables[KIND_COUNT];
+  int32_t *roots = nullptr; // nodes without a parent, in index order
+  uint32_t root_count = 0;
+  void *block = nullptr;
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+  std::atomic<bool> built{false};
+  std::mutex lock;
+
+  // Nothing is built until the first find
+  void init(glTF *gltf_);
+  void kill();
+
+  // INVALID_INDEX if there is no such name
+  int32_t find(Kind kind, StringView name);
+  int32_t find(Kind kind, const char *name) { return find(kind, StringView::get(name)); }
+  // Node at a '/' separated path of names from a root node, e.g. "root/arm/hand"
+  int32_t find_path(StringView path);
+  int32_t find_path(const char *path) { return find_path(StringView::get(path)); }
+
+  void build();
+  int32_t lookup(Kind kind, uint32_t name);
+};
+
+} // namespace glTF
+} // namespace Sol
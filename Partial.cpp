@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string>
+#include <unistd.h>
+
+#include "Partial.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Closure ////////////////////////
+void Closure::init(LazyDocument *doc_) {
+  doc = doc_;
+  for(uint32_t i = glTF::SCENES; i < glTF::SECTION_COUNT; ++i) {
+    size_t count = doc->count((glTF::Section)i);
+    used[i].alloc = alloc;
+    used[i].init(count ? count : 1, 8);
+    used[i].len = count;
+    memset(used[i].mem, 0, count);
+  }
+}
+void Closure::kill() {
+  for(uint32_t i = 0; i < glTF::SECTION_COUNT; ++i) {
+    if (used[i].mem)
+      alloc->deallocate(used[i].mem);
+    used[i] = Array<uint8_t>();
+  }
+  doc = nullptr;
+}
+
+bool Closure::mark(glTF::Section section, int32_t index) {
+  if (index < 0 || (size_t)index >= used[section].len || used[section].mem[index])
+    return false;
+  // A rejected element is left out, as if nothing referenced it
+  used[section].mem[index] = doc->element(section, index) != nullptr;
+  return used[section].mem[index];
+}
+
+bool Closure::add_scene(int32_t scene) {
+  if (!mark(glTF::SCENES, scene) && !has(glTF::SCENES, scene))
+    return false;
+  Scene *s = (Scene*)doc->element(glTF::SCENES, scene);
+  for(size_t i = 0; i < s->nodes.len; ++i)
+    add_node(s->nodes.mem[i]);
+  return true;
+}
+
+bool Closure::add_node(int32_t root) {
+  if (root < 0 || (size_t)root >= used[glTF::NODES].len)
+    return false;
+  // Explicit stack: hierarchies can be deeper than the call stack
+  Array<int32_t> stack;
+  stack.alloc = alloc;
+  stack.init(64, 8);
+  stack.push(root);
+  while(stack.len) {
+    int32_t index = stack.mem[--stack.len];
+    if (!mark(glTF::NODES, index))
+      continue;
+    Node *node = (Node*)doc->element(glTF::NODES, index);
+    for(size_t i = 0; i < node->children.len; ++i)
+      stack.push(node->children.mem[i]);
+    add_mesh(node->mesh);
+    add_skin(node->skin, &stack);
+    mark(glTF::CAMERAS, node->camera);
+  }
+  alloc->deallocate(stack.mem);
+  return true;
+}
+
+void Closure::add_mesh(int32_t index) {
+  if (!mark(glTF::MESHES, index))
+    return;
+  Mesh *mesh = (Mesh*)doc->element(glTF::MESHES, index);
+  for(size_t i = 0; i < mesh->primitives.len; ++i) {
+    Mesh::Primitive *prim = &mesh->primitives.mem[i];
+    for(size_t j = 0; j < prim->attributes.len; ++j)
+      add_accessor(prim->attributes.mem[j].accessor);
+    for(size_t t = 0; t < prim->targets.len; ++t)
+      for(size_t j = 0; j < prim->targets.mem[t].attributes.len; ++j)
+        add_accessor(prim->targets.mem[t].attributes.mem[j].accessor);
+    add_accessor(prim->indices);
+    add_material(prim->material);
+  }
+}
+void Closure::add_skin(int32_t index, Array<int32_t> *stack) {
+  if (!mark(glTF::SKINS, index))
+    return;
+  Skin *skin = (Skin*)doc->element(glTF::SKINS, index);
+  // Joints may sit outside the subtree being loaded
+  for(size_t i = 0; i < skin->joints.len; ++i)
+    stack->push(skin->joints.mem[i]);
+  if (skin->skeleton != INVALID_INDEX)
+    stack->push(skin->skeleton);
+  add_accessor(skin->i_bind_matrices);
+}
+void Closure::add_material(int32_t index) {
+  if (!mark(glTF::MATERIALS, index))
+    return;
+  Material *mat = (Material*)doc->element(glTF::MATERIALS, index);
+  add_texture(mat->pbr_metallic_roughness.base_color_texture.index);
+  add_texture(mat->pbr_metallic_roughness.metallic_roughness_texture.index);
+  add_texture(mat->normal_texture.index);
+  add_texture(mat->occlusion_texture.index);
+  add_texture(mat->emissive_texture.index);
+}
+void Closure::add_texture(int32_t index) {
+  if (!mark(glTF::TEXTURES, index))
+    return;
+  Texture *tex = (Texture*)doc->element(glTF::TEXTURES, index);
+  mark(glTF::SAMPLERS, tex->sampler);
+  if (mark(glTF::IMAGES, tex->source))
+    add_buffer_view(((Image*)doc->element(glTF::IMAGES, tex->source))->buffer_view);
+}
+void Closure::add_accessor(int32_t index) {
+  if (!mark(glTF::ACCESSORS, index))
+    return;
+  Accessor *accessor = (Accessor*)doc->element(glTF::ACCESSORS, index);
+  add_buffer_view(accessor->buffer_view);
+  if (accessor->sparse.count != INVALID_COUNT) {
+    add_buffer_view(accessor->sparse.indices.buffer_view);
+    add_buffer_view(accessor->sparse.values.buffer_view);
+  }
+}
+void Closure::add_buffer_view(int32_t index) {
+  if (!mark(glTF::BUFFER_VIEWS, index))
+    return;
+  mark(glTF::BUFFERS, ((BufferView*)doc->element(glTF::BUFFER_VIEWS, index))->buffer);
+}
+
+// Ranges ////////////////////////
+namespace {
+  struct ByteRange {
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  bool read_range(int fd, uint8_t *dst, ByteRange range) {
+    uint64_t done = 0;
+    uint64_t size = range.end - range.begin;
+    while(done < size) {
+      ssize_t got = pread(fd, dst + range.begin + done, size - done, range.begin + done);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        return false;
+      done += got;
+    }
+    return true;
+  }
+}
+
+bool load_ranges(Closure *closure, const char *dir) {
+  glTF *gltf = &closure->doc->gltf;
+  size_t view_count = closure->used[glTF::BUFFER_VIEWS].len;
+  Array<ByteRange> ranges;
+  ranges.alloc = closure->alloc;
+  ranges.init(view_count ? view_count : 1, 8);
+
+  bool ok = true;
+  for(size_t b = 0; b < closure->used[glTF::BUFFERS].len; ++b) {
+    if (!closure->has(glTF::BUFFERS, b))
+      continue;
+    Buffer *buf = &gltf->buffers.buffers[b];
+    if (buf->data || buf->uri.len == 0 || strncmp(buf->uri.c_str(), "data:", 5) == 0)
+      continue;
+
+    ranges.len = 0;
+    for(size_t v = 0; v < view_count; ++v) {
+      if (!closure->has(glTF::BUFFER_VIEWS, v))
+        continue;
+      BufferView *view = &gltf->buffer_views.views[v];
+      if (view->buffer != (int32_t)b || view->byte_length == INVALID_COUNT)
+        continue;
+      uint64_t begin = view->byte_offset != INVALID_COUNT ? view->byte_offset : 0;
+      uint64_t end = begin + view->byte_length;
+      if (end > buf->byte_length) {
+        ok = false;
+        continue;
+      }
+      ranges.push({begin, end});
+    }
+    if (ranges.len == 0)
+      continue;
+
+    std::sort(ranges.mem, ranges.mem + ranges.len, [](const ByteRange &x, const ByteRange &y) {
+      return x.begin < y.begin;
+    });
+    size_t merged = 0;
+    for(size_t i = 1; i < ranges.len; ++i) {
+      if (ranges.mem[i].begin <= ranges.mem[merged].end) {
+        if (ranges.mem[i].end > ranges.mem[merged].end)
+          ranges.mem[merged].end = ranges.mem[i].end;
+      } else {
+        ranges.mem[++merged] = ranges.mem[i];
+      }
+    }
+    ranges.len = merged + 1;
+
+    std::string path = std::string(dir) + "/" + decode_uri(buf->uri.c_str());
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      ok = false;
+      continue;
+    }
+    // byte_length comes from the file, so the allocation is bound by what the views use and
+    // what the buffer file really holds
+    uint64_t used_end = ranges.mem[ranges.len - 1].end;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || used_end > (uint64_t)st.st_size) {
+      close(fd);
+      ok = false;
+      continue;
+    }
+    buf->data = (uint8_t*)mem_alloca(used_end ? used_end : 1, 16);
+    if (!buf->data) {
+      close(fd);
+      ok = false;
+      continue;
+    }
+    bool read = true;
+    for(size_t i = 0; i < ranges.len && read; ++i)
+      read = read_range(fd, buf->data, ranges.mem[i]);
+    close(fd);
+    if (!read) {
+      mem_free(buf->data);
+      buf->data = nullptr;
+      ok = false;
+    }
+  }
+  closure->alloc->deallocate(ranges.mem);
+  return ok;
+}
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Lazy.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// The objects a scene or node subtree needs: nodes (with skin joints), meshes, skins, cameras,
+// materials, textures, samplers, images, accessors, buffer views and buffers. Collecting it fills
+// exactly those elements of the LazyDocument and nothing else; the rest keep their defaults.
+struct Closure {
+  LazyDocument *doc = nullptr;
+  Array<uint8_t> used[glTF::SECTION_COUNT]; // one flag per element
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  void init(LazyDocument *doc_);
+  void kill();
+
+  bool has(glTF::Section section, size_t index) const {
+    return index < used[section].len && used[section].mem[index];
+  }
+  // The scene's root nodes and everything below them
+  bool add_scene(int32_t scene);
+  // The node and everything below it
+  bool add_node(int32_t node);
+
+  // Mark index, false if it is out of range, already marked or its element was rejected
+  bool mark(glTF::Section section, int32_t index);
+  void add_mesh(int32_t mesh);
+  void add_skin(int32_t skin, Array<int32_t> *stack);
+  void add_material(int32_t material);
+  void add_texture(int32_t texture);
+  void add_accessor(int32_t accessor);
+  void add_buffer_view(int32_t view);
+};
+
+// Allocate each used buffer's Buffer::data and read only the byte ranges its used buffer views
+// cover (merged where they touch), relative to dir. data is still addressed by buffer offset but
+// only reaches the end of the last used range, not byte_length; bytes outside the ranges are
+// left unset. A buffer file shorter than its used ranges fails.
+bool load_ranges(Closure *closure, const char *dir);
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Sol {
+
+struct HashKey {
+  const char *str;
+  uint32_t value;
+};
+
+constexpr size_t const_strlen(const char *str) {
+  size_t len = 0;
+  while(str[len] != '\0')
+    ++len;
+  return len;
+}
+constexpr uint32_t seeded_hash(const char *str, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+  for(size_t i = 0; i < len; ++i) {
+    h ^= (uint8_t)str[i];
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  return h;
+}
+
+// Collision free string -> value table over a fixed key set, built at compile time by searching
+// for a hash seed which puts every key in its own slot. A lookup is one hash, one slot read and
+// one compare against the single candidate key. SIZE must be a power of 2 >= COUNT.
+template <size_t COUNT, size_t SIZE>
+struct PerfectHash {
+  static constexpr uint32_t MAX_SEED = 1 << 16;
+
+  const char *keys[COUNT] = {};
+  uint32_t lens[COUNT] = {};
+  uint32_t values[COUNT] = {};
+  uint8_t slots[SIZE] = {}; // key index + 1, 0 is empty
+  uint32_t seed = MAX_SEED; // MAX_SEED if no seed was found
+
+  constexpr PerfectHash(const HashKey (&keys_)[COUNT]) {
+    static_assert((SIZE & (SIZE - 1)) == 0 && SIZE >= COUNT && COUNT < 255, "PerfectHash: bad size");
+    for(size_t i = 0; i < COUNT; ++i) {
+      keys[i] = keys_[i].str;
+      lens[i] = const_strlen(keys_[i].str);
+      values[i] = keys_[i].value;
+    }
+    for(uint32_t s = 0; s < MAX_SEED; ++s) {
+      for(size_t i = 0; i < SIZE; ++i)
+        slots[i] = 0;
+      bool ok = true;
+      for(size_t i = 0; i < COUNT && ok; ++i) {
+        size_t slot = seeded_hash(keys[i], lens[i], s) & (SIZE - 1);
+        if (slots[slot])
+          ok = false;
+        else
+          slots[slot] = i + 1;
+      }
+      if (ok) {
+        seed = s;
+        return;
+      }
+    }
+  }
+
+  uint32_t find(const char *str, size_t len, uint32_t fallback) const {
+    uint32_t i = slots[seeded_hash(str, len, seed) & (SIZE - 1)];
+    if (i == 0)
+      return fallback;
+    --i;
+    if (lens[i] != len || memcmp(keys[i], str, len) != 0)
+      return fallback;
+    return values[i];
+  }
+  constexpr bool valid() const { return seed != MAX_SEED; }
+};
+
+template <size_t SIZE, size_t COUNT>
+constexpr PerfectHash<COUNT, SIZE> make_perfect_hash(const HashKey (&keys)[COUNT]) {
+  return PerfectHash<COUNT, SIZE>(keys);
+}
+
+} // namespace Sol
@@ -0,0 +1,323 @@
+#include <cstring>
+
+#include "RefIndex.hpp"
+#include "Reload.hpp"
+
+namespace Sol {
+namespace glTF {
+
+namespace {
+  // refs(emit) calls emit(key, item) for every reference, and is run twice: once to count the
+  // items of each key, once to place them. Keys out of range are dropped.
+  template <typename T, typename Refs>
+  void build_csr(Csr<T> *csr, size_t key_count, Allocator *alloc, Refs refs) {
+    Array<uint32_t> &offsets = csr->offsets;
+    offsets.alloc = alloc;
+    offsets.init(key_count + 1, 8);
+    offsets.len = key_count + 1;
+    memset(offsets.mem, 0, offsets.len * sizeof(uint32_t));
+
+    size_t total = 0;
+    refs([&](int64_t key, const T&) {
+      if (key < 0 || (size_t)key >= key_count)
+        return;
+      ++offsets.mem[key + 1];
+      ++total;
+    });
+    for(size_t k = 1; k <= key_count; ++k)
+      offsets.mem[k] += offsets.mem[k - 1];
+
+    // offsets[k] is now the start of k; placing advances it to the start of k + 1...
+    csr->items.alloc = alloc;
+    csr->items.init(total ? total : 1, 8);
+    csr->items.len = total;
+    refs([&](int64_t key, const T &item) {
+      if (key < 0 || (size_t)key >= key_count)
+        return;
+      csr->items.mem[offsets.mem[key]++] = item;
+    });
+    // ...so shift back by one key
+    for(size_t k = key_count; k > 0; --k)
+      offsets.mem[k] = offsets.mem[k - 1];
+    offsets.mem[0] = 0;
+  }
+
+  template <typename T>
+  void kill_csr(Csr<T> *csr, Allocator *alloc) {
+    if (csr->offsets.mem)
+      alloc->deallocate(csr->offsets.mem);
+    if (csr->items.mem)
+      alloc->deallocate(csr->items.mem);
+    *csr = Csr<T>();
+  }
+}
+
+void RefIndex::build(glTF *g) {
+  // Rebuilding replaces the last build
+  kill();
+  Array<Node> &nodes = g->nodes.nodes;
+  Array<Mesh> &meshes = g->meshes.meshes;
+  Array<Skin> &skins = g->skins.skins;
+  Array<Accessor> &accessors = g->accessors.accessors;
+  Array<Texture> &textures = g->textures.textures;
+  Array<Image> &images = g->images.images;
+  Array<Material> &materials = g->materials.materials;
+  Array<Animation> &animations = g->animations.animations;
+  Array<BufferView> &views = g->buffer_views.views;
+
+  counts[glTF::ASSET] = 1;
+  counts[glTF::SCENES] = g->scenes.scenes.len;
+  counts[glTF::NODES] = nodes.len;
+  counts[glTF::BUFFERS] = g->buffers.buffers.len;
+  counts[glTF::BUFFER_VIEWS] = views.len;
+  counts[glTF::ACCESSORS] = accessors.len;
+  counts[glTF::MESHES] = meshes.len;
+  counts[glTF::SKINS] = skins.len;
+  counts[glTF::TEXTURES] = textures.len;
+  counts[glTF::IMAGES] = images.len;
+  counts[glTF::SAMPLERS] = g->samplers.samplers.len;
+  counts[glTF::MATERIALS] = materials.len;
+  counts[glTF::CAMERAS] = g->cameras.cameras.len;
+  counts[glTF::ANIMATIONS] = animations.len;
+
+  parents.alloc = alloc;
+  parents.init(nodes.len ? nodes.len : 1, 8);
+  parents.len = nodes.len;
+  for(size_t i = 0; i < nodes.len; ++i)
+    parents.mem[i] = INVALID_INDEX;
+  for(size_t i = 0; i < nodes.len; ++i) {
+    for(size_t c = 0; c < nodes.mem[i].children.len; ++c) {
+      int32_t child = nodes.mem[i].children.mem[c];
+      if (child >= 0 && (size_t)child < nodes.len)
+        parents.mem[child] = i;
+    }
+  }
+
+  build_csr(&nodes_by_mesh, meshes.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < nodes.len; ++i)
+      emit(nodes.mem[i].mesh, i);
+  });
+  build_csr(&nodes_by_skin, skins.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < nodes.len; ++i)
+      emit(nodes.mem[i].skin, i);
+  });
+  build_csr(&nodes_by_camera, g->cameras.cameras.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < nodes.len; ++i)
+      emit(nodes.mem[i].camera, i);
+  });
+  build_csr(&skins_by_joint, nodes.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < skins.len; ++i)
+      for(size_t j = 0; j < skins.mem[i].joints.len; ++j)
+        emit(skins.mem[i].joints.mem[j], i);
+  });
+  build_csr(&skins_by_accessor, accessors.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < skins.len; ++i)
+      emit(skins.mem[i].i_bind_matrices, i);
+  });
+
+  build_csr(&primitives_by_material, materials.len, alloc, [&](auto emit) {
+    for(uint32_t m = 0; m < meshes.len; ++m)
+      for(uint32_t p = 0; p < meshes.mem[m].primitives.len; ++p)
+        emit(meshes.mem[m].primitives.mem[p].material, PrimRef{m, p});
+  });
+  build_csr(&primitives_by_accessor, accessors.len, alloc, [&](auto emit) {
+    for(uint32_t m = 0; m < meshes.len; ++m) {
+      for(uint32_t p = 0; p < meshes.mem[m].primitives.len; ++p) {
+        Mesh::Primitive *prim = &meshes.mem[m].primitives.mem[p];
+        for(size_t a = 0; a < prim->attributes.len; ++a)
+          emit(prim->attributes.mem[a].accessor, PrimRef{m, p});
+        for(size_t t = 0; t < prim->targets.len; ++t)
+          for(size_t a = 0; a < prim->targets.mem[t].attributes.len; ++a)
+            emit(prim->targets.mem[t].attributes.mem[a].accessor, PrimRef{m, p});
+        emit(prim->indices, PrimRef{m, p});
+      }
+    }
+  });
+  build_csr(&samplers_by_accessor, accessors.len, alloc, [&](auto emit) {
+    for(uint32_t a = 0; a < animations.len; ++a) {
+      for(uint32_t s = 0; s < animations.mem[a].samplers.len; ++s) {
+        emit(animations.mem[a].samplers.mem[s].input, SamplerRef{a, s});
+        emit(animations.mem[a].samplers.mem[s].output, SamplerRef{a, s});
+      }
+    }
+  });
+  build_csr(&channels_by_node, nodes.len, alloc, [&](auto emit) {
+    for(uint32_t a = 0; a < animations.len; ++a)
+      for(uint32_t c = 0; c < animations.mem[a].channels.len; ++c)
+        emit(animations.mem[a].channels.mem[c].target.node, ChannelRef{a, c});
+  });
+
+  build_csr(&accessors_by_view, views.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < accessors.len; ++i) {
+      Accessor *accessor = &accessors.mem[i];
+      emit(accessor->buffer_view, i);
+      if (accessor->sparse.count != INVALID_COUNT) {
+        emit(accessor->sparse.indices.buffer_view, i);
+        emit(accessor->sparse.values.buffer_view, i);
+      }
+    }
+  });
+  build_csr(&images_by_view, views.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < images.len; ++i)
+      emit(images.mem[i].buffer_view, i);
+  });
+  build_csr(&views_by_buffer, g->buffers.buffers.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < views.len; ++i)
+      emit(views.mem[i].buffer, i);
+  });
+  build_csr(&textures_by_image, images.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < textures.len; ++i)
+      emit(textures.mem[i].source, i);
+  });
+  build_csr(&textures_by_sampler, g->samplers.samplers.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < textures.len; ++i)
+      emit(textures.mem[i].sampler, i);
+  });
+  build_csr(&materials_by_texture, textures.len, alloc, [&](auto emit) {
+    for(uint32_t i = 0; i < materials.len; ++i) {
+      Material *mat = &materials.mem[i];
+      int32_t refs[] = {
+        mat->pbr_metallic_roughness.base_color_texture.index,
+        mat->pbr_metallic_roughness.metallic_roughness_texture.index,
+        mat->normal_texture.index, mat->occlusion_texture.index, mat->emissive_texture.index,
+      };
+      for(uint32_t r = 0; r < 5; ++r) {
+        // A material listing a texture twice is one user
+        bool seen = false;
+        for(uint32_t q = 0; q < r; ++q)
+          seen |= refs[q] == refs[r];
+        if (!seen)
+          emit(refs[r], i);
+      }
+    }
+  });
+}
+
+void RefIndex::kill() {
+  if (parents.mem)
+    alloc->deallocate(parents.mem);
+  parents = Array<int32_t>();
+  kill_csr(&nodes_by_mesh, alloc);
+  kill_csr(&nodes_by_skin, alloc);
+  kill_csr(&nodes_by_camera, alloc);
+  kill_csr(&skins_by_joint, alloc);
+  kill_csr(&primitives_by_material, alloc);
+  kill_csr(&primitives_by_accessor, alloc);
+  kill_csr(&skins_by_accessor, alloc);
+  kill_csr(&samplers_by_accessor, alloc);
+  kill_csr(&accessors_by_view, alloc);
+  kill_csr(&images_by_view, alloc);
+  kill_csr(&views_by_buffer, alloc);
+  kill_csr(&textures_by_image, alloc);
+  kill_csr(&textures_by_sampler, alloc);
+  kill_csr(&materials_by_texture, alloc);
+  kill_csr(&channels_by_node, alloc);
+  for(uint32_t s = 0; s < glTF::SECTION_COUNT; ++s)
+    counts[s] = 0;
+}
+
+void RefIndex::propagate(ChangeSet *changes) {
+  ScratchScope scope;
+  uint8_t *seen[glTF::SECTION_COUNT] = {};
+  for(uint32_t s = 0; s < glTF::SECTION_COUNT; ++s) {
+    if (!counts[s])
+      continue;
+    seen[s] = (uint8_t*)MemoryService::scratch()->allocate(counts[s], 1);
+    memset(seen[s], 0, counts[s]);
+  }
+  auto reach = [&](glTF::Section section, uint32_t index) {
+    if (index >= counts[section] || seen[section][index])
+      return;
+    seen[section][index] = 1;
+    changes->push(section, index, Change::MODIFIED);
+  };
+  for(size_t i = 0; i < changes->changes.len; ++i) {
+    Change change = changes->changes.mem[i];
+    if (change.index < counts[change.section])
+      seen[change.section][change.index] = 1;
+  }
+
+  // Entries appended by reach() are visited by this same loop
+  for(size_t i = 0; i < changes->changes.len; ++i) {
+    Change change = changes->changes.mem[i];
+    if (change.kind == Change::ADDED)
+      continue;
+    uint32_t count;
+    switch(change.section) {
+      case glTF::BUFFERS: {
+        const uint32_t *v = views_by_buffer.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::BUFFER_VIEWS, v[j]);
+        break;
+      }
+      case glTF::BUFFER_VIEWS: {
+        const uint32_t *a = accessors_by_view.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::ACCESSORS, a[j]);
+        const uint32_t *im = images_by_view.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::IMAGES, im[j]);
+        break;
+      }
+      case glTF::ACCESSORS: {
+        const PrimRef *p = primitives_by_accessor.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::MESHES, p[j].mesh);
+        const uint32_t *sk = skins_by_accessor.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::SKINS, sk[j]);
+        const SamplerRef *sa = samplers_by_accessor.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::ANIMATIONS, sa[j].animation);
+        break;
+      }
+      case glTF::IMAGES: {
+        const uint32_t *t = textures_by_image.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::TEXTURES, t[j]);
+        break;
+      }
+      case glTF::SAMPLERS: {
+        const uint32_t *t = textures_by_sampler.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::TEXTURES, t[j]);
+        break;
+      }
+      case glTF::TEXTURES: {
+        const uint32_t *m = materials_by_texture.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::MATERIALS, m[j]);
+        break;
+      }
+      case glTF::MATERIALS: {
+        const PrimRef *p = primitives_by_material.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::MESHES, p[j].mesh);
+        break;
+      }
+      case glTF::MESHES: {
+        const uint32_t *n = nodes_by_mesh.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::NODES, n[j]);
+        break;
+      }
+      case glTF::SKINS: {
+        const uint32_t *n = nodes_by_skin.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::NODES, n[j]);
+        break;
+      }
+      case glTF::CAMERAS: {
+        const uint32_t *n = nodes_by_camera.get(change.index, &count);
+        for(uint32_t j = 0; j < count; ++j)
+          reach(glTF::NODES, n[j]);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+struct ChangeSet;
+
+// Compressed sparse rows: the items of key k are items[offsets[k]] up to items[offsets[k + 1]]
+template <typename T>
+struct Csr {
+  Array<uint32_t> offsets; // key count + 1
+  Array<T> items;
+
+  size_t keys() const { return offsets.len ? offsets.len - 1 : 0; }
+  // Items of key, count set to how many. nullptr and 0 for keys out of range.
+  const T* get(size_t key, uint32_t *count) const {
+    if (key >= keys()) {
+      *count = 0;
+      return nullptr;
+    }
+    *count = offsets.mem[key + 1] - offsets.mem[key];
+    return items.mem + offsets.mem[key];
+  }
+};
+
+// Who refers to what, the inverse of the index fields in the document. Built once after fill in
+// two passes over the references (count, then place), so each lookup is O(1) plus the results.
+struct RefIndex {
+  struct PrimRef {
+    uint32_t mesh;
+    uint32_t primitive;
+  };
+  struct ChannelRef {
+    uint32_t animation;
+    uint32_t channel;
+  };
+  struct SamplerRef {
+    uint32_t animation;
+    uint32_t sampler;
+  };
+
+  Array<int32_t> parents; // per node, INVALID_INDEX for roots
+  Csr<uint32_t> nodes_by_mesh;
+  Csr<uint32_t> nodes_by_skin;
+  Csr<uint32_t> nodes_by_camera;
+  Csr<uint32_t> skins_by_joint; // node -> skins using it as a joint
+  Csr<PrimRef> primitives_by_material;
+  Csr<PrimRef> primitives_by_accessor; // attributes, morph targets and indices
+  Csr<uint32_t> skins_by_accessor; // inverse bind matrices
+  Csr<SamplerRef> samplers_by_accessor; // animation inputs and outputs
+  Csr<uint32_t> accessors_by_view; // including sparse indices and values
+  Csr<uint32_t> images_by_view;
+  Csr<uint32_t> views_by_buffer;
+  Csr<uint32_t> textures_by_image;
+  Csr<uint32_t> textures_by_sampler;
+  Csr<uint32_t> materials_by_texture;
+  Csr<ChannelRef> channels_by_node;
+  size_t counts[glTF::SECTION_COUNT] = {}; // elements per section when built
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  // May be called again, e.g. after a reload, the previous index is freed first
+  void build(glTF *gltf);
+  void kill();
+
+  // Add to changes everything depending on what is already in it: a modified buffer marks its
+  // views, their accessors and images, the meshes, skins and animations reading those accessors,
+  // and the nodes using those meshes and skins.
+  void propagate(ChangeSet *changes);
+};
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,370 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "Reload.hpp"
+#include "Validate.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// ChangeSet ////////////////////////
+void ChangeSet::push(glTF::Section section, uint32_t index, Change::Kind kind) {
+  if (!changes.mem) {
+    changes.alloc = alloc;
+    changes.init(64, 8);
+  }
+  changes.push({section, index, kind});
+  sections[section] = true;
+}
+void ChangeSet::clear() {
+  changes.len = 0;
+  for(uint32_t i = 0; i < glTF::SECTION_COUNT; ++i)
+    sections[i] = false;
+}
+void ChangeSet::kill() {
+  if (changes.mem)
+    alloc->deallocate(changes.mem);
+  changes = Array<Change>();
+  clear();
+}
+
+// Diff ////////////////////////
+namespace {
+  // Field by field equality between an object of a and the same kind of object of b
+  struct Compare {
+    glTF *a;
+    glTF *b;
+
+    bool name(uint32_t x, uint32_t y) {
+      if ((x == StringPool::NONE) != (y == StringPool::NONE))
+        return false;
+      return a->strings.view(x).equals(b->strings.view(y));
+    }
+    template <typename T>
+    bool pod(const Array<T> &x, const Array<T> &y) {
+      return x.len == y.len && (x.len == 0 || memcmp(x.mem, y.mem, x.len * sizeof(T)) == 0);
+    }
+    bool str(const StringBuffer &x, const StringBuffer &y) { return x.view().equals(y.view()); }
+    bool attributes(const Array<Mesh::Primitive::Attribute> &x, const Array<Mesh::Primitive::Attribute> &y) {
+      if (x.len != y.len)
+        return false;
+      for(size_t i = 0; i < x.len; ++i) {
+        const Mesh::Primitive::Attribute &p = x.mem[i];
+        const Mesh::Primitive::Attribute &q = y.mem[i];
+        if (p.accessor != q.accessor || p.semantic != q.semantic || p.set != q.set || !name(p.key, q.key))
+          return false;
+      }
+      return true;
+    }
+    bool tex(const Material::MatTexture &x, const Material::MatTexture &y) {
+      return x.scale == y.scale && x.index == y.index && x.tex_coord == y.tex_coord;
+    }
+
+    bool equal(const Scene &x, const Scene &y) { return pod(x.nodes, y.nodes) && name(x.name, y.name); }
+    bool equal(const Node &x, const Node &y) {
+      return x.mesh == y.mesh && x.skin == y.skin && x.camera == y.camera && name(x.name, y.name) &&
+             pod(x.rotation, y.rotation) && pod(x.scale, y.scale) && pod(x.translation, y.translation) &&
+             pod(x.matrix, y.matrix) && pod(x.weights, y.weights) && pod(x.children, y.children);
+    }
+    bool equal(const Buffer &x, const Buffer &y) { return x.byte_length == y.byte_length && str(x.uri, y.uri); }
+    bool equal(const BufferView &x, const BufferView &y) {
+      return x.byte_length == y.byte_length && x.byte_offset == y.byte_offset &&
+             x.byte_stride == y.byte_stride && x.buffer == y.buffer && x.target == y.target;
+    }
+    bool equal(const Accessor &x, const Accessor &y) {
+      const Accessor::Sparse &s = x.sparse;
+      const Accessor::Sparse &t = y.sparse;
+      return x.type == y.type && x.component_type == y.component_type && x.byte_offset == y.byte_offset &&
+             x.count == y.count && x.buffer_view == y.buffer_view && pod(x.max, y.max) && pod(x.min, y.min) &&
+             s.count == t.count && s.indices.byte_offset == t.indices.byte_offset &&
+             s.indices.buffer_view == t.indices.buffer_view && s.indices.component_type == t.indices.component_type &&
+             s.values.byte_offset == t.values.byte_offset && s.values.buffer_view == t.values.buffer_view;
+    }
+    bool equal(const Mesh &x, const Mesh &y) {
+      if (x.primitives.len != y.primitives.len || !pod(x.weights, y.weights) || !name(x.name, y.name) ||
+          x.extras.target_names.len != y.extras.target_names.len)
+        return false;
+      for(size_t i = 0; i < x.extras.target_names.len; ++i)
+        if (!name(x.extras.target_names.mem[i], y.extras.target_names.mem[i]))
+          return false;
+      for(size_t i = 0; i < x.primitives.len; ++i) {
+        const Mesh::Primitive &p = x.primitives.mem[i];
+        const Mesh::Primitive &q = y.primitives.mem[i];
+        if (p.indices != q.indices || p.material != q.material || p.mode != q.mode ||
+            !attributes(p.attributes, q.attributes) || p.targets.len != q.targets.len)
+          return false;
+        for(size_t j = 0; j < p.targets.len; ++j)
+          if (!attributes(p.targets.mem[j].attributes, q.targets.mem[j].attributes))
+            return false;
+      }
+      return true;
+    }
+    bool equal(const Skin &x, const Skin &y) {
+      return x.i_bind_matrices == y.i_bind_matrices && x.skeleton == y.skeleton && pod(x.joints, y.joints);
+    }
+    bool equal(const Texture &x, const Texture &y) { return x.sampler == y.sampler && x.source == y.source; }
+    bool equal(const Image &x, const Image &y) {
+      return x.mime_type == y.mime_type && x.buffer_view == y.buffer_view && str(x.uri, y.uri);
+    }
+    bool equal(const Sampler &x, const Sampler &y) {
+      return x.mag_filter == y.mag_filter && x.min_filter == y.min_filter && x.wrap_s == y.wrap_s && x.wrap_t == y.wrap_t;
+    }
+    bool equal(const Material &x, const Material &y) {
+      const Material::PbrMetallicRoughness &p = x.pbr_metallic_roughness;
+      const Material::PbrMetallicRoughness &q = y.pbr_metallic_roughness;
+      return pod(p.base_color_factor, q.base_color_factor) && tex(p.base_color_texture, q.base_color_texture) &&
+             tex(p.metallic_roughness_texture, q.metallic_roughness_texture) &&
+             p.metallic_factor == q.metallic_factor && p.roughness_factor == q.roughness_factor &&
+             pod(x.emissive_factor, y.emissive_factor) && name(x.name, y.name) &&
+             tex(x.normal_texture, y.normal_texture) && tex(x.occlusion_texture, y.occlusion_texture) &&
+             tex(x.emissive_texture, y.emissive_texture) && x.alpha_mode == y.alpha_mode &&
+             x.alpha_cutoff == y.alpha_cutoff && x.double_sided == y.double_sided;
+    }
+    bool equal(const Camera &x, const Camera &y) {
+      return x.type == y.type && x.aspect_ratio == y.aspect_ratio && x.yfov == y.yfov && x.xmag == y.xmag &&
+             x.ymag == y.ymag && x.zfar == y.zfar && x.znear == y.znear && name(x.name, y.name);
+    }
+    bool equal(const Animation &x, const Animation &y) {
+      if (x.channels.len != y.channels.len || x.samplers.len != y.samplers.len || !name(x.name, y.name))
+        return false;
+      for(size_t i = 0; i < x.channels.len; ++i) {
+        const Animation::Channel &p = x.channels.mem[i];
+        const Animation::Channel &q = y.channels.mem[i];
+        if (p.sampler != q.sampler || p.target.node != q.target.node || p.target.path != q.target.path)
+          return false;
+      }
+      for(size_t i = 0; i < x.samplers.len; ++i) {
+        const Animation::Sampler &p = x.samplers.mem[i];
+        const Animation::Sampler &q = y.samplers.mem[i];
+        if (p.interpolation != q.interpolation || p.input != q.input || p.output != q.output)
+          return false;
+      }
+      return true;
+    }
+
+    template <typename T>
+    void section(const Array<T> &x, const Array<T> &y, glTF::Section sec, ChangeSet *changes) {
+      size_t common = x.len < y.len ? x.len : y.len;
+      for(size_t i = 0; i < common; ++i)
+        if (!equal(x.mem[i], y.mem[i]))
+          changes->push(sec, i, Change::MODIFIED);
+      for(size_t i = common; i < y.len; ++i)
+        changes->push(sec, i, Change::ADDED);
+      for(size_t i = common; i < x.len; ++i)
+        changes->push(sec, i, Change::REMOVED);
+    }
+  };
+}
+
+void diff(glTF *old_doc, glTF *new_doc, ChangeSet *changes) {
+  Compare cmp = {old_doc, new_doc};
+  if (!cmp.str(old_doc->asset.version, new_doc->asset.version) ||
+      !cmp.str(old_doc->asset.copyright, new_doc->asset.copyright))
+    changes->push(glTF::ASSET, Change::SECTION, Change::MODIFIED);
+  if (old_doc->scenes.scene != new_doc->scenes.scene)
+    changes->push(glTF::SCENES, Change::SECTION, Change::MODIFIED);
+
+  cmp.section(old_doc->scenes.scenes, new_doc->scenes.scenes, glTF::SCENES, changes);
+  cmp.section(old_doc->nodes.nodes, new_doc->nodes.nodes, glTF::NODES, changes);
+  cmp.section(old_doc->buffers.buffers, new_doc->buffers.buffers, glTF::BUFFERS, changes);
+  cmp.section(old_doc->buffer_views.views, new_doc->buffer_views.views, glTF::BUFFER_VIEWS, changes);
+  cmp.section(old_doc->accessors.accessors, new_doc->accessors.accessors, glTF::ACCESSORS, changes);
+  cmp.section(old_doc->meshes.meshes, new_doc->meshes.meshes, glTF::MESHES, changes);
+  cmp.section(old_doc->skins.skins, new_doc->skins.skins, glTF::SKINS, changes);
+  cmp.section(old_doc->textures.textures, new_doc->textures.textures, glTF::TEXTURES, changes);
+  cmp.section(old_doc->images.images, new_doc->images.images, glTF::IMAGES, changes);
+  cmp.section(old_doc->samplers.samplers, new_doc->samplers.samplers, glTF::SAMPLERS, changes);
+  cmp.section(old_doc->materials.materials, new_doc->materials.materials, glTF::MATERIALS, changes);
+  cmp.section(old_doc->cameras.cameras, new_doc->cameras.cameras, glTF::CAMERAS, changes);
+  cmp.section(old_doc->animations.animations, new_doc->animations.animations, glTF::ANIMATIONS, changes);
+}
+
+// FileWatcher ////////////////////////
+bool FileWatcher::init(const char *path) {
+  const char *slash = strrchr(path, '/');
+  dir = canonical_dir(slash ? std::string(path, slash - path) : std::string("."));
+  name = slash ? slash + 1 : path;
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    return false;
+  watch = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (watch < 0) {
+    kill();
+    return false;
+  }
+  dirs.push_back({watch, dir});
+  return true;
+#else
+  return false;
+#endif
+}
+bool FileWatcher::add_dir(const std::string &dir_) {
+#ifdef __linux__
+  if (fd < 0)
+    return false;
+  // inotify hands back the same descriptor for a directory which is already watched
+  int wd = inotify_add_watch(fd, dir_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0)
+    return false;
+  for(const auto &d : dirs)
+    if (d.first == wd)
+      return true;
+  dirs.push_back({wd, dir_});
+  return true;
+#else
+  (void)dir_;
+  return false;
+#endif
+}
+void FileWatcher::kill() {
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+  watch = -1;
+  dirs.clear();
+}
+
+bool FileWatcher::poll(int timeout_ms, std::vector<std::string> *written) {
+  bool changed = false;
+#ifdef __linux__
+  if (fd < 0)
+    return false;
+  struct pollfd pfd = {fd, POLLIN, 0};
+  if (::poll(&pfd, 1, timeout_ms) <= 0)
+    return false;
+
+  alignas(struct inotify_event) char buf[4096];
+  for(;;) {
+    ssize_t got = read(fd, buf, sizeof(buf));
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      break;
+    for(ssize_t i = 0; i < got; ) {
+      const struct inotify_event *e = (const struct inotify_event*)(buf + i);
+      i += sizeof(struct inotify_event) + e->len;
+      if (e->len == 0)
+        continue;
+      if (e->wd == watch && name == e->name) {
+        changed = true;
+        continue;
+      }
+      if (!written)
+        continue;
+      for(const auto &d : dirs) {
+        if (d.first == e->wd) {
+          written->push_back(d.second + "/" + e->name);
+          break;
+        }
+      }
+    }
+  }
+#endif
+  return changed;
+}
+
+// HotReload ////////////////////////
+bool HotReload::init(const char *path_, ThreadPool *pool_, bool dependents_) {
+  path = path_;
+  pool = pool_;
+  dependents = dependents_;
+  live = 0;
+  if (!watcher.init(path_))
+    return false;
+  ChangeSet changes;
+  bool ok = reload(&changes);
+  changes.kill();
+  return ok;
+}
+void HotReload::kill() {
+  watcher.kill();
+  refs.kill();
+  docs[0].free_buffers();
+  docs[0].kill();
+  docs[1].free_buffers();
+  docs[1].kill();
+}
+
+bool HotReload::poll(ChangeSet *changes, int timeout_ms) {
+  std::vector<std::string> written;
+  bool changed = watcher.poll(timeout_ms, &written);
+
+  bool reported = false;
+  Array<Buffer> &buffers = document()->buffers.buffers;
+  for(size_t i = 0; i < buffers.len && !written.empty(); ++i) {
+    std::string buffer_path = buffer_file(buffers[i]);
+    if (buffer_path.empty())
+      continue;
+    for(const std::string &file : written) {
+      if (file == buffer_path) {
+        changes->push(glTF::BUFFERS, i, Change::MODIFIED);
+        reported = true;
+        break;
+      }
+    }
+  }
+  // A reload propagates everything in changes, buffer rewrites included
+  if (changed && reload(changes))
+    return true;
+  if (reported && dependents)
+    refs.propagate(changes);
+  return reported;
+}
+
+bool HotReload::reload(ChangeSet *changes) {
+  std::ifstream f(path, std::ios::binary);
+  if (!f.is_open())
+    return false;
+  std::stringstream text;
+  text << f.rdbuf();
+  std::string str = text.str();
+  Json json;
+  if (!parse_json(str.data(), str.size(), &json) || !json.is_object())
+    return false;
+
+  glTF *next = previous();
+  next->free_buffers();
+  next->fill(json, pool);
+  // A half written or broken file must not replace a good document
+  Diagnostics diagnostics;
+  bool valid = validate(next, &diagnostics);
+  diagnostics.kill();
+  if (!valid)
+    return false;
+  diff(document(), next, changes);
+  live ^= 1;
+  if (dependents) {
+    refs.build(document());
+    refs.propagate(changes);
+  }
+
+  // Buffers may live in other directories, and a reload can point them somewhere new
+  Array<Buffer> &buffers = document()->buffers.buffers;
+  for(size_t i = 0; i < buffers.len; ++i) {
+    std::string file = buffer_file(buffers[i]);
+    if (!file.empty())
+      watcher.add_dir(file.substr(0, file.rfind('/')));
+  }
+  return true;
+}
+
+std::string HotReload::buffer_file(const Buffer &buffer) {
+  if (buffer.uri.len == 0 || strncmp(buffer.uri.c_str(), "data:", 5) == 0)
+    return std::string();
+  const char *uri = buffer.uri.c_str();
+  std::string file = watcher.dir + "/" + decode_uri(uri);
+  size_t slash = file.rfind('/');
+  return canonical_dir(file.substr(0, slash)) + file.substr(slash);
+}
+
+} // namespace glTF
+} // namespace Sol
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "glTF.hpp"
+#include "RefIndex.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// One object which differs between two versions of a document. Objects are matched by index,
+// since that is how glTF objects refer to each other.
+struct Change {
+  enum Kind : uint8_t {
+    ADDED, // only in the new document
+    REMOVED, // only in the old document
+    MODIFIED,
+  };
+  // index for properties of the section itself, e.g. Scenes::scene or the asset strings
+  static constexpr uint32_t SECTION = UINT32_MAX;
+
+  glTF::Section section;
+  uint32_t index;
+  Kind kind;
+};
+
+struct ChangeSet {
+  Array<Change> changes;
+  bool sections[glTF::SECTION_COUNT] = {}; // true if any change is in that section
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  void push(glTF::Section section, uint32_t index, Change::Kind kind);
+  void clear();
+  void kill();
+  bool empty() const { return changes.len == 0; }
+};
+
+// Append to changes every object which differs between old_doc and new_doc. Names and attribute
+// keys are compared as strings, so the two documents may have interned them differently.
+void diff(glTF *old_doc, glTF *new_doc, ChangeSet *changes);
+
+// Watches one file through inotify on its directory, which also sees editors that save by
+// writing a new file and renaming it over the old one. More directories can be watched for the
+// files a document references. Directories are kept as canonical paths.
+struct FileWatcher {
+  int fd = -1;
+  int watch = -1; // the file's directory
+  std::string dir;
+  std::string name;
+  std::vector<std::pair<int, std::string>> dirs; // every watched directory by watch descriptor
+
+  bool init(const char *path);
+  // Report writes in dir_ too, false if it cannot be watched
+  bool add_dir(const std::string &dir_);
+  void kill();
+  // Wait up to timeout_ms (0 polls, -1 blocks) for writes in the watched directories. True if
+  // the file was written; written gets the path (directory/name) of every other file which was.
+  bool poll(int timeout_ms, std::vector<std::string> *written = nullptr);
+};
+
+// Keeps a live document in sync with its file. On each change the file is parsed into a second
+// document, diffed against the live one and swapped in; the old version stays readable through
+// previous() until the next reload so that REMOVED and MODIFIED objects can still be looked up.
+struct HotReload {
+  glTF docs[2];
+  uint32_t live = 0;
+  FileWatcher watcher;
+  std::string path;
+  ThreadPool *pool = nullptr;
+  // With dependents every change also reports what depends on it (see RefIndex::propagate), e.g.
+  // a rewritten buffer brings its views, accessors, meshes and the nodes using them. refs is
+  // rebuilt for the live document on each reload.
+  bool dependents = false;
+  RefIndex refs;
+
+  // Fill the live document from path and start watching it
+  bool init(const char *path_, ThreadPool *pool_ = nullptr, bool dependents_ = false);
+  void kill();
+
+  glTF* document() { return &docs[live]; }
+  glTF* previous() { return &docs[live ^ 1]; }
+
+  // True if the file changed and was reloaded, with changes holding what differs. A file which
+  // does not parse or fails validate() leaves the live document as it was, though previous()
+  // then holds the rejected version. Rewrites of a buffer file are reported as
+  // MODIFIED buffers without reloading anything. Buffer uris are resolved against the document's
+  // directory (after decoding %XX escapes) and every directory holding one is watched.
+  bool poll(ChangeSet *changes, int timeout_ms = 0);
+  bool reload(ChangeSet *changes);
+  // Path a buffer file's writes are reported under, empty for embedded and data: uris
+  std::string buffer_file(const Buffer &buffer);
+};
+
+} // namespace glTF
+} // namespace Sol
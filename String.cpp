@@ -5,10 +5,42 @@
 namespace Sol {
 
 // StringView ///////////////////
-void StringView::copy_to_buf(StringBuffer *buf, size_t start, size_t end) {
-  char *ptr = buf->str;
-  ABORT(start < end, "StringView::copy_to_buf: start > end");
-  mem_cpy(buf->str, ptr + start, end - start);
+StringView StringView::get(const char *str_) {
+  return get(str_, strlen(str_));
+}
+StringView StringView::get(const char *str_, size_t len_) {
+  StringView view;
+  view.str = str_;
+  view.len = len_;
+  return view;
+}
+StringView StringView::get(const std::string &str_) {
+  return get(str_.c_str(), str_.length());
+}
+
+bool StringView::equals(StringView other) const {
+  return len == other.len && memcmp(str, other.str, len) == 0;
+}
+bool StringView::equals(const char *str_) const {
+  return equals(get(str_));
+}
+StringView StringView::sub(size_t start, size_t end) const {
+  ABORT(start <= end && end <= len, "StringView::sub: range out of bounds");
+  return get(str + start, end - start);
+}
+void StringView::copy_to_buf(StringBuffer *buf, size_t start, size_t end) const {
+  ABORT(start <= end && end <= len, "StringView::copy_to_buf: range out of bounds");
+  size_t size = end - start;
+  if (buf->cap < size)
+    buf->grow(size - buf->cap);
+
+  char *dst = buf->data();
+  mem_cpy(dst, (void*)(str + start), size);
+  buf->len = size;
+  dst[size] = '\0';
+}
+void StringView::copy_to_buf(StringBuffer *buf) const {
+  copy_to_buf(buf, 0, len);
 }
 
 // StringBuffer /////////////////
@@ -54,40 +86,54 @@ StringBuffer StringBuffer::get(size_t size, std::string str_, Allocator *alloc_)
 }
 
 void StringBuffer::init(size_t size) {
-  ABORT(size > 0, "StringBuffer::init: size must be greater than 0");
+  len = 0;
+  if (size <= SSO_CAP) {
+    cap = SSO_CAP;
+    sso[0] = '\0';
+    return;
+  }
   cap = size; 
 
   if (alloc == &MemoryService::instance()->system_allocator)
-    str = (char*)mem_alloc(size + 1);
+    heap = (char*)mem_alloc(size + 1);
   else 
-    str = (char*)lin_alloca(size + 1, 1);
-  str[0] = '\0';
+    heap = (char*)alloc->allocate(size + 1, 1);
+  heap[0] = '\0';
 }
 void StringBuffer::init(size_t size, Allocator *alloc_) {
-  cap = size;
   alloc = alloc_;
-
-  if (alloc == &MemoryService::instance()->system_allocator)
-    str = (char*)mem_alloc(size + 1);
-  else 
-    str = (char*)lin_alloca(size + 1, 1);
+  init(size);
 }
 void StringBuffer::kill() {
-  if (alloc == &MemoryService::instance()->system_allocator)
-    mem_free(str);
+  if (!small() && alloc == &MemoryService::instance()->system_allocator)
+    mem_free(heap);
+  cap = SSO_CAP;
+  len = 0;
+  sso[0] = '\0';
 }
 
 void StringBuffer::grow(size_t size) {
+  size_t new_cap = cap + size;
+  if (new_cap <= SSO_CAP)
+    return;
+
   // +1 for null byte is not in the cap
-  if (alloc == &MemoryService::instance()->system_allocator) {
-    str = (char*)mem_realloc(size + cap + 1, str);
+  if (small()) {
+    char *str;
+    if (alloc == &MemoryService::instance()->system_allocator)
+      str = (char*)mem_alloc(new_cap + 1);
+    else
+      str = (char*)alloc->allocate(new_cap + 1, 1);
+    mem_cpy(str, sso, len + 1);
+    heap = str;
+  } else if (alloc == &MemoryService::instance()->system_allocator) {
+    heap = (char*)mem_realloc(new_cap + 1, heap);
   } else {
-    char* old_str = str;
-    str = (char*)lin_alloca(size + cap + 1, 1);
-    mem_cpy(str, old_str, len + 1); // len + 1 for null byte
+    // Extends in place when this string was the arena's latest allocation
+    heap = (char*)alloc->reallocate(new_cap + 1, heap, cap + 1);
   }
-  cap += size;
-  str[len] = '\0'; // Just for safety sake, in case for whatever reason it wasnt there for the copy...
+  cap = new_cap;
+  heap[len] = '\0'; // Just for safety sake, in case for whatever reason it wasnt there for the copy...
 }
 void StringBuffer::copy_here(const char *str_, size_t size) {
   if (size == 0) {
@@ -95,11 +141,11 @@ void StringBuffer::copy_here(const char *str_, size_t size) {
       ++size;
   }
 
-  size_t rem = cap - len;
-  if (rem < size) 
-    grow(size - rem);
+  if (cap < size) 
+    grow(size - cap);
 
-  mem_cpy(str, str_, size);
+  char *str = data();
+  mem_cpy(str, (void*)str_, size);
   len = size;
   str[len] = '\0';
 }
@@ -108,11 +154,11 @@ void StringBuffer::copy_here(std::string str_, size_t size) {
   size = str_.length();
   if (size == 0)
     return;
-  //ABORT(size > 0, "StringBuffer::copy_here size to copy must be > 0");
 
   if (cap < size) 
     grow(size - cap);
 
+  char *str = data();
   mem_cpy((void*)str, (void*)str_.c_str(), size);
   len = size;
   str[len] = '\0';
@@ -127,7 +173,8 @@ void StringBuffer::push(const char *str_) {
   if (rem < size)
     grow(size - rem);
 
-  mem_cpy(str + len, str_, size);
+  char *str = data();
+  mem_cpy(str + len, (void*)str_, size);
   len += size;
   str[len] = '\0';
 }
@@ -138,23 +185,129 @@ void StringBuffer::push(std::string str_) {
   if (rem < size)
     grow(size - rem);
 
-  mem_cpy(str + len, str_.c_str(), size);
+  char *str = data();
+  mem_cpy(str + len, (void*)str_.c_str(), size);
   len += size;
   str[len] = '\0';
 }
 
-const char* StringBuffer::c_str() {
-  if (len == 0)
-    return "\0";
-  else 
-    return (const char*)str;
+const char* StringBuffer::c_str() const {
+  return data();
 }
-StringView StringBuffer::view(size_t start, size_t end) {
-  StringView view;
-  view.buf = this;
-  view.start = start;
-  view.end = end;
-  return view;
+StringView StringBuffer::view() const {
+  return StringView::get(data(), len);
+}
+StringView StringBuffer::view(size_t start, size_t end) const {
+  return view().sub(start, end);
+}
+
+// StringPool /////////////////
+namespace {
+  inline size_t pool_table_size(size_t count) {
+    size_t size = 16;
+    while(size < count * 2)
+      size *= 2;
+    return size;
+  }
+}
+
+uint32_t StringPool::hash(const char *str, size_t len) {
+  uint32_t h = 2166136261u;
+  for(size_t i = 0; i < len; ++i) {
+    h ^= (uint8_t)str[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+size_t StringPool::size_for(size_t count, size_t bytes) {
+  // + alignment padding of each Array
+  return (bytes + count) + count * 2 * sizeof(uint32_t) + pool_table_size(count) * sizeof(uint32_t) + 4 * 8;
+}
+void StringPool::init(size_t count, size_t bytes, Allocator *alloc) {
+  chars.alloc = alloc;
+  offsets.alloc = alloc;
+  lengths.alloc = alloc;
+  table.alloc = alloc;
+
+  chars.init(bytes + count, 1);
+  offsets.init(count, 8);
+  lengths.init(count, 8);
+  table.init(pool_table_size(count), 8);
+  table.len = table.cap;
+  memset(table.mem, 0, table.cap * sizeof(uint32_t));
+}
+
+void StringPool::rehash(size_t size) {
+  Array<uint32_t> old = table;
+  table = Array<uint32_t>();
+  table.alloc = old.alloc;
+  table.init(size, 8);
+  table.len = size;
+  memset(table.mem, 0, size * sizeof(uint32_t));
+
+  size_t mask = size - 1;
+  for(uint32_t id = 0; id < offsets.len; ++id) {
+    size_t i = hash(chars.mem + offsets.mem[id], lengths.mem[id]) & mask;
+    while(table.mem[i])
+      i = (i + 1) & mask;
+    table.mem[i] = id + 1;
+  }
+  old.alloc->deallocate(old.mem);
+}
+
+uint32_t StringPool::find(const char *str, size_t len) {
+  if (table.len == 0)
+    return NONE;
+  size_t mask = table.len - 1;
+  for(size_t i = hash(str, len) & mask;; i = (i + 1) & mask) {
+    uint32_t id = table.mem[i];
+    if (id == 0)
+      return NONE;
+    --id;
+    if (lengths.mem[id] == len && memcmp(chars.mem + offsets.mem[id], str, len) == 0)
+      return id;
+  }
+}
+uint32_t StringPool::intern(const char *str, size_t len) {
+  uint32_t id = find(str, len);
+  if (id != NONE)
+    return id;
+
+  if ((offsets.len + 1) * 2 > table.len)
+    rehash(pool_table_size(offsets.len + 1));
+
+  id = offsets.len;
+  offsets.push(chars.len);
+  lengths.push(len);
+  chars.copy_here((char*)str, len);
+  chars.push('\0');
+
+  size_t mask = table.len - 1;
+  size_t i = hash(str, len) & mask;
+  while(table.mem[i])
+    i = (i + 1) & mask;
+  table.mem[i] = id + 1;
+  return id;
+}
+uint32_t StringPool::intern(const char *str) {
+  return intern(str, strlen(str));
+}
+
+const char* StringPool::get(uint32_t id) {
+  if (id >= offsets.len)
+    return "";
+  return chars.mem + offsets.mem[id];
+}
+StringView StringPool::view(uint32_t id) {
+  if (id >= offsets.len)
+    return StringView();
+  return StringView::get(chars.mem + offsets.mem[id], lengths.mem[id]);
+}
+size_t StringPool::length(uint32_t id) {
+  if (id >= offsets.len)
+    return 0;
+  return lengths.mem[id];
 }
 
 } // namespace Sol
@@ -1,26 +1,44 @@
 #pragma once
 #include "Allocator.hpp"
+#include "Array.hpp"
 #include <string>
 
 namespace Sol {
 
 struct StringBuffer;
 
+// Non owning (pointer, length) slice of a string which lives elsewhere, e.g. in the source json
+// or a GLB chunk. Not null terminated in general, copy it into a StringBuffer for that.
 struct StringView {
-  size_t start = 0;
-  size_t end = 0;
-  StringBuffer *buf;
+  const char *str = "";
+  size_t len = 0;
+
+  static StringView get(const char *str_);
+  static StringView get(const char *str_, size_t len_);
+  static StringView get(const std::string &str_);
 
-  const char* c_str();
-  void copy_to_buf(StringBuffer *buf, size_t start, size_t end);
+  bool equals(StringView other) const;
+  bool equals(const char *str_) const;
+  // [start, end) of this view
+  StringView sub(size_t start, size_t end) const;
+  // Overwrite buf with [start, end) of this view
+  void copy_to_buf(StringBuffer *buf, size_t start, size_t end) const;
+  void copy_to_buf(StringBuffer *buf) const;
 };
 
+// Strings up to SSO_CAP chars live inside the struct and never touch the allocator. Since the
+// inline bytes are not pointed to, a StringBuffer can be memcpy'd or realloc'd like any other POD.
 struct StringBuffer {
+  static constexpr size_t SSO_CAP = 23;
+
   // cap is one less than the true capacity: there is always a byte for null term 
-  size_t cap = 0;
+  size_t cap = SSO_CAP;
   size_t len = 0;
-  char *str = nullptr;
-  Allocator *alloc = &MemoryService::instance()->scratch_allocator;
+  union {
+    char sso[SSO_CAP + 1] = {}; // while cap <= SSO_CAP
+    char *heap;
+  };
+  Allocator *alloc = MemoryService::scratch();
 
   /*
   * !! size argument should not include null byte, this is already accounted for !!
@@ -34,6 +52,10 @@ struct StringBuffer {
   void init(size_t size, Allocator *allocator_);
   void kill();
 
+  bool small() const { return cap <= SSO_CAP; }
+  char* data() { return small() ? sso : heap; }
+  const char* data() const { return small() ? sso : heap; }
+
   void grow(size_t size);
   // Overwrite existing string data
   void copy_here(const char *str_, size_t size);
@@ -41,8 +63,39 @@ struct StringBuffer {
 
   void push(const char* str_);
   void push(std::string str_);
-  const char* c_str();
-  StringView view(size_t start, size_t end);
+  const char* c_str() const;
+  StringView view() const;
+  StringView view(size_t start, size_t end) const;
+};
+
+// Interns strings into one contiguous block: equal strings get the same id and are stored once.
+// If the pool is sized up front by init() it never reallocates and get() pointers stay valid, 
+// otherwise hold on to ids rather than pointers.
+struct StringPool {
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  Array<char> chars; // null terminated strings back to back
+  Array<uint32_t> offsets; // id -> offset into chars
+  Array<uint32_t> lengths; // id -> length, not including the null byte
+  Array<uint32_t> table; // open addressing, id + 1 (0 is empty), size is a power of 2
+
+  // count strings totalling bytes characters (not including null bytes)
+  void init(size_t count, size_t bytes, Allocator *alloc);
+  // Bytes init() takes from alloc for a pool of that size
+  static size_t size_for(size_t count, size_t bytes);
+
+  uint32_t intern(const char *str, size_t len);
+  uint32_t intern(const char *str);
+  uint32_t intern(StringView str) { return intern(str.str, str.len); }
+  // NONE if the string was never interned
+  uint32_t find(const char *str, size_t len);
+  StringView view(uint32_t id);
+  const char* get(uint32_t id);
+  size_t length(uint32_t id);
+  size_t count() { return offsets.len; }
+
+  static uint32_t hash(const char *str, size_t len);
+  void rehash(size_t size);
 };
 
 } // namespace Sol
@@ -0,0 +1,194 @@
+#include "ThreadPool.hpp"
+#include "Allocator.hpp"
+#include "VulkanErrors.hpp"
+
+namespace Sol {
+
+namespace {
+  // Pool this thread works for and its deque there
+  thread_local const ThreadPool *Worker_Pool = nullptr;
+  thread_local uint32_t Worker_Index = 0;
+
+  // This thread's deque in pool, 0 for threads which are not its workers
+  inline uint32_t deque_index(const ThreadPool *pool) {
+    return Worker_Pool == pool ? Worker_Index : 0;
+  }
+
+  struct Range {
+    ThreadPool::RangeFunc func;
+    void *arg;
+    size_t begin;
+    size_t end;
+  };
+  void run_range(void *arg) {
+    Range *range = (Range*)arg;
+    range->func(range->begin, range->end, range->arg);
+  }
+}
+
+void ThreadPool::init(uint32_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+    thread_count = thread_count > 1 ? thread_count - 1 : 0;
+  }
+  quit = false;
+  queued = 0;
+  deque_count = thread_count + 1;
+  deques = new Deque[deque_count];
+  workers.reserve(thread_count);
+  for(uint32_t i = 0; i < thread_count; ++i)
+    workers.emplace_back(&ThreadPool::work, this, i + 1);
+}
+void ThreadPool::kill() {
+  {
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    quit = true;
+  }
+  sleep_cond.notify_all();
+  // Workers only leave once the deques are empty. Help them, and do it all without workers. Jobs
+  // held back on a counter are pushed when it finishes, so they are drained too.
+  Job job;
+  while(find_job(&job))
+    run(job);
+  for(auto &worker : workers)
+    worker.join();
+  DEBUG_ABORT(queued.load() == 0, "ThreadPool::kill: jobs left after draining");
+  workers.clear();
+  delete[] deques;
+  deques = nullptr;
+  deque_count = 1;
+}
+
+void ThreadPool::push(Job job) {
+  Deque *deque = &deques[deque_index(this)];
+  {
+    std::lock_guard<std::mutex> guard(deque->lock);
+    deque->jobs.push_back(job);
+  }
+  queued.fetch_add(1, std::memory_order_release);
+  // Taking the lock orders this against a worker checking queued before it sleeps
+  { std::lock_guard<std::mutex> guard(sleep_lock); }
+  sleep_cond.notify_one();
+}
+
+void ThreadPool::submit(JobFunc func, void *arg, Counter *counter) {
+  if (counter)
+    counter->pending.fetch_add(1, std::memory_order_relaxed);
+  push({func, arg, counter});
+}
+void ThreadPool::submit_after(Counter *dependency, JobFunc func, void *arg, Counter *counter) {
+  if (counter)
+    counter->pending.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> guard(dependency->lock);
+    if (!dependency->done()) {
+      dependency->after.push_back({func, arg, counter});
+      return;
+    }
+  }
+  push({func, arg, counter});
+}
+
+// Own deque newest first (still in cache), then steal the oldest job of the others
+bool ThreadPool::find_job(Job *job) {
+  uint32_t count = deque_count;
+  uint32_t self = deque_index(this);
+  if (queued.load(std::memory_order_acquire) == 0)
+    return false;
+  {
+    Deque *deque = &deques[self];
+    std::lock_guard<std::mutex> guard(deque->lock);
+    if (!deque->jobs.empty()) {
+      *job = deque->jobs.back();
+      deque->jobs.pop_back();
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  for(uint32_t i = 1; i < count; ++i) {
+    Deque *deque = &deques[(self + i) % count];
+    std::lock_guard<std::mutex> guard(deque->lock);
+    if (!deque->jobs.empty()) {
+      *job = deque->jobs.front();
+      deque->jobs.pop_front();
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(Job job) {
+  {
+    ScratchScope scope;
+    job.func(job.arg);
+  }
+  Counter *counter = job.counter;
+  if (!counter)
+    return;
+
+  // Decremented under the lock, wait() takes it once more before the counter can go away
+  std::vector<Job> after;
+  {
+    std::lock_guard<std::mutex> guard(counter->lock);
+    if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      after.swap(counter->after);
+  }
+  for(const Job &next : after)
+    push(next);
+}
+
+void ThreadPool::work(uint32_t index) {
+  Worker_Pool = this;
+  Worker_Index = index;
+  for(;;) {
+    Job job;
+    if (find_job(&job)) {
+      run(job);
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(sleep_lock);
+    // Quitting waits for the deques to empty, a job still running elsewhere pushes to its own
+    if (quit.load() && queued.load() == 0)
+      break;
+    sleep_cond.wait(guard, [&]{ return quit.load() || queued.load() > 0; });
+  }
+}
+
+void ThreadPool::wait(Counter *counter) {
+  while(!counter->done()) {
+    Job job;
+    if (find_job(&job))
+      run(job);
+    else
+      std::this_thread::yield();
+  }
+  // The last job may still be inside run() holding the lock
+  std::lock_guard<std::mutex> guard(counter->lock);
+}
+
+void ThreadPool::parallel_for(size_t count, size_t grain, RangeFunc func, void *arg) {
+  if (count == 0)
+    return;
+  if (grain == 0) {
+    grain = count / (thread_count() * 4);
+    if (grain == 0)
+      grain = 1;
+  }
+  size_t chunks = (count + grain - 1) / grain;
+  if (chunks == 1 || deque_count == 1) {
+    func(0, count, arg);
+    return;
+  }
+
+  ScratchScope scope;
+  Range *ranges = (Range*)scope.arena->allocate(chunks * sizeof(Range), alignof(Range));
+  Counter counter;
+  for(size_t i = 0; i < chunks; ++i) {
+    ranges[i] = {func, arg, i * grain, (i + 1) * grain < count ? (i + 1) * grain : count};
+    submit(run_range, &ranges[i], &counter);
+  }
+  wait(&counter);
+}
+
+} // namespace Sol
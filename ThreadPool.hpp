@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Sol {
+
+// Work stealing job system. Every thread has its own deque: it pushes and pops its own jobs at the
+// back, idle threads steal from the front of the others. Threads which are not workers share deque 0.
+// Jobs run inside a ScratchScope on their thread's scratch arena, so they may lin_alloca freely, but
+// must not hand scratch memory back to whoever submitted them.
+struct ThreadPool {
+  typedef void (*JobFunc)(void *arg);
+  typedef void (*RangeFunc)(size_t begin, size_t end, void *arg);
+
+  struct Counter;
+  struct Job {
+    JobFunc func;
+    void *arg;
+    Counter *counter; // decremented once the job has run, may be nullptr
+  };
+  // Number of submitted jobs which have not finished. Jobs submitted after a counter only start once it
+  // reaches 0, so counters double as dependencies between groups of jobs.
+  struct Counter {
+    std::atomic<uint32_t> pending{0};
+    std::mutex lock;
+    std::vector<Job> after; // jobs waiting for pending to reach 0
+
+    bool done() { return pending.load(std::memory_order_acquire) == 0; }
+  };
+  struct Deque {
+    std::mutex lock;
+    std::deque<Job> jobs;
+  };
+
+  std::vector<std::thread> workers;
+  Deque *deques = nullptr; // deque 0 is for threads outside the pool
+  uint32_t deque_count = 1; // workers + 1
+  std::atomic<uint32_t> queued{0}; // jobs sitting in deques
+  std::atomic<bool> quit{false};
+  std::mutex sleep_lock;
+  std::condition_variable sleep_cond;
+
+  // thread_count workers, 0 for one less than the hardware threads (the caller makes up the last one)
+  void init(uint32_t thread_count);
+  // Runs every job still queued or held back on a counter, then joins the workers. Threads in
+  // wait() return once their counters finish.
+  void kill();
+  uint32_t thread_count() { return deque_count; }
+
+  // counter (optional) is incremented now and decremented when the job finishes
+  void submit(JobFunc func, void *arg, Counter *counter);
+  // Same, but the job is held back until every job of dependency has finished
+  void submit_after(Counter *dependency, JobFunc func, void *arg, Counter *counter);
+  // Run jobs on this thread until counter reaches 0
+  void wait(Counter *counter);
+
+  // func over [0, count) in chunks of grain items, returns once all of them are done.
+  // grain 0 picks one giving each thread a few chunks to balance by stealing.
+  void parallel_for(size_t count, size_t grain, RangeFunc func, void *arg);
+
+  void push(Job job);
+  bool find_job(Job *job);
+  void run(Job job);
+  void work(uint32_t index);
+};
+
+} // namespace Sol
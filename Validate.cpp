@@ -0,0 +1,469 @@
+#include <cstring>
+
+#include "Validate.hpp"
+#include "Indices.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// Diagnostics ////////////////////////
+void Diagnostics::push(glTF::Section section, uint32_t index, Diagnostic::Severity severity,
+                       Diagnostic::Code code, const char *message) {
+  if (severity == Diagnostic::ERROR)
+    ++errors;
+  else
+    ++warnings;
+  if (list.len >= max)
+    return;
+  if (!list.mem) {
+    list.alloc = alloc;
+    list.init(64, 8);
+  }
+  list.push({section, index, severity, code, message});
+}
+void Diagnostics::clear() {
+  list.len = 0;
+  errors = 0;
+  warnings = 0;
+}
+void Diagnostics::kill() {
+  if (list.mem)
+    alloc->deallocate(list.mem);
+  list = Array<Diagnostic>();
+  clear();
+}
+
+// Validate ////////////////////////
+namespace {
+  // Branchless over the whole batch so the loops compile to vector compares and ors. Only a
+  // batch with a failure is walked again to report which elements failed.
+
+  // Adding bias (1 for optional references) takes INVALID_INDEX to 0, so one unsigned compare
+  // checks both ends of [0, limit)
+  bool any_out_of_range(const int32_t *refs, size_t count, uint32_t limit, uint32_t bias) {
+    uint32_t bound = limit + bias;
+    uint32_t bad = 0;
+    for(size_t i = 0; i < count; ++i)
+      bad |= (uint32_t)refs[i] + bias >= bound;
+    return bad;
+  }
+  // need > have is the borrow out of have - need. Built from bit operations it vectorizes on plain
+  // SSE2, which has no unsigned 64 bit compare.
+  bool any_exceeding(const uint64_t *need, const uint64_t *have, size_t count) {
+    uint64_t borrow = 0;
+    for(size_t i = 0; i < count; ++i)
+      borrow |= (~have[i] & need[i]) | (~(have[i] ^ need[i]) & (have[i] - need[i]));
+    return borrow >> 63;
+  }
+
+  bool check_joints_weights_count(const Array<Mesh::Primitive::Attribute> *attrs) {
+    uint32_t count_w = 0;
+    uint32_t count_j = 0;
+    for(size_t i = 0; i < attrs->len; ++i) {
+      count_w += attrs->mem[i].semantic == Mesh::Primitive::Attribute::WEIGHTS;
+      count_j += attrs->mem[i].semantic == Mesh::Primitive::Attribute::JOINTS;
+    }
+    return count_j == count_w;
+  }
+
+  struct Validator {
+    glTF *gltf;
+    Diagnostics *out;
+    Allocator *alloc;
+    // Gathered references of one kind of field, with the element each came from
+    Array<int32_t> refs;
+    Array<uint32_t> ref_owners;
+    // Gathered end offsets against the length they must fit in
+    Array<uint64_t> need;
+    Array<uint64_t> have;
+    Array<uint32_t> range_owners;
+
+    void init(glTF *gltf_, Diagnostics *out_) {
+      gltf = gltf_;
+      out = out_;
+      alloc = out->alloc;
+      refs.alloc = alloc;
+      refs.init(256, 8);
+      ref_owners.alloc = alloc;
+      ref_owners.init(256, 8);
+      need.alloc = alloc;
+      need.init(256, 8);
+      have.alloc = alloc;
+      have.init(256, 8);
+      range_owners.alloc = alloc;
+      range_owners.init(256, 8);
+    }
+    void kill() {
+      alloc->deallocate(refs.mem);
+      alloc->deallocate(ref_owners.mem);
+      alloc->deallocate(need.mem);
+      alloc->deallocate(have.mem);
+      alloc->deallocate(range_owners.mem);
+    }
+
+    void error(glTF::Section section, uint32_t index, Diagnostic::Code code, const char *message) {
+      out->push(section, index, Diagnostic::ERROR, code, message);
+    }
+    void warning(glTF::Section section, uint32_t index, Diagnostic::Code code, const char *message) {
+      out->push(section, index, Diagnostic::WARNING, code, message);
+    }
+
+    void ref(uint32_t owner, int32_t value) {
+      refs.push(value);
+      ref_owners.push(owner);
+    }
+    // Check the gathered references against a section of limit elements, then drop them
+    void check_refs(glTF::Section owner, size_t limit, bool optional, const char *message) {
+      uint32_t bias = optional ? 1 : 0;
+      if (any_out_of_range(refs.mem, refs.len, limit, bias)) {
+        for(size_t i = 0; i < refs.len; ++i)
+          if ((uint32_t)refs.mem[i] + bias >= limit + bias)
+            error(owner, ref_owners.mem[i], Diagnostic::INDEX_OUT_OF_RANGE, message);
+      }
+      refs.len = 0;
+      ref_owners.len = 0;
+    }
+
+    void range(uint32_t owner, uint64_t end, uint64_t length) {
+      need.push(end);
+      have.push(length);
+      range_owners.push(owner);
+    }
+    void check_ranges(glTF::Section owner, Diagnostic::Code code, const char *message) {
+      if (any_exceeding(need.mem, have.mem, need.len)) {
+        for(size_t i = 0; i < need.len; ++i)
+          if (need.mem[i] > have.mem[i])
+            error(owner, range_owners.mem[i], code, message);
+      }
+      need.len = 0;
+      have.len = 0;
+      range_owners.len = 0;
+    }
+
+    // Fast ////////////////////////
+    void references() {
+      const size_t scene_count = gltf->scenes.scenes.len;
+      const size_t node_count = gltf->nodes.nodes.len;
+      const size_t accessor_count = gltf->accessors.accessors.len;
+      const size_t view_count = gltf->buffer_views.views.len;
+      const size_t texture_count = gltf->textures.textures.len;
+
+      ref(0, gltf->scenes.scene);
+      check_refs(glTF::SCENES, scene_count, true, "scene is not a scene");
+      for(size_t i = 0; i < scene_count; ++i) {
+        const Scene &scene = gltf->scenes.scenes.mem[i];
+        for(size_t j = 0; j < scene.nodes.len; ++j)
+          ref(i, scene.nodes.mem[j]);
+      }
+      check_refs(glTF::SCENES, node_count, false, "scene.nodes is not a node");
+
+      for(size_t i = 0; i < node_count; ++i) {
+        const Node &node = gltf->nodes.nodes.mem[i];
+        for(size_t j = 0; j < node.children.len; ++j)
+          ref(i, node.children.mem[j]);
+      }
+      check_refs(glTF::NODES, node_count, false, "node.children is not a node");
+      for(size_t i = 0; i < node_count; ++i)
+        ref(i, gltf->nodes.nodes.mem[i].mesh);
+      check_refs(glTF::NODES, gltf->meshes.meshes.len, true, "node.mesh is not a mesh");
+      for(size_t i = 0; i < node_count; ++i)
+        ref(i, gltf->nodes.nodes.mem[i].skin);
+      check_refs(glTF::NODES, gltf->skins.skins.len, true, "node.skin is not a skin");
+      for(size_t i = 0; i < node_count; ++i)
+        ref(i, gltf->nodes.nodes.mem[i].camera);
+      check_refs(glTF::NODES, gltf->cameras.cameras.len, true, "node.camera is not a camera");
+
+      for(size_t i = 0; i < view_count; ++i)
+        ref(i, gltf->buffer_views.views.mem[i].buffer);
+      check_refs(glTF::BUFFER_VIEWS, gltf->buffers.buffers.len, false, "bufferView.buffer is not a buffer");
+
+      for(size_t i = 0; i < accessor_count; ++i) {
+        const Accessor &accessor = gltf->accessors.accessors.mem[i];
+        ref(i, accessor.buffer_view);
+      }
+      check_refs(glTF::ACCESSORS, view_count, true, "accessor.bufferView is not a buffer view");
+      for(size_t i = 0; i < accessor_count; ++i) {
+        const Accessor &accessor = gltf->accessors.accessors.mem[i];
+        if (accessor.sparse.count == INVALID_COUNT)
+          continue;
+        ref(i, accessor.sparse.indices.buffer_view);
+        ref(i, accessor.sparse.values.buffer_view);
+      }
+      check_refs(glTF::ACCESSORS, view_count, false, "accessor.sparse bufferView is not a buffer view");
+
+      for(size_t i = 0; i < gltf->meshes.meshes.len; ++i) {
+        const Mesh &mesh = gltf->meshes.meshes.mem[i];
+        for(size_t p = 0; p < mesh.primitives.len; ++p) {
+          const Mesh::Primitive &prim = mesh.primitives.mem[p];
+          for(size_t j = 0; j < prim.attributes.len; ++j)
+            ref(i, prim.attributes.mem[j].accessor);
+          for(size_t t = 0; t < prim.targets.len; ++t)
+            for(size_t j = 0; j < prim.targets.mem[t].attributes.len; ++j)
+              ref(i, prim.targets.mem[t].attributes.mem[j].accessor);
+        }
+      }
+      check_refs(glTF::MESHES, accessor_count, false, "primitive attribute is not an accessor");
+      for(size_t i = 0; i < gltf->meshes.meshes.len; ++i) {
+        const Mesh &mesh = gltf->meshes.meshes.mem[i];
+        for(size_t p = 0; p < mesh.primitives.len; ++p)
+          ref(i, mesh.primitives.mem[p].indices);
+      }
+      check_refs(glTF::MESHES, accessor_count, true, "primitive.indices is not an accessor");
+      for(size_t i = 0; i < gltf->meshes.meshes.len; ++i) {
+        const Mesh &mesh = gltf->meshes.meshes.mem[i];
+        for(size_t p = 0; p < mesh.primitives.len; ++p)
+          ref(i, mesh.primitives.mem[p].material);
+      }
+      check_refs(glTF::MESHES, gltf->materials.materials.len, true, "primitive.material is not a material");
+
+      for(size_t i = 0; i < gltf->skins.skins.len; ++i) {
+        const Skin &skin = gltf->skins.skins.mem[i];
+        for(size_t j = 0; j < skin.joints.len; ++j)
+          ref(i, skin.joints.mem[j]);
+      }
+      check_refs(glTF::SKINS, node_count, false, "skin.joints is not a node");
+      for(size_t i = 0; i < gltf->skins.skins.len; ++i)
+        ref(i, gltf->skins.skins.mem[i].skeleton);
+      check_refs(glTF::SKINS, node_count, true, "skin.skeleton is not a node");
+      for(size_t i = 0; i < gltf->skins.skins.len; ++i)
+        ref(i, gltf->skins.skins.mem[i].i_bind_matrices);
+      check_refs(glTF::SKINS, accessor_count, true, "skin.inverseBindMatrices is not an accessor");
+
+      for(size_t i = 0; i < texture_count; ++i)
+        ref(i, gltf->textures.textures.mem[i].sampler);
+      check_refs(glTF::TEXTURES, gltf->samplers.samplers.len, true, "texture.sampler is not a sampler");
+      for(size_t i = 0; i < texture_count; ++i)
+        ref(i, gltf->textures.textures.mem[i].source);
+      check_refs(glTF::TEXTURES, gltf->images.images.len, true, "texture.source is not an image");
+
+      for(size_t i = 0; i < gltf->images.images.len; ++i)
+        ref(i, gltf->images.images.mem[i].buffer_view);
+      check_refs(glTF::IMAGES, view_count, true, "image.bufferView is not a buffer view");
+
+      for(size_t i = 0; i < gltf->materials.materials.len; ++i) {
+        const Material &mat = gltf->materials.materials.mem[i];
+        ref(i, mat.pbr_metallic_roughness.base_color_texture.index);
+        ref(i, mat.pbr_metallic_roughness.metallic_roughness_texture.index);
+        ref(i, mat.normal_texture.index);
+        ref(i, mat.occlusion_texture.index);
+        ref(i, mat.emissive_texture.index);
+      }
+      check_refs(glTF::MATERIALS, texture_count, true, "material texture is not a texture");
+
+      for(size_t i = 0; i < gltf->animations.animations.len; ++i) {
+        const Animation &anim = gltf->animations.animations.mem[i];
+        for(size_t j = 0; j < anim.channels.len; ++j)
+          ref(i, anim.channels.mem[j].target.node);
+      }
+      check_refs(glTF::ANIMATIONS, node_count, true, "channel.target.node is not a node");
+      for(size_t i = 0; i < gltf->animations.animations.len; ++i) {
+        const Animation &anim = gltf->animations.animations.mem[i];
+        for(size_t j = 0; j < anim.samplers.len; ++j) {
+          ref(i, anim.samplers.mem[j].input);
+          ref(i, anim.samplers.mem[j].output);
+        }
+      }
+      check_refs(glTF::ANIMATIONS, accessor_count, false, "animation sampler input/output is not an accessor");
+      // Channel samplers index their own animation's samplers, a batch per animation
+      for(size_t i = 0; i < gltf->animations.animations.len; ++i) {
+        const Animation &anim = gltf->animations.animations.mem[i];
+        for(size_t j = 0; j < anim.channels.len; ++j)
+          ref(i, anim.channels.mem[j].sampler);
+        check_refs(glTF::ANIMATIONS, anim.samplers.len, false, "channel.sampler is not a sampler of its animation");
+      }
+    }
+
+    void ranges() {
+      const size_t buffer_count = gltf->buffers.buffers.len;
+      const size_t view_count = gltf->buffer_views.views.len;
+
+      for(size_t i = 0; i < view_count; ++i) {
+        const BufferView &view = gltf->buffer_views.views.mem[i];
+        if (view.byte_length == INVALID_COUNT) {
+          error(glTF::BUFFER_VIEWS, i, Diagnostic::MISSING_FIELD, "bufferView has no byteLength");
+          continue;
+        }
+        if (view.buffer < 0 || (size_t)view.buffer >= buffer_count)
+          continue;
+        uint64_t offset = view.byte_offset != INVALID_COUNT ? view.byte_offset : 0;
+        range(i, offset + view.byte_length, gltf->buffers.buffers.mem[view.buffer].byte_length);
+      }
+      check_ranges(glTF::BUFFER_VIEWS, Diagnostic::VIEW_OUT_OF_BUFFER, "bufferView runs past the end of its buffer");
+
+      for(size_t i = 0; i < gltf->accessors.accessors.len; ++i) {
+        const Accessor &accessor = gltf->accessors.accessors.mem[i];
+        uint32_t elem_size = component_size(accessor.component_type) * type_width(accessor.type);
+        if (elem_size == 0) {
+          error(glTF::ACCESSORS, i, Diagnostic::BAD_COMPONENT_TYPE, "accessor has no valid componentType and type");
+          continue;
+        }
+        if (accessor.count == INVALID_COUNT) {
+          error(glTF::ACCESSORS, i, Diagnostic::MISSING_FIELD, "accessor has no count");
+          continue;
+        }
+        if (accessor.buffer_view < 0 || (size_t)accessor.buffer_view >= view_count || accessor.count == 0)
+          continue;
+        const BufferView &view = gltf->buffer_views.views.mem[accessor.buffer_view];
+        if (view.byte_length == INVALID_COUNT)
+          continue;
+        uint64_t stride = view.byte_stride != INVALID_COUNT ? view.byte_stride : elem_size;
+        uint64_t offset = accessor.byte_offset != INVALID_COUNT ? accessor.byte_offset : 0;
+        range(i, offset + stride * (accessor.count - 1) + elem_size, view.byte_length);
+      }
+      check_ranges(glTF::ACCESSORS, Diagnostic::ACCESSOR_OUT_OF_VIEW, "accessor runs past the end of its bufferView");
+    }
+
+    // Full ////////////////////////
+    void layout() {
+      for(size_t i = 0; i < gltf->buffer_views.views.len; ++i) {
+        const BufferView &view = gltf->buffer_views.views.mem[i];
+        if (view.byte_stride == INVALID_COUNT)
+          continue;
+        if (view.byte_stride < 4 || view.byte_stride > 252 || view.byte_stride % 4)
+          error(glTF::BUFFER_VIEWS, i, Diagnostic::BAD_STRIDE, "bufferView.byteStride must be a multiple of 4 in [4, 252]");
+        if (view.target == BufferView::ELEMENT_ARRAY_BUFFER)
+          warning(glTF::BUFFER_VIEWS, i, Diagnostic::BAD_STRIDE, "index bufferView has a byteStride");
+      }
+
+      for(size_t i = 0; i < gltf->accessors.accessors.len; ++i) {
+        const Accessor &accessor = gltf->accessors.accessors.mem[i];
+        uint32_t comp = component_size(accessor.component_type);
+        uint32_t elem_size = comp * type_width(accessor.type);
+        if (elem_size == 0 || accessor.buffer_view < 0 || (size_t)accessor.buffer_view >= gltf->buffer_views.views.len)
+          continue;
+        const BufferView &view = gltf->buffer_views.views.mem[accessor.buffer_view];
+        if (view.byte_stride != INVALID_COUNT && view.byte_stride < elem_size)
+          error(glTF::ACCESSORS, i, Diagnostic::BAD_STRIDE, "accessor elements are larger than the bufferView's byteStride");
+        uint64_t offset = accessor.byte_offset != INVALID_COUNT ? accessor.byte_offset : 0;
+        uint64_t view_offset = view.byte_offset != INVALID_COUNT ? view.byte_offset : 0;
+        if (offset % comp || (offset + view_offset) % comp)
+          warning(glTF::ACCESSORS, i, Diagnostic::MISALIGNED, "accessor is not aligned to its component size");
+      }
+
+      for(size_t i = 0; i < gltf->meshes.meshes.len; ++i) {
+        const Mesh &mesh = gltf->meshes.meshes.mem[i];
+        for(size_t p = 0; p < mesh.primitives.len; ++p) {
+          const Mesh::Primitive &prim = mesh.primitives.mem[p];
+          if (!check_joints_weights_count(&prim.attributes))
+            error(glTF::MESHES, i, Diagnostic::JOINTS_WEIGHTS_COUNT, "primitive JOINTS_n count != WEIGHTS_n count");
+          if (prim.indices < 0 || (size_t)prim.indices >= gltf->accessors.accessors.len)
+            continue;
+          const Accessor &indices = gltf->accessors.accessors.mem[prim.indices];
+          bool unsigned_int = indices.component_type == Accessor::UINT8 || indices.component_type == Accessor::UINT16 ||
+                              indices.component_type == Accessor::UINT32;
+          if (indices.type != Accessor::SCALAR || !unsigned_int)
+            error(glTF::MESHES, i, Diagnostic::BAD_COMPONENT_TYPE, "primitive.indices must be unsigned int scalars");
+        }
+      }
+    }
+
+    void cameras() {
+      for(size_t i = 0; i < gltf->cameras.cameras.len; ++i) {
+        const Camera &cam = gltf->cameras.cameras.mem[i];
+        if (cam.type == Camera::UNKNOWN) {
+          error(glTF::CAMERAS, i, Diagnostic::CAMERA_TYPE, "camera type must be defined");
+          continue;
+        }
+        if (cam.type == Camera::ORTHO) {
+          if (cam.xmag == INVALID_FLOAT || cam.ymag == INVALID_FLOAT)
+            error(glTF::CAMERAS, i, Diagnostic::CAMERA_FIELD, "orthographic camera must have xmag and ymag");
+          if (cam.zfar == INVALID_FLOAT || cam.znear == INVALID_FLOAT)
+            error(glTF::CAMERAS, i, Diagnostic::CAMERA_FIELD, "orthographic camera must have zfar and znear");
+        }
+        if (cam.type == Camera::PERSPECTIVE) {
+          if (cam.yfov == INVALID_FLOAT || cam.znear == INVALID_FLOAT)
+            error(glTF::CAMERAS, i, Diagnostic::CAMERA_FIELD, "perspective camera must have yfov and znear");
+          else if (cam.znear <= 0)
+            error(glTF::CAMERAS, i, Diagnostic::CAMERA_FIELD, "perspective camera znear must be positive");
+        }
+        if (cam.zfar != INVALID_FLOAT && cam.znear != INVALID_FLOAT && cam.zfar <= cam.znear)
+          warning(glTF::CAMERAS, i, Diagnostic::CAMERA_FIELD, "camera zfar is not beyond znear");
+      }
+    }
+
+    // Every node has at most one parent, so following parents from any node either reaches a
+    // root or goes round a cycle. Each node is walked through once.
+    void hierarchy() {
+      const size_t node_count = gltf->nodes.nodes.len;
+      if (node_count == 0)
+        return;
+      Array<int32_t> parents;
+      parents.alloc = alloc;
+      parents.init(node_count, 8);
+      Array<uint32_t> walked;
+      walked.alloc = alloc;
+      walked.init(node_count, 8);
+      for(size_t i = 0; i < node_count; ++i) {
+        parents.mem[i] = INVALID_INDEX;
+        walked.mem[i] = 0;
+      }
+
+      for(size_t i = 0; i < node_count; ++i) {
+        const Node &node = gltf->nodes.nodes.mem[i];
+        for(size_t j = 0; j < node.children.len; ++j) {
+          int32_t child = node.children.mem[j];
+          if (child < 0 || (size_t)child >= node_count)
+            continue;
+          if (parents.mem[child] != INVALID_INDEX)
+            error(glTF::NODES, child, Diagnostic::MULTIPLE_PARENTS, "node is the child of more than one node");
+          else
+            parents.mem[child] = i;
+        }
+      }
+
+      // walked holds the start of the walk that first reached a node, plus one
+      for(size_t i = 0; i < node_count; ++i) {
+        int32_t n = i;
+        while(n != INVALID_INDEX && walked.mem[n] == 0) {
+          walked.mem[n] = i + 1;
+          n = parents.mem[n];
+        }
+        if (n != INVALID_INDEX && walked.mem[n] == i + 1)
+          error(glTF::NODES, n, Diagnostic::NODE_CYCLE, "node is its own ancestor");
+      }
+      alloc->deallocate(parents.mem);
+      alloc->deallocate(walked.mem);
+    }
+  };
+}
+
+bool validate(glTF *gltf, Diagnostics *out, Validation mode) {
+  uint32_t errors = out->errors;
+  if (gltf->asset.version.len == 0)
+    out->push(glTF::ASSET, Diagnostic::SECTION, Diagnostic::ERROR, Diagnostic::MISSING_VERSION,
+              "asset has no version");
+
+  Validator v;
+  v.init(gltf, out);
+  v.references();
+  v.ranges();
+  if (mode == Validation::FULL) {
+    v.layout();
+    v.cameras();
+    v.hierarchy();
+  }
+  v.kill();
+  return out->errors == errors;
+}
+
+bool validate_indices(glTF *gltf, Diagnostics *out) {
+  uint32_t errors = out->errors;
+  for(size_t i = 0; i < gltf->meshes.meshes.len; ++i) {
+    const Mesh &mesh = gltf->meshes.meshes.mem[i];
+    for(size_t p = 0; p < mesh.primitives.len; ++p) {
+      const Mesh::Primitive &prim = mesh.primitives.mem[p];
+      uint32_t stride;
+      const uint8_t *data = gltf->accessor_data(prim.indices, &stride);
+      if (!data)
+        continue;
+      const Accessor &indices = gltf->accessors.accessors.mem[prim.indices];
+      if (max_index(data, indices.count, stride, indices.component_type) >= vertex_count(gltf, &prim))
+        out->push(glTF::MESHES, i, Diagnostic::ERROR, Diagnostic::INDEX_BEYOND_VERTICES,
+                  "primitive index is not below its vertex count");
+    }
+  }
+  return out->errors == errors;
+}
+
+} // namespace glTF
+} // namespace Sol
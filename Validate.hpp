@@ -0,0 +1,71 @@
+#pragma once
+
+#include "glTF.hpp"
+
+namespace Sol {
+namespace glTF {
+
+// One problem found in a document, pointing at the object it was found on
+struct Diagnostic {
+  enum Severity : uint8_t {
+    ERROR, // reading the object as described would go out of bounds or is undefined
+    WARNING, // against the spec, but safe to read
+  };
+  enum Code : uint8_t {
+    MISSING_VERSION,
+    MISSING_FIELD,
+    INDEX_OUT_OF_RANGE,
+    VIEW_OUT_OF_BUFFER,
+    ACCESSOR_OUT_OF_VIEW,
+    BAD_COMPONENT_TYPE,
+    BAD_STRIDE,
+    MISALIGNED,
+    CAMERA_TYPE,
+    CAMERA_FIELD,
+    JOINTS_WEIGHTS_COUNT,
+    INDEX_BEYOND_VERTICES,
+    MULTIPLE_PARENTS,
+    NODE_CYCLE,
+  };
+  // index for properties of the section itself, e.g. the asset version
+  static constexpr uint32_t SECTION = UINT32_MAX;
+
+  glTF::Section section;
+  uint32_t index;
+  Severity severity;
+  Code code;
+  const char *message; // static string
+};
+
+struct Diagnostics {
+  Array<Diagnostic> list;
+  uint32_t errors = 0;
+  uint32_t warnings = 0;
+  // Beyond this many only the counts go up, a broken file can have an error per element
+  uint32_t max = 1024;
+  Allocator *alloc = &MemoryService::instance()->system_allocator;
+
+  void push(glTF::Section section, uint32_t index, Diagnostic::Severity severity, Diagnostic::Code code,
+            const char *message);
+  void clear();
+  void kill();
+  bool ok() const { return errors == 0; }
+};
+
+enum class Validation {
+  // Index bounds, view and accessor ranges and required fields: everything a reader needs
+  // to not go out of bounds. Cheap enough for every load.
+  FAST,
+  // Also stride and alignment rules, cameras, joints/weights pairs and the node hierarchy
+  FULL,
+};
+
+// Append what is wrong with a filled document to out, true if no errors were found. Nothing is
+// read from the buffers, only the document's description of them.
+bool validate(glTF *gltf, Diagnostics *out, Validation mode = Validation::FAST);
+// Read every primitive's indices and check them against its vertex count, true if all are in
+// range. Buffers must be loaded; indices which do not resolve are left to validate().
+bool validate_indices(glTF *gltf, Diagnostics *out);
+
+} // namespace glTF
+} // namespace Sol
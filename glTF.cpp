@@ -1,12 +1,19 @@
+#include <climits>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cstring>
+#include <mutex>
+#include <type_traits>
 
 #include "glTF.hpp"
+#include "PerfectHash.hpp"
 #include "nlohmann/json.hpp"
 #include "VulkanErrors.hpp"
+#include "ThreadPool.hpp"
+#include "IO.hpp"
 
 namespace Sol {
 namespace glTF {
@@ -21,173 +28,1069 @@ const uint8_t JPG_BYTE_PATTERN[3] = { 0xFF, 0xD8, 0xFF };
 const int32_t NEAREST_FALLBACK = 9728;
 const int32_t LINEAR_FALLBACK = 9729;
 
-bool read_json(const char* file, Json *json) {
-  std::ifstream f(file);
+const char* KNOWN_STRINGS[Str::COUNT] = {
+  "POSITION", "NORMAL", "TANGENT", 
+  "TEXCOORD_0", "TEXCOORD_1", "TEXCOORD_2", "TEXCOORD_3", 
+  "COLOR_0", "COLOR_1", 
+  "JOINTS_0", "JOINTS_1", "JOINTS_2", "JOINTS_3", 
+  "WEIGHTS_0", "WEIGHTS_1", "WEIGHTS_2", "WEIGHTS_3",
+};
+
+namespace {
+  // Nesting depth and the number of values in arrays and objects (counted as containers plus
+  // commas), which bound the parser's stack and what fill() allocates
+  bool within_limits(const char *text, size_t size, const Limits &limits) {
+    if (size > limits.max_bytes)
+      return false;
+    uint32_t depth = 0;
+    size_t elements = 0;
+    bool in_string = false;
+    for(size_t i = 0; i < size; ++i) {
+      char c = text[i];
+      if (in_string) {
+        if (c == '\\')
+          ++i;
+        else if (c == '"')
+          in_string = false;
+        continue;
+      }
+      switch(c) {
+        case '"':
+          in_string = true;
+          break;
+        case '[':
+        case '{':
+          if (++depth > limits.max_depth || ++elements > limits.max_elements)
+            return false;
+          break;
+        case ']':
+        case '}':
+          depth -= depth > 0;
+          break;
+        case ',':
+          if (++elements > limits.max_elements)
+            return false;
+          break;
+        default:
+          break;
+      }
+    }
+    return true;
+  }
+}
+
+bool parse_json(const char *text, size_t size, Json *json, const Limits &limits) {
+  if (!within_limits(text, size, limits)) {
+    *json = Json(Json::value_t::discarded);
+    return false;
+  }
+  *json = Json::parse(text, text + size, nullptr, false);
+  return !json->is_discarded();
+}
+
+bool read_json(const char* file, Json *json, const Limits &limits) {
+  std::ifstream f(file, std::ios::binary | std::ios::ate);
   if (!f.is_open())
     return false;
+  std::streamoff size = f.tellg();
+  if (size < 0 || (uint64_t)size > limits.max_bytes)
+    return false;
+  std::string text(size, '\0');
+  f.seekg(0);
+  f.read(&text[0], size);
+  if (f.gcount() != size)
+    return false;
+  return parse_json(text.data(), text.size(), json, limits);
+}
+
+bool parse_glb(const uint8_t *data, size_t size, Glb *glb) {
+  const uint32_t MAGIC = 0x46546C67; // "glTF"
+  const uint32_t JSON_CHUNK = 0x4E4F534A;
+  const uint32_t BIN_CHUNK = 0x004E4942;
+  auto read_u32 = [data](size_t offset) {
+    uint32_t v;
+    memcpy(&v, data + offset, 4);
+    return v;
+  };
 
-  *json = Json::parse(f);
-  f.close();
+  *glb = Glb();
+  if (size < 12 || read_u32(0) != MAGIC || read_u32(4) != 2)
+    return false;
+  uint64_t length = read_u32(8);
+  if (length > size)
+    return false;
+
+  uint64_t offset = 12;
+  bool first = true;
+  while(offset + 8 <= length) {
+    uint64_t chunk_size = read_u32(offset);
+    uint32_t type = read_u32(offset + 4);
+    offset += 8;
+    if (chunk_size > length - offset)
+      return false;
+    if (first && type != JSON_CHUNK)
+      return false;
+    if (type == JSON_CHUNK && first) {
+      glb->json = (const char*)data + offset;
+      glb->json_size = chunk_size;
+    } else if (type == BIN_CHUNK && !glb->bin) {
+      glb->bin = data + offset;
+      glb->bin_size = chunk_size;
+    } else if (type == JSON_CHUNK) {
+      return false;
+    }
+    first = false;
+    offset += chunk_size;
+  }
+  return glb->json != nullptr && offset == length;
+}
+
+namespace {
+  int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+}
+std::string decode_uri(const char *uri) {
+  std::string out;
+  for(const char *c = uri; *c; ++c) {
+    int hi, lo;
+    if (c[0] == '%' && (hi = hex_digit(c[1])) >= 0 && (lo = hex_digit(c[2])) >= 0) {
+      out.push_back((char)(hi * 16 + lo));
+      c += 2;
+    } else {
+      out.push_back(*c);
+    }
+  }
+  return out;
+}
+std::string canonical_dir(const std::string &dir) {
+  char buf[PATH_MAX];
+  if (!realpath(dir.c_str(), buf))
+    return dir;
+  return buf;
+}
+
+bool glTF::load_buffers(const char *dir) {
+  for(size_t i = 0; i < buffers.buffers.len; ++i)
+    if (!load_buffer(i, dir))
+      return false;
   return true;
 }
+bool glTF::load_buffer(size_t index, const char *dir) {
+  Buffer *buf = &buffers.buffers[index];
+  if (buf->data || buf->uri.len == 0)
+    return true;
+  // TODO:: Support base64 data uris
+  if (strncmp(buf->uri.c_str(), "data:", 5) == 0)
+    return false;
+
+  std::string path = std::string(dir) + "/" + decode_uri(buf->uri.c_str());
+  std::ifstream f(path, std::ios::binary);
+  if (!f.is_open())
+    return false;
+
+  buf->data = (uint8_t*)mem_alloca(buf->byte_length, 16);
+  f.read((char*)buf->data, buf->byte_length);
+  if ((uint32_t)f.gcount() != buf->byte_length) {
+    mem_free(buf->data);
+    buf->data = nullptr;
+    return false;
+  }
+  return true;
+}
+namespace {
+  char* join_path(LinearAllocator *arena, const char *dir, const char *uri) {
+    std::string file = decode_uri(uri);
+    size_t dir_len = strlen(dir);
+    char *path = (char*)arena->allocate(dir_len + file.size() + 2, 1);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, file.c_str(), file.size() + 1);
+    return path;
+  }
+  bool is_file_uri(const StringBuffer &uri) {
+    return uri.len && strncmp(uri.c_str(), "data:", 5) != 0;
+  }
+}
+
+bool glTF::load_files(const char *dir, FileReader *reader) {
+  ScratchScope scope;
+  size_t max = buffers.buffers.len + images.images.len;
+  if (max == 0)
+    return true;
+  ReadRequest *requests = (ReadRequest*)scope.arena->allocate(max * sizeof(ReadRequest), 8);
+  uint8_t **owners = (uint8_t**)scope.arena->allocate(max * sizeof(uint8_t*), 8);
+  size_t count = 0;
+  bool ok = true;
+
+  // Destinations are allocated before anything is read, so all the reads can be in flight together
+  for(size_t i = 0; i < buffers.buffers.len; ++i) {
+    Buffer *buf = &buffers.buffers[i];
+    if (buf->data || !is_file_uri(buf->uri))
+      continue;
+    buf->data = (uint8_t*)mem_alloca(buf->byte_length ? buf->byte_length : 1, 16);
+    requests[count] = ReadRequest();
+    requests[count].path = join_path(scope.arena, dir, buf->uri.c_str());
+    requests[count].dst = buf->data;
+    requests[count].size = buf->byte_length;
+    owners[count++] = (uint8_t*)buf;
+  }
+  size_t image_start = count;
+  for(size_t i = 0; i < images.images.len; ++i) {
+    Image *img = &images.images[i];
+    if (img->data || !is_file_uri(img->uri))
+      continue;
+    const char *path = join_path(scope.arena, dir, img->uri.c_str());
+    int64_t size = FileReader::file_size(path);
+    if (size < 0 || size > UINT32_MAX) {
+      ok = false;
+      continue;
+    }
+    img->byte_length = size;
+    img->data = (uint8_t*)mem_alloca(size ? size : 1, 16);
+    requests[count] = ReadRequest();
+    requests[count].path = path;
+    requests[count].dst = img->data;
+    requests[count].size = size;
+    owners[count++] = (uint8_t*)img;
+  }
+
+  ok &= reader->read(requests, count);
+  for(size_t i = 0; i < count; ++i) {
+    if (requests[i].result == (int64_t)requests[i].size)
+      continue;
+    mem_free(requests[i].dst);
+    if (i < image_start)
+      ((Buffer*)owners[i])->data = nullptr;
+    else
+      ((Image*)owners[i])->data = nullptr;
+  }
+  return ok;
+}
+
+void glTF::free_buffers() {
+  for(size_t i = 0; i < buffers.buffers.len; ++i) {
+    if (buffers.buffers[i].data)
+      mem_free(buffers.buffers[i].data);
+    buffers.buffers[i].data = nullptr;
+  }
+  for(size_t i = 0; i < images.images.len; ++i) {
+    if (images.images[i].data)
+      mem_free(images.images[i].data);
+    images.images[i].data = nullptr;
+  }
+}
+
+uint32_t component_size(Accessor::ComponentType type) {
+  switch(type) {
+    case Accessor::INT8:
+    case Accessor::UINT8:
+      return 1;
+    case Accessor::INT16:
+    case Accessor::UINT16:
+      return 2;
+    case Accessor::UINT32:
+    case Accessor::FLOAT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+uint32_t type_width(Accessor::Type type) {
+  const uint32_t widths[] = { 1, 2, 3, 4, 4, 9, 16 };
+  if ((uint32_t)type > Accessor::MAT4)
+    return 0;
+  return widths[type];
+}
+
+const uint8_t* glTF::accessor_data(int32_t index, uint32_t *stride) {
+  if (index < 0 || (size_t)index >= accessors.accessors.len)
+    return nullptr;
+  Accessor *accessor = &accessors.accessors[index];
+  if (accessor->buffer_view == INVALID_INDEX || (size_t)accessor->buffer_view >= buffer_views.views.len)
+    return nullptr;
+  BufferView *view = &buffer_views.views[accessor->buffer_view];
+  if (view->buffer == INVALID_INDEX || (size_t)view->buffer >= buffers.buffers.len)
+    return nullptr;
+  Buffer *buf = &buffers.buffers[view->buffer];
+  if (!buf->data)
+    return nullptr;
 
-void glTF::fill(Json json) {
-  asset.fill(json);
-  scenes.fill(json); 
-  nodes.fill(json);
-  buffers.fill(json);
-  buffer_views.fill(json);
-  accessors.fill(json);
-  meshes.fill(json);
-  skins.fill(json);
-  textures.fill(json);
-  images.fill(json);
-  samplers.fill(json);
-  materials.fill(json);
-  cameras.fill(json);
-  animations.fill(json);
+  uint32_t elem_size = component_size(accessor->component_type) * type_width(accessor->type);
+  *stride = view->byte_stride != INVALID_COUNT ? view->byte_stride : elem_size;
+
+  uint32_t view_offset = view->byte_offset != INVALID_COUNT ? view->byte_offset : 0;
+  uint32_t offset = accessor->byte_offset != INVALID_COUNT ? accessor->byte_offset : 0;
+  if (accessor->count == INVALID_COUNT || accessor->count == 0 || elem_size == 0)
+    return nullptr;
+  uint64_t end = (uint64_t)offset + (uint64_t)*stride * (accessor->count - 1) + elem_size;
+  if (end > view->byte_length || (uint64_t)view_offset + view->byte_length > buf->byte_length)
+    return nullptr;
+
+  return buf->data + view_offset + offset;
 }
 
 namespace { 
+  // Allocator for the document being filled by this thread, see glTF::fill. 
+  // nullptr leaves Arrays and strings on their default (the thread's scratch arena).
+  thread_local Allocator *Doc_Alloc = nullptr;
+  // Pool for names and attribute keys of the document being filled
+  thread_local StringPool *Doc_Strings = nullptr;
+  // Held while interning when several threads fill one document
+  thread_local std::mutex *Doc_Strings_Lock = nullptr;
+  // Strings seen by the counting pass which will go into the pool
+  thread_local size_t Count_Strings = 0;
+  thread_local size_t Count_String_Bytes = 0;
+  const Json Empty_Json = Json::array();
+
+  uint32_t intern(StringView str) {
+    if (!Doc_Strings_Lock)
+      return Doc_Strings->intern(str);
+    std::lock_guard<std::mutex> guard(*Doc_Strings_Lock);
+    return Doc_Strings->intern(str);
+  }
+
+  const Json& find_or_empty(const Json &json, const char* key) {
+    auto tmp = json.find(key);
+    if (tmp == json.end())
+      return Empty_Json;
+    return tmp.value();
+  }
+  // Same, but anything other than an array is treated as missing, so a mistyped section
+  // cannot be iterated as if it held elements
+  const Json& find_array(const Json &json, const char* key) {
+    auto tmp = json.find(key);
+    if (tmp == json.end() || !tmp->is_array())
+      return Empty_Json;
+    return tmp.value();
+  }
+  // Compile time perfect hashes for every string enum in the spec
+  constexpr HashKey ACCESSOR_TYPE_KEYS[] = {
+    { "SCALAR", Accessor::SCALAR }, { "VEC2", Accessor::VEC2 }, { "VEC3", Accessor::VEC3 }, { "VEC4", Accessor::VEC4 },
+    { "MAT2", Accessor::MAT2 }, { "MAT3", Accessor::MAT3 }, { "MAT4", Accessor::MAT4 },
+  };
+  constexpr HashKey ALPHA_MODE_KEYS[] = {
+    { "OPAQUE", Material::OPAQUE }, { "MASK", Material::MASK }, { "BLEND", Material::BLEND },
+  };
+  constexpr HashKey CAMERA_TYPE_KEYS[] = {
+    { "perspective", Camera::PERSPECTIVE }, { "orthographic", Camera::ORTHO },
+  };
+  constexpr HashKey MIME_TYPE_KEYS[] = {
+    { "image/jpeg", Image::JPG }, { "image/png", Image::PNG },
+  };
+  constexpr HashKey PATH_KEYS[] = {
+    { "translation", Animation::Channel::Target::TRANSLATION }, { "rotation", Animation::Channel::Target::ROTATION },
+    { "scale", Animation::Channel::Target::SCALE }, { "weights", Animation::Channel::Target::WEIGHTS },
+  };
+  constexpr HashKey INTERPOLATION_KEYS[] = {
+    { "LINEAR", Animation::Sampler::LINEAR }, { "STEP", Animation::Sampler::STEP }, 
+    { "CUBICSPLINE", Animation::Sampler::CUBICSPLINE },
+  };
+  // Indexed semantics are hashed without their "_n"
+  constexpr HashKey SEMANTIC_KEYS[] = {
+    { "POSITION", Mesh::Primitive::Attribute::POSITION }, { "NORMAL", Mesh::Primitive::Attribute::NORMAL }, 
+    { "TANGENT", Mesh::Primitive::Attribute::TANGENT }, { "TEXCOORD", Mesh::Primitive::Attribute::TEXCOORD },
+    { "COLOR", Mesh::Primitive::Attribute::COLOR }, { "JOINTS", Mesh::Primitive::Attribute::JOINTS },
+    { "WEIGHTS", Mesh::Primitive::Attribute::WEIGHTS },
+  };
+
+  constexpr auto ACCESSOR_TYPES = make_perfect_hash<16>(ACCESSOR_TYPE_KEYS);
+  constexpr auto ALPHA_MODES = make_perfect_hash<4>(ALPHA_MODE_KEYS);
+  constexpr auto CAMERA_TYPES = make_perfect_hash<4>(CAMERA_TYPE_KEYS);
+  constexpr auto MIME_TYPES = make_perfect_hash<4>(MIME_TYPE_KEYS);
+  constexpr auto PATHS = make_perfect_hash<8>(PATH_KEYS);
+  constexpr auto INTERPOLATIONS = make_perfect_hash<4>(INTERPOLATION_KEYS);
+  constexpr auto SEMANTICS = make_perfect_hash<16>(SEMANTIC_KEYS);
+  static_assert(ACCESSOR_TYPES.valid() && ALPHA_MODES.valid() && CAMERA_TYPES.valid() && MIME_TYPES.valid() &&
+                PATHS.valid() && INTERPOLATIONS.valid() && SEMANTICS.valid(), "No perfect hash seed found");
+
+  // View of the string json[key] without copying it, str is nullptr if there is no such string
+  StringView find_string(const Json &json, const char* key) {
+    StringView view;
+    auto obj = json.find(key);
+    if (obj == json.end() || !obj->is_string()) {
+      view.str = nullptr;
+      return view;
+    }
+    return StringView::get(obj->get_ref<const std::string&>());
+  }
+
+  template<typename Table>
+  uint32_t decode(const Json &json, const char* key, const Table &table, uint32_t fallback) {
+    StringView str = find_string(json, key);
+    if (!str.str)
+      return fallback;
+    return table.find(str.str, str.len, fallback);
+  }
+
+  // Fixed id in Str for the common semantics, StringPool::NONE otherwise
+  uint32_t semantic_id(Mesh::Primitive::Attribute::Semantic semantic, uint32_t set) {
+    switch(semantic) {
+      case Mesh::Primitive::Attribute::POSITION:
+        return Str::POSITION;
+      case Mesh::Primitive::Attribute::NORMAL:
+        return Str::NORMAL;
+      case Mesh::Primitive::Attribute::TANGENT:
+        return Str::TANGENT;
+      case Mesh::Primitive::Attribute::TEXCOORD:
+        return set < 4 ? Str::TEXCOORD_0 + set : StringPool::NONE;
+      case Mesh::Primitive::Attribute::COLOR:
+        return set < 2 ? Str::COLOR_0 + set : StringPool::NONE;
+      case Mesh::Primitive::Attribute::JOINTS:
+        return set < 4 ? Str::JOINTS_0 + set : StringPool::NONE;
+      case Mesh::Primitive::Attribute::WEIGHTS:
+        return set < 4 ? Str::WEIGHTS_0 + set : StringPool::NONE;
+      default:
+        return StringPool::NONE;
+    }
+  }
+  // Split "TEXCOORD_12" into its semantic and set index, and give the attribute its key id
+  void decode_semantic(StringView key, Mesh::Primitive::Attribute *attrib) {
+    using Attribute = Mesh::Primitive::Attribute;
+    const char *str = key.str;
+    size_t len = key.len;
+    size_t digits = len;
+    while(digits > 0 && str[digits - 1] >= '0' && str[digits - 1] <= '9')
+      --digits;
+
+    size_t base_len = len;
+    uint32_t set = 0;
+    if (digits < len && digits > 1 && str[digits - 1] == '_' && len - digits <= 3) {
+      base_len = digits - 1;
+      for(size_t i = digits; i < len; ++i)
+        set = set * 10 + (str[i] - '0');
+    }
+
+    uint32_t semantic = SEMANTICS.find(str, base_len, Attribute::CUSTOM);
+    // POSITION, NORMAL and TANGENT take no index, the rest need one
+    bool indexed = semantic >= Attribute::TEXCOORD;
+    if (indexed != (base_len != len) || set > UINT8_MAX)
+      semantic = Attribute::CUSTOM;
+
+    attrib->semantic = (Attribute::Semantic)semantic;
+    attrib->set = semantic == Attribute::CUSTOM ? 0 : set;
+    attrib->key = semantic_id(attrib->semantic, set);
+    if (attrib->key == StringPool::NONE)
+      attrib->key = intern(key);
+  }
+
+  // json as a T if it is a number (a bool for bool) which fits in T. Anything else is left for
+  // the caller to treat as missing, nlohmann would throw or convert out of range values.
   template<typename T>
-  static bool load_T(Json json, const char* key, T *obj) {
+  bool get_number(const Json &json, T *obj) {
+    if constexpr (std::is_same<T, bool>::value) {
+      if (!json.is_boolean())
+        return false;
+      *obj = json.get<bool>();
+      return true;
+    } else if constexpr (std::is_floating_point<T>::value) {
+      if (!json.is_number())
+        return false;
+      double d = json.get<double>();
+      // Also false for NaN
+      if (!(std::fabs(d) <= (double)std::numeric_limits<T>::max()))
+        return false;
+      *obj = (T)d;
+      return true;
+    } else {
+      using Int = typename std::conditional<std::is_enum<T>::value, std::underlying_type<T>, 
+                                            std::common_type<T>>::type::type;
+      const double min = (double)std::numeric_limits<Int>::min();
+      const double max = (double)std::numeric_limits<Int>::max();
+      if (json.is_number_unsigned()) {
+        uint64_t u = json.get<uint64_t>();
+        if (u > (uint64_t)std::numeric_limits<Int>::max())
+          return false;
+        *obj = (T)(Int)u;
+      } else if (json.is_number_integer()) {
+        int64_t i = json.get<int64_t>();
+        if (i < (int64_t)std::numeric_limits<Int>::min() || i > (int64_t)std::numeric_limits<Int>::max())
+          return false;
+        *obj = (T)(Int)i;
+      } else if (json.is_number_float()) {
+        double d = json.get<double>();
+        if (!(d >= min && d <= max) || d != std::floor(d))
+          return false;
+        *obj = (T)(Int)d;
+      } else {
+        return false;
+      }
+      return true;
+    }
+  }
+
+  template<typename T>
+  static bool load_T(const Json &json, const char* key, T *obj) {
     auto tmp = json.find(key);
     if (tmp == json.end())
       return false;
+    return get_number(tmp.value(), obj);
+  }
+  // Short strings stay inline in the StringBuffer and take nothing from the arena
+  static bool load_string(const Json &json, const char* key, StringBuffer *str) {
+    StringView tmp = find_string(json, key);
+    if (!tmp.str)
+      return false;
 
-    *obj = tmp.value();
+    if (Doc_Alloc)
+      str->init(tmp.len, Doc_Alloc);
+    else
+      str->init(tmp.len);
+    tmp.copy_to_buf(str);
     return true;
   }
-  static bool load_string(Json json, const char* key, StringBuffer *str) {
-    auto obj = json.find(key);
-    if (obj == json.end())
+  static bool load_name(const Json &json, const char* key, uint32_t *id) {
+    StringView tmp = find_string(json, key);
+    if (!tmp.str)
       return false;
 
-    std::string tmp = json.value(key, "");
-    str->init(tmp.length());
-    str->copy_here(tmp, tmp.length());
+    *id = intern(tmp);
     return true;
   }
+  // object also accepts a json object, for the attribute maps which fill an element per member
   template<typename T>
-  static bool load_array(Json json, const char* key, Array<T> *array) {
+  static bool load_array(const Json &json, const char* key, Array<T> *array, bool object = false) {
     auto obj = json.find(key);
-    if (obj == json.end())
+    if (obj == json.end() || !(obj->is_array() || (object && obj->is_object())))
       return false;
 
     size_t size = obj.value().size();
+    if (Doc_Alloc)
+      array->alloc = Doc_Alloc;
     array->init(size, 8);
     return true;
   }
   template<typename T>
-  static void fill_obj_array(Json json, const char* key, Array<T> *array) {
-    for(auto i : json[key]) {
-      T t;
-      t.fill(i);
-      array->push(t);
+  static void fill_num_array(const Json &json, const char* key, Array<T> *array) {
+    if (!load_array(json, key, array))
+      return;
+    T t;
+    for(const auto &i : json[key])
+      if (get_number(i, &t))
+        array->push(t);
+  }
+  template<typename T>
+  static void fill_obj_array(const Json &json, const char* key, Array<T> *array) {
+    for(const auto &i : find_array(json, key))
+      array->emplace_back()->fill(i);
+  }
+  static void fill_name_array(const Json &json, const char* key, Array<uint32_t> *array) {
+    for(const auto &i : find_array(json, key)) {
+      if (i.is_string())
+        array->push(intern(StringView::get(i.get_ref<const std::string&>())));
     }
   }
-  static void fill_str_array(Json json, const char* key, Array<StringBuffer> *array) {
-    for(auto i : json[key]) {
-      std::string str = i;
-      StringBuffer buf = StringBuffer::get(str.length(), str);
-      array->push(buf);
+
+  // Counting pass: an upper bound on the bytes each section allocates while filling, 
+  // the sizes mirror load_array/load_string above
+  template<typename T>
+  size_t count_array(const Json &json, const char* key) {
+    auto obj = json.find(key);
+    if (obj == json.end())
+      return 0;
+    return obj->size() * sizeof(T) + 8;
+  }
+  size_t count_string(const Json &json, const char* key) {
+    StringView str = find_string(json, key);
+    return str.len > StringBuffer::SSO_CAP ? str.len + 1 : 0;
+  }
+  // Names go to the string pool rather than the section
+  size_t count_name(const Json &json, const char* key) {
+    StringView str = find_string(json, key);
+    if (!str.str)
+      return 0;
+    ++Count_Strings;
+    Count_String_Bytes += str.len;
+    return 0;
+  }
+  size_t count_attributes(const Json &json) {
+    for(const auto &i : json.items()) {
+      ++Count_Strings;
+      Count_String_Bytes += i.key().length();
     }
+    return json.size() * sizeof(Mesh::Primitive::Attribute) + 8;
   }
 
-  static bool check_joints_weights_count(Array<Mesh::Primitive::Attribute> *attrs) {
-    uint32_t count_w = 0;
-    uint32_t count_j = 0;
-    const char* w = "WEIGHTS";
-    const char* j = "JOINTS";
-    for(int i = 0; i < attrs->len; ++i) {
-      StringBuffer str = (*attrs)[i].key;
-      int w_check = memcmp(w, str.c_str(), 7);
-      int j_check = memcmp(j, str.c_str(), 6);
-
-      if (w_check == 0)
-        ++count_w;
-      if (j_check == 0)
-        ++count_j;
+  size_t count_asset(const Json &json) {
+    const Json &asset = find_or_empty(json, "asset");
+    return count_string(asset, "version") + count_string(asset, "copyright");
+  }
+  size_t count_scenes(const Json &json) {
+    size_t size = count_array<Scene>(json, "scenes");
+    for(const auto &i : find_array(json, "scenes"))
+      size += count_name(i, "name") + count_array<int32_t>(i, "nodes");
+    return size;
+  }
+  size_t count_nodes(const Json &json) {
+    size_t size = count_array<Node>(json, "nodes");
+    for(const auto &i : find_array(json, "nodes")) {
+      size += count_name(i, "name");
+      size += count_array<float>(i, "rotation") + count_array<float>(i, "scale") + count_array<float>(i, "translation");
+      size += count_array<float>(i, "weights") + count_array<float>(i, "matrix");
+      size += count_array<int32_t>(i, "children");
     }
-    if (count_j != count_w)
-      return false;
-    else 
-      return true;
+    return size;
+  }
+  size_t count_buffers(const Json &json) {
+    size_t size = count_array<Buffer>(json, "buffers");
+    for(const auto &i : find_array(json, "buffers"))
+      size += count_string(i, "uri");
+    return size;
+  }
+  size_t count_buffer_views(const Json &json) {
+    return count_array<BufferView>(json, "bufferViews");
+  }
+  size_t count_accessors(const Json &json) {
+    size_t size = count_array<Accessor>(json, "accessors");
+    for(const auto &i : find_array(json, "accessors"))
+      size += count_array<float>(i, "max") + count_array<float>(i, "min");
+    return size;
+  }
+  size_t count_meshes(const Json &json) {
+    size_t size = count_array<Mesh>(json, "meshes");
+    for(const auto &mesh : find_array(json, "meshes")) {
+      size += count_array<Mesh::Primitive>(mesh, "primitives");
+      size += count_array<float>(mesh, "weights");
+      size += count_name(mesh, "name");
+      size += count_array<uint32_t>(mesh, "targetNames");
+      for(const auto &name : find_array(mesh, "targetNames")) {
+        if (!name.is_string())
+          continue;
+        ++Count_Strings;
+        Count_String_Bytes += name.get_ref<const std::string&>().length();
+      }
+
+      for(const auto &prim : find_array(mesh, "primitives")) {
+        auto attribs = prim.find("attributes");
+        if (attribs != prim.end())
+          size += count_attributes(*attribs);
+        size += count_array<Mesh::Primitive::Target>(prim, "targets");
+        for(const auto &target : find_array(prim, "targets"))
+          size += count_attributes(target);
+      }
+    }
+    return size;
+  }
+  size_t count_skins(const Json &json) {
+    size_t size = count_array<Skin>(json, "skins");
+    for(const auto &i : find_array(json, "skins"))
+      size += count_array<int32_t>(i, "joints");
+    return size;
+  }
+  size_t count_textures(const Json &json) {
+    return count_array<Texture>(json, "textures");
+  }
+  size_t count_images(const Json &json) {
+    size_t size = count_array<Image>(json, "images");
+    for(const auto &i : find_array(json, "images"))
+      size += count_string(i, "uri");
+    return size;
+  }
+  size_t count_samplers(const Json &json) {
+    return count_array<Sampler>(json, "samplers");
+  }
+  size_t count_materials(const Json &json) {
+    size_t size = count_array<Material>(json, "materials");
+    for(const auto &i : find_array(json, "materials")) {
+      size += count_name(i, "name") + count_array<float>(i, "emissiveFactor");
+      auto pbr = i.find("pbrMetallicRoughness");
+      if (pbr != i.end())
+        size += count_array<float>(*pbr, "baseColorFactor");
+    }
+    return size;
   }
+  size_t count_cameras(const Json &json) {
+    size_t size = count_array<Camera>(json, "cameras");
+    for(const auto &i : find_array(json, "cameras"))
+      size += count_name(i, "name");
+    return size;
+  }
+  size_t count_animations(const Json &json) {
+    size_t size = count_array<Animation>(json, "animations");
+    for(const auto &i : find_array(json, "animations")) {
+      size += count_name(i, "name");
+      size += count_array<Animation::Channel>(i, "channels") + count_array<Animation::Sampler>(i, "samplers");
+    }
+    return size;
+  }
+}
+
+size_t glTF::count(const Json &json, size_t section_bytes[SECTION_COUNT]) {
+  size_t (*counters[SECTION_COUNT])(const Json&) = {
+    count_asset, count_scenes, count_nodes, count_buffers, count_buffer_views, 
+    count_accessors, count_meshes, count_skins, count_textures, count_images, 
+    count_samplers, count_materials, count_cameras, count_animations,
+  };
+  size_t total = 0;
+  Count_Strings = Str::COUNT;
+  Count_String_Bytes = 0;
+  for(uint32_t i = 0; i < Str::COUNT; ++i)
+    Count_String_Bytes += strlen(KNOWN_STRINGS[i]);
+
+  for(uint32_t i = 0; i < SECTION_COUNT; ++i) {
+    size_t size = counters[i](json);
+    if (section_bytes)
+      section_bytes[i] = size;
+    total += size;
+  }
+  return total + StringPool::size_for(Count_Strings, Count_String_Bytes);
+}
+
+namespace {
+  // Sections with more elements than this are split into ranges filled by separate tasks
+  constexpr size_t SPLIT_MIN = 256;
+  constexpr uint32_t MAX_SPLIT = 8;
+  constexpr uint32_t MAX_FILL_TASKS = glTF::SECTION_COUNT + 2 * (MAX_SPLIT - 1);
+  // Alignment padding and block header of each task's slice of the arena
+  constexpr size_t TASK_SLACK = 128;
+
+  // A whole section, or elements [begin, end) of a split section
+  struct FillTask {
+    glTF *gltf;
+    const Json *json;
+    glTF::Section section;
+    bool split = false;
+    size_t begin = 0;
+    size_t end = 0;
+    LinearAllocator arena;
+    std::mutex *strings_lock;
+  };
+
+  template<typename T>
+  void fill_range(const Json &json, const char* key, Array<T> *array, size_t begin, size_t end) {
+    const Json &items = find_array(json, key);
+    for(size_t i = begin; i < end; ++i)
+      array->mem[i].fill(items[i]);
+  }
+  // Allocate and default construct the elements, so ranges of them can be filled independently
+  template<typename T>
+  void prepare_split(const Json &json, const char* key, Array<T> *array) {
+    if (!load_array(json, key, array))
+      return;
+    while(array->len < array->cap)
+      array->emplace_back();
+  }
+
+  void fill_section(glTF *gltf, glTF::Section section, const Json &json) {
+    switch(section) {
+      case glTF::ASSET:        gltf->asset.fill(json); break;
+      case glTF::SCENES:       gltf->scenes.fill(json); break;
+      case glTF::NODES:        gltf->nodes.fill(json); break;
+      case glTF::BUFFERS:      gltf->buffers.fill(json); break;
+      case glTF::BUFFER_VIEWS: gltf->buffer_views.fill(json); break;
+      case glTF::ACCESSORS:    gltf->accessors.fill(json); break;
+      case glTF::MESHES:       gltf->meshes.fill(json); break;
+      case glTF::SKINS:        gltf->skins.fill(json); break;
+      case glTF::TEXTURES:     gltf->textures.fill(json); break;
+      case glTF::IMAGES:       gltf->images.fill(json); break;
+      case glTF::SAMPLERS:     gltf->samplers.fill(json); break;
+      case glTF::MATERIALS:    gltf->materials.fill(json); break;
+      case glTF::CAMERAS:      gltf->cameras.fill(json); break;
+      case glTF::ANIMATIONS:   gltf->animations.fill(json); break;
+      default: break;
+    }
+  }
+
+  void fill_task(void *arg) {
+    FillTask *task = (FillTask*)arg;
+    Allocator *prev = Doc_Alloc;
+    StringPool *prev_strings = Doc_Strings;
+    std::mutex *prev_lock = Doc_Strings_Lock;
+    Doc_Alloc = &task->arena;
+    Doc_Strings = &task->gltf->strings;
+    Doc_Strings_Lock = task->strings_lock;
+
+    if (!task->split)
+      fill_section(task->gltf, task->section, *task->json);
+    else if (task->section == glTF::NODES)
+      fill_range(*task->json, "nodes", &task->gltf->nodes.nodes, task->begin, task->end);
+    else if (task->section == glTF::ACCESSORS)
+      fill_range(*task->json, "accessors", &task->gltf->accessors.accessors, task->begin, task->end);
+
+    Doc_Alloc = prev;
+    Doc_Strings = prev_strings;
+    Doc_Strings_Lock = prev_lock;
+  }
+
+  void init_task_arena(FillTask *task, LinearAllocator *arena, size_t size) {
+    size += TASK_SLACK;
+    void *buffer = arena->allocate(size, 16);
+    task->arena.init(buffer, size, 4096);
+  }
+}
+
+void glTF::fill(const Json &json, ThreadPool *pool) {
+  // One allocation for the whole document: everything filled below comes out of arena
+  size_t section_bytes[SECTION_COUNT];
+  size_t size = count(json, section_bytes) + MAX_FILL_TASKS * TASK_SLACK;
+  // Refilling reuses the arena when it is big enough
+  if (arena.mem && arena.head->cap >= size) {
+    clear();
+  } else {
+    if (arena.mem)
+      kill();
+    arena.init(size);
+  }
+  Allocator *prev = Doc_Alloc;
+  StringPool *prev_strings = Doc_Strings;
+  Doc_Alloc = &arena;
+  Doc_Strings = &strings;
+
+  strings.init(Count_Strings, Count_String_Bytes, &arena);
+  for(uint32_t i = 0; i < Str::COUNT; ++i)
+    strings.intern(KNOWN_STRINGS[i]);
+
+  std::mutex strings_lock;
+  FillTask tasks[MAX_FILL_TASKS];
+  uint32_t task_count = 0;
+  uint32_t max_split = pool ? pool->thread_count() : 1;
+  if (max_split > MAX_SPLIT)
+    max_split = MAX_SPLIT;
+
+  for(uint32_t i = 0; i < SECTION_COUNT; ++i) {
+    Section section = (Section)i;
+    size_t count = 0;
+    size_t array_bytes = 0;
+    if (section == NODES) {
+      count = find_array(json, "nodes").size();
+      array_bytes = count * sizeof(Node) + 8;
+    } else if (section == ACCESSORS) {
+      count = find_array(json, "accessors").size();
+      array_bytes = count * sizeof(Accessor) + 8;
+    }
+    size_t split = count / SPLIT_MIN;
+    if (split > max_split)
+      split = max_split;
+
+    if (split < 2) {
+      FillTask *task = &tasks[task_count++];
+      task->section = section;
+      init_task_arena(task, &arena, section_bytes[i]);
+      continue;
+    }
+
+    // The element array comes out of the main arena here, the elements' contents out of the ranges' slices
+    if (section == NODES)
+      prepare_split(json, "nodes", &nodes.nodes);
+    else
+      prepare_split(json, "accessors", &accessors.accessors);
+    size_t content_bytes = section_bytes[i] - array_bytes;
+    for(size_t r = 0; r < split; ++r) {
+      FillTask *task = &tasks[task_count++];
+      task->section = section;
+      task->split = true;
+      task->begin = count * r / split;
+      task->end = count * (r + 1) / split;
+      init_task_arena(task, &arena, content_bytes * (task->end - task->begin) / count);
+    }
+  }
+
+  ThreadPool::Counter counter;
+  for(uint32_t i = 0; i < task_count; ++i) {
+    tasks[i].gltf = this;
+    tasks[i].json = &json;
+    tasks[i].strings_lock = pool ? &strings_lock : nullptr;
+    if (pool)
+      pool->submit(fill_task, &tasks[i], &counter);
+    else
+      fill_task(&tasks[i]);
+  }
+  if (pool)
+    pool->wait(&counter);
+
+  // Anything which overflowed a task's slice is freed with the document
+  for(uint32_t i = 0; i < task_count; ++i)
+    arena.adopt(&tasks[i].arena);
+
+  Doc_Alloc = prev;
+  Doc_Strings = prev_strings;
+}
+namespace {
+  // Arena block size of piecewise filled documents
+  constexpr size_t PIECE_BLOCK = 16 * 1024;
+
+  // Points this thread's fill state at a piecewise filled document
+  struct PieceScope {
+    Allocator *prev;
+    StringPool *prev_strings;
+    std::mutex *prev_lock;
+
+    PieceScope(glTF *gltf) {
+      if (!gltf->arena.mem) {
+        gltf->arena.init(PIECE_BLOCK);
+        gltf->strings.init(Str::COUNT * 2, PIECE_BLOCK / 16, &gltf->arena);
+        for(uint32_t i = 0; i < Str::COUNT; ++i)
+          gltf->strings.intern(KNOWN_STRINGS[i]);
+      }
+      prev = Doc_Alloc;
+      prev_strings = Doc_Strings;
+      prev_lock = Doc_Strings_Lock;
+      Doc_Alloc = &gltf->arena;
+      Doc_Strings = &gltf->strings;
+      Doc_Strings_Lock = nullptr;
+    }
+    ~PieceScope() {
+      Doc_Alloc = prev;
+      Doc_Strings = prev_strings;
+      Doc_Strings_Lock = prev_lock;
+    }
+  };
+
+  template<typename T>
+  void reserve_elements(Array<T> *array, size_t count) {
+    array->alloc = Doc_Alloc;
+    array->init(count ? count : 1, 8);
+    while(array->len < count)
+      array->emplace_back();
+  }
+  template<typename T>
+  void fill_one(Array<T> *array, const Json &json, size_t index) {
+    ABORT(index < array->len, "glTF::fill_element: section not reserved");
+    array->mem[index] = T();
+    array->mem[index].fill(json);
+  }
+}
+
+void glTF::fill_section(const Json &json, Section section) {
+  PieceScope scope(this);
+  ::Sol::glTF::fill_section(this, section, json);
+}
+void glTF::reserve_section(Section section, size_t count) {
+  PieceScope scope(this);
+  switch(section) {
+    case SCENES:       reserve_elements(&scenes.scenes, count); break;
+    case NODES:        reserve_elements(&nodes.nodes, count); break;
+    case BUFFERS:      reserve_elements(&buffers.buffers, count); break;
+    case BUFFER_VIEWS: reserve_elements(&buffer_views.views, count); break;
+    case ACCESSORS:    reserve_elements(&accessors.accessors, count); break;
+    case MESHES:       reserve_elements(&meshes.meshes, count); break;
+    case SKINS:        reserve_elements(&skins.skins, count); break;
+    case TEXTURES:     reserve_elements(&textures.textures, count); break;
+    case IMAGES:       reserve_elements(&images.images, count); break;
+    case SAMPLERS:     reserve_elements(&samplers.samplers, count); break;
+    case MATERIALS:    reserve_elements(&materials.materials, count); break;
+    case CAMERAS:      reserve_elements(&cameras.cameras, count); break;
+    case ANIMATIONS:   reserve_elements(&animations.animations, count); break;
+    default: ABORT(false, "glTF::reserve_section: not an array section");
+  }
+}
+void glTF::fill_element(const Json &json, Section section, size_t index) {
+  PieceScope scope(this);
+  switch(section) {
+    case SCENES:       fill_one(&scenes.scenes, json, index); break;
+    case NODES:        fill_one(&nodes.nodes, json, index); break;
+    case BUFFERS:      fill_one(&buffers.buffers, json, index); break;
+    case BUFFER_VIEWS: fill_one(&buffer_views.views, json, index); break;
+    case ACCESSORS:    fill_one(&accessors.accessors, json, index); break;
+    case MESHES:       fill_one(&meshes.meshes, json, index); break;
+    case SKINS:        fill_one(&skins.skins, json, index); break;
+    case TEXTURES:     fill_one(&textures.textures, json, index); break;
+    case IMAGES:       fill_one(&images.images, json, index); break;
+    case SAMPLERS:     fill_one(&samplers.samplers, json, index); break;
+    case MATERIALS:    fill_one(&materials.materials, json, index); break;
+    case CAMERAS:      fill_one(&cameras.cameras, json, index); break;
+    case ANIMATIONS:   fill_one(&animations.animations, json, index); break;
+    default: ABORT(false, "glTF::fill_element: not an array section");
+  }
+}
+
+namespace {
+  // Everything here pointed into the arena
+  void reset_sections(glTF *gltf) {
+    gltf->asset = Asset();
+    gltf->scenes = Scenes();
+    gltf->nodes = Nodes();
+    gltf->buffers = Buffers();
+    gltf->buffer_views = BufferViews();
+    gltf->accessors = Accessors();
+    gltf->meshes = Meshes();
+    gltf->skins = Skins();
+    gltf->textures = Textures();
+    gltf->images = Images();
+    gltf->samplers = Samplers();
+    gltf->materials = Materials();
+    gltf->cameras = Cameras();
+    gltf->animations = Animations();
+    gltf->strings = StringPool();
+  }
+}
+
+void glTF::kill() {
+  free_buffers();
+  if (arena.mem)
+    arena.kill();
+  reset_sections(this);
+}
+void glTF::clear() {
+  free_buffers();
+  if (arena.mem)
+    arena.free();
+  reset_sections(this);
 }
 
 // Asset /////////////////////////
-void Asset::fill(Json json) {
+void Asset::fill(const Json &json) {
+  // A missing asset or version is reported by validate()
   auto asset = json.find("asset");
-  ABORT(asset != json.end(), "glTF has no 'asset' obj");
+  if (asset == json.end())
+    return;
 
   load_string(asset.value(), "version", &version);
-  ABORT(version.str, "glTF asset has no 'version' field");
 
   load_string(asset.value(), "copyright", &copyright);
 }
 
 // Scenes ///////////////////////
-void Scenes::fill(Json json) {
+void Scenes::fill(const Json &json) {
   load_T(json, "scene", &scene);
   load_array(json, "scenes", &scenes);
   fill_obj_array(json, "scenes", &scenes);
 }
-void Scene::fill(Json json) {
-  load_string(json, "name", &name);
-  load_array(json, "nodes", &nodes);
-  for(auto i : json["nodes"]) 
-    nodes.push(i);
+void Scene::fill(const Json &json) {
+  load_name(json, "name", &name);
+  fill_num_array(json, "nodes", &nodes);
 }
 
 // Nodes ////////////////////////
-void Nodes::fill(Json json) {
+void Nodes::fill(const Json &json) {
   load_array(json, "nodes", &nodes);
   fill_obj_array(json, "nodes", &nodes);
 }
-void Node::fill(Json json) {
-  load_string(json, "name", &name);
+void Node::fill(const Json &json) {
+  load_name(json, "name", &name);
   load_T(json, "mesh", &mesh);
   load_T(json, "camera", &camera);
   load_T(json, "skin", &skin);
 
-  load_array(json, "rotation", &rotation);
-  for(auto i : json["rotation"])
-    rotation.push(i);
-  load_array(json, "scale", &scale);
-  for(auto i : json["scale"])
-    scale.push(i);
-  load_array(json, "translation", &translation);
-  for(auto i : json["translation"])
-    translation.push(i);
-  load_array(json, "weights", &weights);
-  for(auto i : json["weights"])
-    weights.push(i);
-
-  load_array(json, "matrix", &matrix);
-  for(auto i : json["matrix"])
-    matrix.push(i);
-
-  load_array(json, "children", &children);
-  for(auto i : json["children"])
-    children.push(i);
+  fill_num_array(json, "rotation", &rotation);
+  fill_num_array(json, "scale", &scale);
+  fill_num_array(json, "translation", &translation);
+  fill_num_array(json, "weights", &weights);
+  fill_num_array(json, "matrix", &matrix);
+  fill_num_array(json, "children", &children);
 }
 
 // Buffers & BufferViews //////////////////////
-void Buffers::fill(Json json) {
+void Buffers::fill(const Json &json) {
   load_array(json, "buffers", &buffers);
   fill_obj_array(json, "buffers", &buffers);
 }
-void Buffer::fill(Json json) {
+void Buffer::fill(const Json &json) {
   load_T(json, "byteLength", &byte_length);
   load_string(json, "uri", &uri);
 }
 
-void BufferViews::fill(Json json) {
+void BufferViews::fill(const Json &json) {
   load_array(json, "bufferViews", &views);
   fill_obj_array(json, "bufferViews", &views);
 }
-void BufferView::fill(Json json) {
+void BufferView::fill(const Json &json) {
   load_T(json, "buffer", &buffer);
   load_T(json, "byteLength", &byte_length);
   load_T(json, "byteOffset", &byte_offset);
@@ -196,167 +1099,133 @@ void BufferView::fill(Json json) {
 }
 
 // Accessors ///////////////////////
-void Accessors::fill(Json json) {
+void Accessors::fill(const Json &json) {
   load_array(json, "accessors", &accessors);
   fill_obj_array(json, "accessors", &accessors);
 }
-void Accessor::fill(Json json) {
-  load_array(json, "max", &max);
-  for(auto i : json["max"]) 
-    max.push(i);
-  load_array(json, "min", &min);
-  for(auto i : json["min"])
-    min.push(i);
-
-  StringBuffer tmp;
-  load_string(json, "type", &tmp);
-  if(strcmp("SCALAR", tmp.c_str()) == 0)
-    type = SCALAR;
-  if(strcmp("VEC2", tmp.c_str()) == 0)
-    type = VEC2;
-  if(strcmp("VEC3", tmp.c_str()) == 0)
-    type = VEC3;
-  if(strcmp("VEC4", tmp.c_str()) == 0)
-    type = VEC4;
-  if(strcmp("MAT2", tmp.c_str()) == 0)
-    type = MAT2;
-  if(strcmp("MAT3", tmp.c_str()) == 0)
-    type = MAT3;
-  if(strcmp("MAT4", tmp.c_str()) == 0)
-    type = MAT4;
+void Accessor::fill(const Json &json) {
+  fill_num_array(json, "max", &max);
+  fill_num_array(json, "min", &min);
+
+  type = (Type)decode(json, "type", ACCESSOR_TYPES, type);
 
   load_T(json, "componentType", &component_type);
   load_T(json, "byteOffset", &byte_offset);
   load_T(json, "count", &count);
   load_T(json, "bufferView", &buffer_view);
 
-  Json json_sparse;
-  if (load_T(json, "sparse", &json_sparse)) {
-    sparse.fill(json_sparse);
+  auto json_sparse = json.find("sparse");
+  if (json_sparse != json.end()) {
+    sparse.fill(*json_sparse);
   }
 }
-void Accessor::Sparse::fill(Json json) {
+void Accessor::Sparse::fill(const Json &json) {
   load_T(json, "count", &count);
   
-  Json json_indices;
-  if (load_T(json, "indices", &json_indices)) {
-    indices.fill(json_indices);
+  auto json_indices = json.find("indices");
+  if (json_indices != json.end()) {
+    indices.fill(*json_indices);
   }
-  Json json_values;
-  if (load_T(json, "values", &json_values)) {
-    values.fill(json_values);
+  auto json_values = json.find("values");
+  if (json_values != json.end()) {
+    values.fill(*json_values);
   }
 }
-void Accessor::Sparse::Indices::fill(Json json) {
+void Accessor::Sparse::Indices::fill(const Json &json) {
   load_T(json, "bufferView", &buffer_view);
   load_T(json, "byteOffset", &byte_offset);
   load_T(json, "componentType", &component_type);
 }
-void Accessor::Sparse::Values::fill(Json json) {
+void Accessor::Sparse::Values::fill(const Json &json) {
   load_T(json, "bufferView", &buffer_view);
   load_T(json, "byteOffset", &byte_offset);
 }
 
 // Meshes ////////////////////
-void Meshes::fill(Json json) {
+void Meshes::fill(const Json &json) {
   load_array(json, "meshes", &meshes);
-  for(auto i : json["meshes"]) {
-    Mesh mesh;
-    mesh.fill(i);
-    meshes.push(mesh);
-  }
+  fill_obj_array(json, "meshes", &meshes);
 }
-void Mesh::fill(Json json) {
+void Mesh::fill(const Json &json) {
+  load_name(json, "name", &name);
   load_array(json, "primitives", &primitives);  
   fill_obj_array(json, "primitives", &primitives);  
 
-  load_array(json, "weights", &weights);
-  for(auto i : json["weights"])
-    weights.push(i);
+  fill_num_array(json, "weights", &weights);
 
   extras.fill(json);
 }
-void Mesh::Primitive::fill(Json json) {
+void Mesh::Primitive::fill(const Json &json) {
   load_T(json, "indices", &indices);
   load_T(json, "material", &material);
   load_T(json, "mode", &mode);
 
-  if (load_array(json, "attributes", &attributes))
+  if (load_array(json, "attributes", &attributes, true))
     fill_attrib_array(json["attributes"], &attributes);
   if (load_array(json, "targets", &targets))
     fill_obj_array(json, "targets", &targets);
-
-  bool check = check_joints_weights_count(&attributes);
-  ABORT(check, "Primitive JOINTS_n count != WEIGHTS_n count");
 }
 
-void Mesh::Primitive::Target::fill(Json json) {
+void Mesh::Primitive::Target::fill(const Json &json) {
+  if (!json.is_object())
+    return;
+  if (Doc_Alloc)
+    attributes.alloc = Doc_Alloc;
   attributes.init(json.size(), 8);
   if (attributes.cap)
     fill_attrib_array(json, &attributes);
 }
-void Mesh::Primitive::fill_attrib_array(Json json, Array<Attribute> *attributes) {
-  for(auto i : json.items()) {
-    Attribute attrib;
-    std::string str = i.key();
-    attrib.key = StringBuffer::get(str.length(), str);
-    attrib.accessor = i.value();
-    attributes->push(attrib);
+void Mesh::Primitive::fill_attrib_array(const Json &json, Array<Attribute> *attributes) {
+  for(const auto &i : json.items()) {
+    Attribute *attrib = attributes->emplace_back();
+    decode_semantic(StringView::get(i.key()), attrib);
+    get_number(i.value(), &attrib->accessor);
   }
 }
-void Mesh::Extras::fill(Json json) {
+void Mesh::Extras::fill(const Json &json) {
   load_array(json, "targetNames", &target_names);
-  fill_str_array(json, "targetNames", &target_names);
+  fill_name_array(json, "targetNames", &target_names);
 }
 
 // Skins ////////////////////
-void Skins::fill(Json json) {
+void Skins::fill(const Json &json) {
   load_array(json, "skins", &skins);
   fill_obj_array(json, "skins", &skins);
 }
-void Skin::fill(Json json) {
+void Skin::fill(const Json &json) {
   load_T(json, "inverseBindMatrices", &i_bind_matrices);
   load_T(json, "skeleton", &skeleton);
-  load_array(json, "joints", &joints);
-  for(auto i : json["joints"])
-    joints.push(i);
+  fill_num_array(json, "joints", &joints);
 }
 
 // Textures ////////////////
-void Textures::fill(Json json) {
+void Textures::fill(const Json &json) {
   load_array(json, "textures", &textures);
   fill_obj_array(json, "textures", &textures);
 }
-void Texture::fill(Json json) {
+void Texture::fill(const Json &json) {
   load_T(json, "sampler", &sampler);
   load_T(json, "source", &source);
 }
 
 // Images ////////////////
-void Images::fill(Json json) {
+void Images::fill(const Json &json) {
   load_array(json, "images", &images);
   fill_obj_array(json, "images", &images);
 }
-void Image::fill(Json json) {
+void Image::fill(const Json &json) {
   load_string(json, "uri", &uri);
   load_T(json, "bufferView", &buffer_view);
-  StringBuffer tmp;
-  load_string(json, "mimeType", &tmp);
 
-  // NOTE:: This used to SEGFAULT as c_str() was being called on a potentially uninitialised StringBuffer 
-  // (load_string returns before StringBuffer::init() when the key is not found);
-  if (strcmp(tmp.c_str(), "image/jpeg") == 0)
-    mime_type = JPG;
-  if (strcmp(tmp.c_str(), "image/png") == 0)
-    mime_type = PNG;
+  mime_type = (MimeType)decode(json, "mimeType", MIME_TYPES, mime_type);
 }
 
 // Samplers //////////////
-void Samplers::fill(Json json) {
+void Samplers::fill(const Json &json) {
   load_array(json, "samplers", &samplers);
   fill_obj_array(json, "samplers", &samplers);
 }
-void Sampler::fill(Json json) {
+void Sampler::fill(const Json &json) {
   load_T(json, "magFilter", &mag_filter);
   load_T(json, "minFilter", &min_filter);
   load_T(json, "wrapS", &wrap_s);
@@ -364,75 +1233,57 @@ void Sampler::fill(Json json) {
 }
 
 // Materials ///////////////////
-void Materials::fill(Json json) {
+void Materials::fill(const Json &json) {
   load_array(json, "materials", &materials);
   fill_obj_array(json, "materials", &materials);
 }
-void Material::fill(Json json) {
-  load_string(json, "name", &name);
+void Material::fill(const Json &json) {
+  load_name(json, "name", &name);
   load_T(json, "alphaCutoff", &alpha_cutoff);
   load_T(json, "doubleSided", &double_sided);
-  load_array(json, "emissiveFactor", &emissive_factor);
-  for(auto i : json["emissiveFactor"])
-    emissive_factor.push(i);
-
-  StringBuffer tmp;
-  load_string(json, "alphaMode", &tmp);
-  if (strcmp(tmp.c_str(), "OPAQUE") == 0)
-    alpha_mode = OPAQUE;
-  if (strcmp(tmp.c_str(), "MASK") == 0)
-    alpha_mode = MASK;
-  if (strcmp(tmp.c_str(), "BLEND") == 0)
-    alpha_mode = BLEND;
+  fill_num_array(json, "emissiveFactor", &emissive_factor);
+
+  alpha_mode = (AlphaMode)decode(json, "alphaMode", ALPHA_MODES, alpha_mode);
 
   pbr_metallic_roughness.fill(json);
   normal_texture.fill_tex(json, "normalTexture");
   emissive_texture.fill_tex(json, "emissiveTexture");
   occlusion_texture.fill_tex(json, "occlusionTexture");
 }
-void Material::MatTexture::fill_tex(Json json, const char* key) {
+void Material::MatTexture::fill_tex(const Json &json, const char* key) {
   auto tmp = json.find(key);
   if (tmp == json.end())
     return;
-  else
-    json = tmp.value();
+  const Json &tex = tmp.value();
 
-  load_T(json, "scale", &scale);
-  load_T(json, "strength", &scale);
-  load_T(json, "index", &index);
-  load_T(json, "texCoord", &tex_coord);
+  load_T(tex, "scale", &scale);
+  load_T(tex, "strength", &scale);
+  load_T(tex, "index", &index);
+  load_T(tex, "texCoord", &tex_coord);
 }
-void Material::PbrMetallicRoughness::fill(Json json) {
+void Material::PbrMetallicRoughness::fill(const Json &json) {
   auto tmp = json.find("pbrMetallicRoughness");
   if (tmp == json.end())
     return;
-  else
-    json = tmp.value();
+  const Json &pbr = tmp.value();
 
-  load_array(json, "baseColorFactor", &base_color_factor);
-  for(auto i : json["baseColorFactor"])
-    base_color_factor.push(i);
-  base_color_texture.fill_tex(json, "baseColorTexture"); 
-  metallic_roughness_texture.fill_tex(json, "metallicRoughnessTexture"); 
-  load_T(json, "metallicFactor", &metallic_factor);
-  load_T(json, "roughnessFactor", &roughness_factor);
+  fill_num_array(pbr, "baseColorFactor", &base_color_factor);
+  base_color_texture.fill_tex(pbr, "baseColorTexture"); 
+  metallic_roughness_texture.fill_tex(pbr, "metallicRoughnessTexture"); 
+  load_T(pbr, "metallicFactor", &metallic_factor);
+  load_T(pbr, "roughnessFactor", &roughness_factor);
 }
 
 // Cameras /////////////////////
-void Cameras::fill(Json json) {
+void Cameras::fill(const Json &json) {
   load_array(json, "cameras", &cameras);
   fill_obj_array(json, "cameras", &cameras);
 }
-void Camera::fill(Json json) {
-  load_string(json, "name", &name);
+void Camera::fill(const Json &json) {
+  load_name(json, "name", &name);
 
-  StringBuffer tmp;
-  load_string(json, "type", &tmp);
-  if (strcmp(tmp.c_str(), "perspective") == 0)
-    type = PERSPECTIVE;
-  if (strcmp(tmp.c_str(), "orthographic") == 0)
-    type = ORTHO;
-  ABORT(type != UNKNOWN, "glTF model camera type must be defined");
+  // Missing types and fields are left for validate() to report
+  type = (Type)decode(json, "type", CAMERA_TYPES, type);
 
   load_T(json, "aspectRatio", &aspect_ratio);
   load_T(json, "yfov", &yfov);
@@ -442,67 +1293,46 @@ void Camera::fill(Json json) {
   load_T(json, "znear", &znear);
 
   if (type == ORTHO) {
-    load_T(json["orthographic"], "xmag", &xmag);
-    load_T(json["orthographic"], "ymag", &ymag);
-    load_T(json["orthographic"], "zfar", &zfar);
-    load_T(json["orthographic"], "znear", &znear);
-
-    ABORT(xmag != INVALID_FLOAT, "glTF model Ortho camera must have XMAG defined");
-    ABORT(ymag != INVALID_FLOAT, "glTF model Ortho camera must have YMAG defined");
-    ABORT(zfar != INVALID_FLOAT, "glTF model Ortho camera must have ZFAR defined");
-    ABORT(znear != INVALID_FLOAT, "glTF model Ortho camera must have ZNEAR defined");
+    const Json &ortho = find_or_empty(json, "orthographic");
+    load_T(ortho, "xmag", &xmag);
+    load_T(ortho, "ymag", &ymag);
+    load_T(ortho, "zfar", &zfar);
+    load_T(ortho, "znear", &znear);
   }
   if (type == PERSPECTIVE) {
-    load_T(json["perspective"], "aspectRatio", &aspect_ratio);
-    load_T(json["perspective"], "yfov", &yfov);
-    load_T(json["perspective"], "zfar", &zfar);
-    load_T(json["perspective"], "znear", &znear);
-
-    ABORT(yfov != INVALID_FLOAT, "glTF model Perspective camera must have YFOV defined");
-    ABORT(znear != INVALID_FLOAT, "glTF model Perspective camera must have ZNEAR defined");
+    const Json &perspective = find_or_empty(json, "perspective");
+    load_T(perspective, "aspectRatio", &aspect_ratio);
+    load_T(perspective, "yfov", &yfov);
+    load_T(perspective, "zfar", &zfar);
+    load_T(perspective, "znear", &znear);
   }
 }
 
 // Animations ////////////////////
-void Animations::fill(Json json) {
+void Animations::fill(const Json &json) {
   load_array(json, "animations", &animations);
   fill_obj_array(json, "animations", &animations);
 }
-void Animation::fill(Json json) {
-  load_string(json, "name", &name);
+void Animation::fill(const Json &json) {
+  load_name(json, "name", &name);
 
   load_array(json, "channels", &channels);
   fill_obj_array(json, "channels", &channels);
   load_array(json, "samplers", &samplers);
   fill_obj_array(json, "samplers", &samplers);
 }
-void Animation::Channel::fill(Json json) {
+void Animation::Channel::fill(const Json &json) {
   load_T(json, "sampler", &sampler);
-  load_T(json["target"], "node", &target.node);
-
-  StringBuffer tmp;
-  load_string(json["target"], "path", &tmp);
-  if (strcmp(tmp.c_str(), "rotation") == 0)
-    target.path = Target::ROTATION;
-  if (strcmp(tmp.c_str(), "translation") == 0)
-    target.path = Target::TRANSLATION;
-  if (strcmp(tmp.c_str(), "scale") == 0)
-    target.path = Target::SCALE;
-  if (strcmp(tmp.c_str(), "weights") == 0)
-    target.path = Target::WEIGHTS;
-}
-void Animation::Sampler::fill(Json json) {
+  const Json &json_target = find_or_empty(json, "target");
+  load_T(json_target, "node", &target.node);
+
+  target.path = (Target::Path)decode(json_target, "path", PATHS, target.path);
+}
+void Animation::Sampler::fill(const Json &json) {
   load_T(json, "input", &input);
   load_T(json, "output", &output);
 
-  StringBuffer tmp;
-  load_string(json, "interpolation", &tmp);
-  if(strcmp(tmp.c_str(), "LINEAR") == 0)
-    interpolation = LINEAR;
-  if(strcmp(tmp.c_str(), "STEP") == 0)
-    interpolation = STEP;
-  if(strcmp(tmp.c_str(), "CUBICSPLINE") == 0)
-    interpolation = CUBICSPLINE;
+  interpolation = (Interpolation)decode(json, "interpolation", INTERPOLATIONS, interpolation);
 }
 
 } // namespace glTF
@@ -7,13 +7,45 @@
 
 #include <cstdint>
 #include <limits>
+#include <string>
 
 namespace Sol {
+
+struct ThreadPool;
+struct FileReader;
+
 namespace glTF {
 
 using Json = nlohmann::json;
 
-bool read_json(const char* file, Json *json);
+// Bounds on a document from an untrusted source. The text is checked before it is parsed, so a
+// crafted file fails after one pass over its bytes rather than once the parser has allocated for it.
+struct Limits {
+  size_t max_bytes = 256 * 1024 * 1024;
+  uint32_t max_depth = 64; // of nested arrays and objects
+  size_t max_elements = 16 * 1024 * 1024; // values in arrays and objects over the whole document
+};
+
+// Neither throws: false, leaving json discarded, if the text is not json or breaks a limit
+bool read_json(const char* file, Json *json, const Limits &limits = Limits());
+bool parse_json(const char *text, size_t size, Json *json, const Limits &limits = Limits());
+
+// The chunks of a binary glTF, pointing into the file's bytes
+struct Glb {
+  const char *json = nullptr;
+  uint32_t json_size = 0;
+  const uint8_t *bin = nullptr; // nullptr without a BIN chunk
+  uint32_t bin_size = 0;
+};
+// false unless data is a version 2 glb with its JSON chunk first and every length inside size.
+// Chunks of unknown type are skipped, as the spec asks.
+bool parse_glb(const uint8_t *data, size_t size, Glb *glb);
+
+// uris are URI references, "my%20mesh.bin" names the file "my mesh.bin"
+std::string decode_uri(const char *uri);
+// The same directory reached through "..", "." or a symlink compares equal once canonical.
+// Directories which do not exist (yet) are kept as given.
+std::string canonical_dir(const std::string &dir);
 
 extern const int32_t INVALID_INDEX;
 extern const uint32_t INVALID_COUNT;
@@ -23,26 +55,40 @@ extern const uint8_t JPG_BYTE_PATTERN[3];
 extern const int32_t NEAREST_FALLBACK;
 extern const int32_t LINEAR_FALLBACK;
 
+// Strings interned at these ids in every document's glTF::strings, in this order, so the common 
+// attribute keys compare as integers
+namespace Str {
+enum : uint32_t {
+  POSITION, NORMAL, TANGENT, 
+  TEXCOORD_0, TEXCOORD_1, TEXCOORD_2, TEXCOORD_3, 
+  COLOR_0, COLOR_1, 
+  JOINTS_0, JOINTS_1, JOINTS_2, JOINTS_3, 
+  WEIGHTS_0, WEIGHTS_1, WEIGHTS_2, WEIGHTS_3,
+  COUNT,
+};
+} // namespace Str
+extern const char* KNOWN_STRINGS[Str::COUNT];
+
 // Asset
 struct Asset {
   // TODO:: Add minVerison support
   StringBuffer version;  
   StringBuffer copyright;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Scenes
 struct Scene {
   Array<int32_t> nodes;
-  StringBuffer name;
+  uint32_t name = StringPool::NONE; // id in glTF::strings
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Scenes {
   Array<Scene> scenes;
   int32_t scene = INVALID_INDEX;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Nodes
@@ -54,27 +100,29 @@ struct Node {
   Array<float> weights;
 
   Array<int32_t> children;
-  StringBuffer name;
+  uint32_t name = StringPool::NONE; // id in glTF::strings
   int32_t mesh = INVALID_INDEX;
   int32_t skin = INVALID_INDEX;
   int32_t camera = INVALID_INDEX;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Nodes {
   Array<Node> nodes;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Buffers & BufferViews
 struct Buffer {
   uint32_t byte_length;
   StringBuffer uri;
-  void fill(Json json);
+  // Loaded bytes, nullptr until glTF::load_buffers() 
+  uint8_t *data = nullptr;
+  void fill(const Json &json);
 };
 struct Buffers {
   Array<Buffer> buffers;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct BufferView {
   enum Target {
@@ -88,11 +136,11 @@ struct BufferView {
   int32_t buffer = INVALID_INDEX;
   Target target = NONE;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct BufferViews {
   Array<BufferView> views;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Accessors
@@ -121,17 +169,17 @@ struct Accessor {
       uint32_t byte_offset = INVALID_COUNT;
       int32_t buffer_view = INVALID_INDEX;
       ComponentType component_type = NONE;
-      void fill(Json json);
+      void fill(const Json &json);
     };
     struct Values {
       uint32_t byte_offset = INVALID_COUNT;
       int32_t buffer_view = INVALID_INDEX;
-      void fill(Json json);
+      void fill(const Json &json);
     };
     Indices indices;
     Values values;
     uint32_t count = INVALID_COUNT;
-    void fill(Json json);
+    void fill(const Json &json);
   };
 
   Sparse sparse;
@@ -144,23 +192,35 @@ struct Accessor {
   uint32_t count = INVALID_COUNT;
   int32_t buffer_view = INVALID_INDEX;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Accessors {
   Array<Accessor> accessors;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Meshes
 struct Mesh {
   struct Primitive {
     struct Attribute {
-      StringBuffer key;
+      enum Semantic : uint8_t {
+        CUSTOM, // application specific, '_' prefixed, or unrecognised
+        POSITION,
+        NORMAL,
+        TANGENT,
+        TEXCOORD,
+        COLOR,
+        JOINTS,
+        WEIGHTS,
+      };
+      uint32_t key = StringPool::NONE; // id in glTF::strings, see Str
       int32_t accessor = INVALID_INDEX;
+      Semantic semantic = CUSTOM;
+      uint8_t set = 0; // n of TEXCOORD_n, COLOR_n, JOINTS_n and WEIGHTS_n
     };
     struct Target {
       Array<Attribute> attributes;
-      void fill(Json json);
+      void fill(const Json &json);
     };
 
     Array<Attribute> attributes;
@@ -169,23 +229,24 @@ struct Mesh {
     int32_t material = INVALID_INDEX;
     int32_t mode = INVALID_INDEX;
 
-    static void fill_attrib_array(Json json, Array<Attribute> *attributes);
-    void fill(Json json);
+    static void fill_attrib_array(const Json &json, Array<Attribute> *attributes);
+    void fill(const Json &json);
   };
   struct Extras {
-    Array<StringBuffer> target_names;
-    void fill(Json json);
+    Array<uint32_t> target_names; // ids in glTF::strings
+    void fill(const Json &json);
   };
 
   Array<Primitive> primitives;
   Array<float> weights;
   Extras extras;
+  uint32_t name = StringPool::NONE; // id in glTF::strings
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Meshes {
   Array<Mesh> meshes;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Skins
@@ -193,22 +254,22 @@ struct Skin {
   Array<int32_t> joints;
   int32_t i_bind_matrices = INVALID_INDEX;
   int32_t skeleton = INVALID_INDEX;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Skins {
   Array<Skin> skins;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Textures
 struct Texture {
   int32_t sampler = INVALID_INDEX;
   int32_t source = INVALID_INDEX;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Textures {
   Array<Texture> textures;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Images
@@ -221,12 +282,15 @@ struct Image {
   StringBuffer uri;
   MimeType mime_type = NONE;
   int32_t buffer_view = INVALID_INDEX;
+  // Encoded file bytes of a uri image, nullptr until loaded
+  uint8_t *data = nullptr;
+  uint32_t byte_length = 0;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Images {
   Array<Image> images;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Samplers
@@ -251,11 +315,11 @@ struct Sampler {
   Wrap wrap_s = Wrap::NONE;
   Wrap wrap_t = Wrap::NONE;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Samplers {
   Array<Sampler> samplers;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Materials
@@ -265,7 +329,7 @@ struct Material {
     int32_t index = INVALID_INDEX;
     int32_t tex_coord = INVALID_INDEX;
 
-    void fill_tex(Json json, const char* key);
+    void fill_tex(const Json &json, const char* key);
   };
   struct PbrMetallicRoughness {
     Array<float> base_color_factor;
@@ -274,7 +338,7 @@ struct Material {
     float metallic_factor = INVALID_FLOAT;
     float roughness_factor = INVALID_FLOAT;
 
-    void fill(Json json);
+    void fill(const Json &json);
   };
   enum AlphaMode {
     OPAQUE,
@@ -284,7 +348,7 @@ struct Material {
 
   PbrMetallicRoughness pbr_metallic_roughness;
   Array<float> emissive_factor;
-  StringBuffer name;
+  uint32_t name = StringPool::NONE; // id in glTF::strings
   MatTexture normal_texture;
   MatTexture occlusion_texture;
   MatTexture emissive_texture;
@@ -292,11 +356,11 @@ struct Material {
   float alpha_cutoff = INVALID_FLOAT;
   bool double_sided = false;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Materials {
   Array<Material> materials;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Cameras 
@@ -306,7 +370,7 @@ struct Camera {
     ORTHO,
     PERSPECTIVE,
   };
-  StringBuffer name;
+  uint32_t name = StringPool::NONE; // id in glTF::strings
   Type type = UNKNOWN;
   float aspect_ratio = INVALID_FLOAT;
   float yfov = INVALID_FLOAT;
@@ -315,11 +379,11 @@ struct Camera {
   float zfar = INVALID_FLOAT;
   float znear = INVALID_FLOAT;
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Cameras {
   Array<Camera> cameras;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // Animations
@@ -341,7 +405,7 @@ struct Animation {
     Target target;
     int32_t sampler = INVALID_INDEX;
 
-    void fill(Json json);
+    void fill(const Json &json);
   }; // Channel
 
   struct Sampler {
@@ -350,23 +414,23 @@ struct Animation {
       STEP,
       CUBICSPLINE,
     };
-    Interpolation interpolation;
+    Interpolation interpolation = LINEAR;
     int32_t input = INVALID_INDEX;
     int32_t output = INVALID_INDEX;
 
-    void fill(Json json);
+    void fill(const Json &json);
   }; // Sampler
 
   // NOTE: Accessor comp_type normalisation rules (see spec, right before "Specifying Extensions"...)
   Array<Channel> channels;
   Array<Sampler> samplers;
-  StringBuffer name;
+  uint32_t name = StringPool::NONE; // id in glTF::strings
 
-  void fill(Json json);
+  void fill(const Json &json);
 };
 struct Animations {
   Array<Animation> animations;
-  void fill(Json json);
+  void fill(const Json &json);
 };
 
 // glTF 
@@ -386,8 +450,49 @@ struct glTF {
   Cameras cameras;
   Animations animations;
 
-  void fill(Json json);
+  // Everything the document allocates lives in one block, sized by count() before filling.
+  // Each fill task gets its own slice of it.
+  LinearAllocator arena;
+  // Names and attribute keys, begins with KNOWN_STRINGS
+  StringPool strings;
+
+  enum Section {
+    ASSET, SCENES, NODES, BUFFERS, BUFFER_VIEWS, ACCESSORS, MESHES, SKINS, 
+    TEXTURES, IMAGES, SAMPLERS, MATERIALS, CAMERAS, ANIMATIONS, SECTION_COUNT,
+  };
+
+  // With a pool, sections (and ranges of the large ones) are filled in parallel
+  void fill(const Json &json, ThreadPool *pool = nullptr);
+  // Piecewise filling, for documents filled a part at a time (see LazyDocument). The arena and
+  // strings are created on first use and grow as parts arrive. fill_section takes an object
+  // holding at least the section's key(s). reserve_section makes count default elements of an
+  // array section, which fill_element then fills one at a time from the element's own json.
+  void fill_section(const Json &json, Section section);
+  void reserve_section(Section section, size_t count);
+  void fill_element(const Json &json, Section section, size_t index);
+  // free the arena and any loaded buffers, leaving an empty document
+  void kill();
+  // Same but keeps the arena's memory for the next fill
+  void clear();
+  // Bytes each section will allocate while filling (upper bound), returns the total including strings
+  static size_t count(const Json &json, size_t section_bytes[SECTION_COUNT]);
+  // "" for StringPool::NONE
+  const char* string(uint32_t id) { return strings.get(id); }
+
+  // Read each Buffer::uri (relative to dir) into Buffer::data, allocated from the system allocator
+  bool load_buffers(const char *dir);
+  bool load_buffer(size_t index, const char *dir);
+  // Every external buffer and image at once through reader. Whatever read in full stays loaded.
+  bool load_files(const char *dir, FileReader *reader);
+  // Frees Buffer::data and Image::data. Null them first if they belong to someone else.
+  void free_buffers();
+  // Pointer to the first element of an accessor in its loaded buffer, nullptr if it cannot be resolved.
+  // stride is set to the view's byte stride, or the tightly packed element size.
+  const uint8_t* accessor_data(int32_t accessor, uint32_t *stride);
 };
 
+uint32_t component_size(Accessor::ComponentType type);
+uint32_t type_width(Accessor::Type type);
+
 } // namespace glTF
 } // namespace Sol
@@ -6,9 +6,15 @@
 #include "Array.hpp"
 #include "String.hpp"
 #include "glTF.hpp"
+#include "ThreadPool.hpp"
+#include "Bake.hpp"
+#include "Validate.hpp"
+#include "PerfectHash.hpp"
 
+#include <chrono>
 #include <iostream>
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 using namespace Sol;
@@ -20,10 +26,96 @@ struct Thing {
 };
 
 using Json = nlohmann::json;
-int main() {
+
+// Cold (parse + fill) against warm (map the baked file, with and without checking its key) loads
+void bench_bake(const char *path, const char *bake_path, ThreadPool *pool) {
+  using Clock = std::chrono::steady_clock;
+  const uint32_t RUNS = 100;
+
+  glTF::glTF gltf;
+  Json json;
+  auto start = Clock::now();
+  for(uint32_t i = 0; i < RUNS; ++i) {
+    glTF::read_json(path, &json);
+    gltf.fill(json, pool);
+  }
+  double cold = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / RUNS;
+
+  uint64_t key = glTF::content_key(path, ".", &gltf);
+  bool ok = glTF::bake(&gltf, key, false, bake_path);
+  gltf.kill();
+  if (!ok) {
+    std::cout << "bench_bake: failed to write " << bake_path << '\n';
+    return;
+  }
+
+  glTF::BakedFile baked;
+  start = Clock::now();
+  for(uint32_t i = 0; i < RUNS; ++i) {
+    baked.open(bake_path);
+    baked.kill();
+  }
+  double warm = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / RUNS;
+
+  start = Clock::now();
+  for(uint32_t i = 0; i < RUNS; ++i) {
+    baked.open(bake_path);
+    ok = glTF::content_key(path, ".", baked.doc) == baked.doc->key;
+    baked.kill();
+  }
+  double keyed = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / RUNS;
+
+  std::cout << "bench_bake: cold " << cold << "us, warm " << warm << "us, warm + key check " << keyed 
+            << "us" << (ok ? "" : " (stale key)") << '\n';
+}
+
+// Enum string decoding: a perfect hash (as glTF::fill does it) against the strcmp chain it replaced
+void bench_decode() {
+  using Clock = std::chrono::steady_clock;
+  const uint32_t RUNS = 1 << 22;
+
+  constexpr HashKey KEYS[] = {
+    { "SCALAR", 0 }, { "VEC2", 1 }, { "VEC3", 2 }, { "VEC4", 3 }, { "MAT2", 4 }, { "MAT3", 5 }, { "MAT4", 6 },
+  };
+  constexpr auto TABLE = make_perfect_hash<16>(KEYS);
+  // Built at runtime so neither loop can be folded, the last one misses
+  std::string inputs[8] = { "SCALAR", "VEC2", "VEC3", "VEC4", "MAT2", "MAT3", "MAT4", "VEC5" };
+  volatile uint32_t sink = 0;
+
+  auto start = Clock::now();
+  for(uint32_t i = 0; i < RUNS; ++i) {
+    const std::string &str = inputs[i & 7];
+    sink += TABLE.find(str.data(), str.size(), 7);
+  }
+  double hashed = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / RUNS;
+
+  start = Clock::now();
+  for(uint32_t i = 0; i < RUNS; ++i) {
+    const char *str = inputs[i & 7].c_str();
+    uint32_t value = 7;
+    if (strcmp(str, "SCALAR") == 0) value = 0;
+    else if (strcmp(str, "VEC2") == 0) value = 1;
+    else if (strcmp(str, "VEC3") == 0) value = 2;
+    else if (strcmp(str, "VEC4") == 0) value = 3;
+    else if (strcmp(str, "MAT2") == 0) value = 4;
+    else if (strcmp(str, "MAT3") == 0) value = 5;
+    else if (strcmp(str, "MAT4") == 0) value = 6;
+    sink += value;
+  }
+  double chained = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / RUNS;
+
+  std::cout << "bench_decode: perfect hash " << hashed << "ns, strcmp chain " << chained << "ns per lookup\n";
+}
+
+int main(int argc, char **argv) {
+  // --bench runs the microbenchmarks after the normal load
+  bool bench = false;
+  for(int i = 1; i < argc; ++i)
+    if (strcmp(argv[i], "--bench") == 0)
+      bench = true;
+
   MemoryConfig mem_config;
   MemoryService::instance()->init(&mem_config);
-  MemoryService::instance()->scratch_allocator.init(1024 * 1024);
   
   Json json;
   bool ok = glTF::read_json("test_1.json", &json);
@@ -31,8 +123,21 @@ int main() {
   if (!ok) 
     ABORT(false, "File does not exist");
 
+  ThreadPool pool;
+  pool.init(0);
+
   glTF::glTF gltf;
-  gltf.fill(json);
+  gltf.fill(json, &pool);
+  glTF::Diagnostics diagnostics;
+  glTF::validate(&gltf, &diagnostics, glTF::Validation::FULL);
+  std::cout << "validate: " << diagnostics.errors << " errors, " << diagnostics.warnings << " warnings\n";
+  diagnostics.kill();
+  gltf.kill();
+  if (bench) {
+    bench_bake("test_1.json", "test_1.bake", &pool);
+    bench_decode();
+  }
+  pool.kill();
 
   MemoryService::instance()->shutdown();
   return 0;